@@ -60,48 +60,216 @@
 
 #include "../../core/snmp.h"
 
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+# define AES_HW_AESNI
+# include <cpuid.h>
+# include <wmmintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRYPTO) && defined(__linux__)
+# define AES_HW_ARMV8
+# include <arm_neon.h>
+# include <sys/auxv.h>
+# include <asm/hwcap.h>
+#endif
+
+#define AES_ROUNDS 10
+
+/* CFB128 over an expanded AES-128 key schedule, in place is fine */
+typedef void (*aes_cfb_f)(const unsigned char *sched, unsigned char *iv,
+                          const unsigned char *in, unsigned char *out,
+                          size_t len, int enc);
+
+/* Portable table driven cipher */
+static void
+aes_cfb_soft(const unsigned char *sched, unsigned char *iv,
+             const unsigned char *in, unsigned char *out,
+             size_t len, int enc)
+{
+  AES_KEY aes_key;
+  int num = 0, i;
+
+  for (i = 0; i < 4 * (AES_ROUNDS + 1); i++) {
+    aes_key.rd_key[i] = GETU32(sched + 4 * i);
+  }
+  aes_key.rounds = AES_ROUNDS;
+  AES_cfb128_encrypt(in, out, len, &aes_key, iv, &num, enc);
+}
+
+#ifdef AES_HW_AESNI
+/* AES-NI cipher */
+__attribute__((target("aes,sse2")))
+static void
+aes_cfb_hw(const unsigned char *sched, unsigned char *iv,
+           const unsigned char *in, unsigned char *out,
+           size_t len, int enc)
+{
+  __m128i rk[AES_ROUNDS + 1], b, c;
+  unsigned char tail[16];
+  size_t i;
+  int r;
+
+  for (r = 0; r <= AES_ROUNDS; r++) {
+    rk[r] = _mm_loadu_si128((const __m128i *)(sched + 16 * r));
+  }
+
+  b = _mm_loadu_si128((const __m128i *)iv);
+  for (; len > 0; in += 16, out += 16) {
+    b = _mm_xor_si128(b, rk[0]);
+    for (r = 1; r < AES_ROUNDS; r++) {
+      b = _mm_aesenc_si128(b, rk[r]);
+    }
+    b = _mm_aesenclast_si128(b, rk[AES_ROUNDS]);
+
+    if (len < 16) {
+      /* Last partial block */
+      _mm_storeu_si128((__m128i *)tail, b);
+      for (i = 0; i < len; i++) {
+        out[i] = in[i] ^ tail[i];
+      }
+      break;
+    }
+
+    c = _mm_loadu_si128((const __m128i *)in);
+    _mm_storeu_si128((__m128i *)out, _mm_xor_si128(b, c));
+    b = enc ? _mm_xor_si128(b, c) : c;
+    len -= 16;
+  }
+}
+
+static int
+aes_hw_supported(void)
+{
+  unsigned int a, b, c, d;
+
+  return __get_cpuid(1, &a, &b, &c, &d) && (c & bit_AES) && (d & bit_SSE2);
+}
+#endif
+
+#ifdef AES_HW_ARMV8
+/* ARMv8 crypto extension cipher */
+static void
+aes_cfb_hw(const unsigned char *sched, unsigned char *iv,
+           const unsigned char *in, unsigned char *out,
+           size_t len, int enc)
+{
+  uint8x16_t rk[AES_ROUNDS + 1], b, c;
+  unsigned char tail[16];
+  size_t i;
+  int r;
+
+  for (r = 0; r <= AES_ROUNDS; r++) {
+    rk[r] = vld1q_u8(sched + 16 * r);
+  }
+
+  b = vld1q_u8(iv);
+  for (; len > 0; in += 16, out += 16) {
+    for (r = 0; r < AES_ROUNDS - 1; r++) {
+      b = vaesmcq_u8(vaeseq_u8(b, rk[r]));
+    }
+    b = veorq_u8(vaeseq_u8(b, rk[AES_ROUNDS - 1]), rk[AES_ROUNDS]);
+
+    if (len < 16) {
+      /* Last partial block */
+      vst1q_u8(tail, b);
+      for (i = 0; i < len; i++) {
+        out[i] = in[i] ^ tail[i];
+      }
+      break;
+    }
+
+    c = vld1q_u8(in);
+    vst1q_u8(out, veorq_u8(b, c));
+    b = enc ? veorq_u8(b, c) : c;
+    len -= 16;
+  }
+}
+
+static int
+aes_hw_supported(void)
+{
+  return (getauxval(AT_HWCAP) & HWCAP_AES) != 0;
+}
+#endif
+
+/* Cipher picked by cpu features at first use */
+static aes_cfb_f
+aes_cfb(void)
+{
+  static aes_cfb_f cfb;
+
+  if (cfb == NULL) {
+#if defined(AES_HW_AESNI) || defined(AES_HW_ARMV8)
+    cfb = aes_hw_supported() ? aes_cfb_hw : aes_cfb_soft;
+#else
+    cfb = aes_cfb_soft;
+#endif
+  }
+  return cfb;
+}
+
 /*******************************************************************
- * AES_Encrypt
+ * AES_Schedule
  *
  * Parameters:
  *	*key		    Key bits for crypting.
  *	 keylen		  Length of key (buffer) in bytes.
+ *	*sched		  Round keys, AES_SCHED_LEN bytes.
+ *
+ * Expand key into round keys once for AES_Encrypt and AES_Decrypt.
+ * Round keys are kept in byte order so that hardware ciphers use them
+ * as they are.
+ */
+void
+AES_Schedule(const unsigned char *key, unsigned int keylen, unsigned char *sched)
+{
+  AES_KEY aes_key;
+  int i;
+
+  if (!key || !sched || keylen < AES_SECRETKEYLEN) {
+    return;
+  }
+
+  AES_set_encrypt_key(key, AES_SECRETKEYLEN * 8, &aes_key);
+  for (i = 0; i < 4 * (AES_ROUNDS + 1); i++) {
+    PUTU32(sched + 4 * i, aes_key.rd_key[i]);
+  }
+}
+
+/*******************************************************************
+ * AES_Encrypt
+ *
+ * Parameters:
+ *	*sched		  Round keys given by AES_Schedule.
  *	*iv		      IV bits for crypting.
  *	 ivlen		  Length of iv (buffer) in bytes.
  *	*plaintext	Plaintext to crypt.
  *	 ptlen		  Length of plaintext.
- *	*ciphertext	Ciphertext to crypt.
+ *	*ciphertext	Ciphertext to crypt, may be plaintext.
  *	*ctlen		  Length of ciphertext.
  *
- * Encrypt plaintext into ciphertext using key and iv.
+ * Encrypt plaintext into ciphertext using round keys and iv.
  *
  * ctlen contains actual number of crypted bytes in ciphertext upon
  * successful return.
  */
 void
-AES_Encrypt(const unsigned char *key, unsigned int keylen,
+AES_Encrypt(const unsigned char *sched,
             const unsigned char *iv, unsigned int ivlen,
             const unsigned char *plaintext, unsigned int ptlen,
             unsigned char *ciphertext, unsigned int *ctlen)
 {
-  unsigned char   my_iv[AES_SECRETKEYLEN * 8];
-  int             new_ivlen = 0;
-  AES_KEY         aes_key;
+  unsigned char   my_iv[AES_SECRETKEYLEN];
 
-  if (!key || !iv || !plaintext || !ciphertext || !ctlen ||
+  if (!sched || !iv || !plaintext || !ciphertext || !ctlen ||
       ptlen <= 0 || *ctlen <= 0 || ptlen > *ctlen ||
-      keylen < AES_SECRETKEYLEN || ivlen < AES_SECRETKEYLEN) {
+      ivlen < AES_SECRETKEYLEN) {
     return;
   }
 
-  memset(my_iv, 0, sizeof(my_iv));
-  AES_set_encrypt_key(key, AES_SECRETKEYLEN * 8, &aes_key);
-  memcpy(my_iv, iv, ivlen);
+  memcpy(my_iv, iv, AES_SECRETKEYLEN);
   /*
    * encrypt the data 
    */
-  AES_cfb128_encrypt(plaintext, ciphertext, ptlen,
-                     &aes_key, my_iv, &new_ivlen, AES_ENCRYPT);
+  aes_cfb()(sched, my_iv, plaintext, ciphertext, ptlen, AES_ENCRYPT);
   *ctlen = ptlen;
 }
 
@@ -109,43 +277,35 @@ AES_Encrypt(const unsigned char *key, unsigned int keylen,
  * AES_Decrypt
  *
  * Parameters:
- *	*key		    Key bits for crypting.
- *	 keylen		  Length of key (buffer) in bytes.
+ *	*sched		  Round keys given by AES_Schedule.
  *	*iv		      IV bits for crypting.
  *	 ivlen		  Length of iv (buffer) in bytes.
  *	*ciphertext	Ciphertext to crypt.
  *	*ctlen		  Length of ciphertext.
- *	*plaintext	Plaintext to crypt.
+ *	*plaintext	Plaintext to crypt, may be ciphertext.
  *	 ptlen		  Length of plaintext.
  *
- * Decrypt ciphertext into plaintext using key and iv.
+ * Decrypt ciphertext into plaintext using round keys and iv.
  *
  * ptlen contains actual number of plaintext bytes in plaintext upon
  * successful return.
  */
 void
-AES_Decrypt(const unsigned char *key, unsigned int keylen,
+AES_Decrypt(const unsigned char *sched,
             const unsigned char *iv, unsigned int ivlen,
             const unsigned char *ciphertext, unsigned int ctlen,
             unsigned char *plaintext, unsigned int *ptlen)
 {
-  unsigned char   my_iv[AES_SECRETKEYLEN * 8];
-  int new_ivlen = 0;
-  AES_KEY aes_key;
+  unsigned char   my_iv[AES_SECRETKEYLEN];
 
-  if (!key || !iv || !plaintext || !ciphertext || !ptlen ||
+  if (!sched || !iv || !plaintext || !ciphertext || !ptlen ||
       ctlen <= 0 || *ptlen <= 0 || ctlen > *ptlen ||
-      keylen < AES_SECRETKEYLEN || ivlen < AES_SECRETKEYLEN) {
+      ivlen < AES_SECRETKEYLEN) {
     return;
   }
 
-  memset(my_iv, 0, sizeof(my_iv));
-  memcpy(my_iv, iv, ivlen);
-
-  /* set key */
-  AES_set_encrypt_key(key, AES_SECRETKEYLEN * 8, &aes_key);
-  /* encrypt the data */
-  AES_cfb128_encrypt(ciphertext, plaintext, ctlen,
-                     &aes_key, my_iv, &new_ivlen, AES_DECRYPT);
+  memcpy(my_iv, iv, AES_SECRETKEYLEN);
+  /* decrypt the data */
+  aes_cfb()(sched, my_iv, ciphertext, plaintext, ctlen, AES_DECRYPT);
   *ptlen = ctlen;
 }
@@ -0,0 +1,104 @@
+/*
+ * This file is part of SmithSNMP
+ * Copyright (C) 2014, Credo Semiconductor Inc.
+ * Copyright (C) 2015, Leo Ma <begeekmyfriend@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ */
+
+
+/*
+ * Lanes of the multi-buffer MD5 and SHA-1 engines. Up to MB_LANES
+ * independent messages are hashed together, one 32-bit word of each
+ * message per vector lane. Vectors use the GCC vector extension, so the
+ * same code runs on AVX2, on SSE2 or NEON in two halves, or on scalar
+ * registers.
+ */
+
+#ifndef _OPENSSL_MB_LOCAL_H_
+#define _OPENSSL_MB_LOCAL_H_
+
+#include <stdint.h>
+#include <string.h>
+
+#define MB_LANES  8
+#define MB_BLOCK  64
+/* Fewest messages worth a vector of lanes, less are hashed one by one */
+#define MB_MIN_LANES_AVX2  3
+#define MB_MIN_LANES       6
+
+#if defined(__GNUC__)
+# define MB_VECTOR
+typedef uint32_t mb_u32 __attribute__((vector_size(MB_LANES * 4)));
+# define MB_ROTL(v, n)  (((v) << (n)) | ((v) >> (32 - (n))))
+# if defined(__x86_64__) || defined(__i386__)
+#  define MB_HW_AVX2
+# endif
+#endif
+
+/* Message of one lane, the blocks behind the last full one are padded
+ * in tail */
+struct mb_lane {
+  const unsigned char *data;
+  size_t full;
+  size_t blocks;
+  unsigned char tail[2 * MB_BLOCK];
+};
+
+/* Pad the message of lane, prefix bytes have been hashed before it */
+static inline void
+mb_lane_init(struct mb_lane *lane, const unsigned char *data, size_t len,
+             size_t prefix, int big_endian)
+{
+  uint64_t bits = (uint64_t)(prefix + len) * 8;
+  size_t rem = len % MB_BLOCK, end;
+  int i;
+
+  lane->data = data;
+  lane->full = len / MB_BLOCK;
+  lane->blocks = lane->full + (rem < MB_BLOCK - 8 ? 1 : 2);
+
+  end = (lane->blocks - lane->full) * MB_BLOCK;
+  memset(lane->tail, 0, end);
+  memcpy(lane->tail, data + lane->full * MB_BLOCK, rem);
+  lane->tail[rem] = 0x80;
+  for (i = 0; i < 8; i++) {
+    lane->tail[end - 8 + i] = big_endian ? bits >> (56 - 8 * i) : bits >> (8 * i);
+  }
+}
+
+/* Block b of lane, NULL when the lane has finished */
+static inline const unsigned char *
+mb_lane_block(const struct mb_lane *lane, size_t b)
+{
+  if (b < lane->full) {
+    return lane->data + b * MB_BLOCK;
+  } else if (b < lane->blocks) {
+    return lane->tail + (b - lane->full) * MB_BLOCK;
+  }
+  return NULL;
+}
+
+#ifdef MB_HW_AVX2
+static inline int
+mb_avx2_supported(void)
+{
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx2");
+}
+#endif
+
+#endif /* _OPENSSL_MB_LOCAL_H_ */
@@ -332,3 +332,76 @@ update_end:
 
   return rc;
 }
+
+/*
+ * MD5_hmac_prepare(secret, ipad, opad): hash the ipad and opad blocks of
+ * the key once, so that each message only costs hashing itself.
+ */
+void
+MD5_hmac_prepare(const unsigned char *secret,  /* IN  - pointer to usrAuthKey */
+                 size_t secretlen,             /* IN  - length of usrAuthKey */
+                 uint32_t *ipad,               /* OUT - hash state after ipad block */
+                 uint32_t *opad)               /* OUT - hash state after opad block */
+{
+  MD5_CTX        MD;
+  unsigned char  K[MD5_HASHKEYLEN];
+  size_t         i;
+
+  memset(K, 0, MD5_HASHKEYLEN);
+  memcpy(K, secret, secretlen < MD5_HASHKEYLEN ? secretlen : MD5_HASHKEYLEN);
+
+  for (i = 0; i < MD5_HASHKEYLEN; i++)
+      K[i] ^= 0x36;
+  MD5_Init(&MD);
+  MD5_Update(&MD, K, MD5_HASHKEYLEN);
+  ipad[0] = MD.A; ipad[1] = MD.B; ipad[2] = MD.C; ipad[3] = MD.D;
+
+  for (i = 0; i < MD5_HASHKEYLEN; i++)
+      K[i] ^= 0x36 ^ 0x5c;
+  MD5_Init(&MD);
+  MD5_Update(&MD, K, MD5_HASHKEYLEN);
+  opad[0] = MD.A; opad[1] = MD.B; opad[2] = MD.C; opad[3] = MD.D;
+
+  memset(K, 0, MD5_HASHKEYLEN);
+}
+
+/* Resume hashing after the pad block of state */
+static void
+MD5_hmac_resume(MD5_CTX *MD, const uint32_t *state)
+{
+  memset(MD, 0, sizeof(*MD));
+  MD->A = state[0]; MD->B = state[1]; MD->C = state[2]; MD->D = state[3];
+  MD->Nl = MD5_HASHKEYLEN * 8;
+}
+
+/*
+ * MD5_hmac_prepared(data, len, mac, maclen, ipad, opad): MD5_hmac with
+ * the pad states given by MD5_hmac_prepare.
+ */
+int
+MD5_hmac_prepared(const unsigned char *data,  /* IN  - pointer to message */
+                  size_t len,                 /* IN  - length of messege */
+                  unsigned char *mac,         /* OUT - pointer to caller 16-octet buffer */
+                  size_t maclen,              /* IN  - length of mac */
+                  const uint32_t *ipad,       /* IN  - hash state after ipad block */
+                  const uint32_t *opad)       /* IN  - hash state after opad block */
+{
+  MD5_CTX        MD;
+  unsigned char  buf[MD5_SECRETKEYLEN];
+
+  if (mac == NULL || data == NULL || len <= 0 ||
+      maclen <= 0 || maclen > MD5_SECRETKEYLEN) {
+      return -1;
+  }
+
+  MD5_hmac_resume(&MD, ipad);
+  MD5_Update(&MD, data, len);
+  MD5_Final(buf, &MD);
+
+  MD5_hmac_resume(&MD, opad);
+  MD5_Update(&MD, buf, MD5_SECRETKEYLEN);
+  MD5_Final(buf, &MD);
+  memcpy(mac, buf, maclen);
+
+  return 0;
+}
@@ -0,0 +1,254 @@
+/*
+ * This file is part of SmithSNMP
+ * Copyright (C) 2014, Credo Semiconductor Inc.
+ * Copyright (C) 2015, Leo Ma <begeekmyfriend@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ */
+
+
+/*
+ * Multi-buffer HMAC-MD5, the messages of a batch are hashed together in
+ * the lanes of one vector, see openssl_mb_local.h.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "openssl_md5.h"
+#include "openssl_mb_local.h"
+
+#include "../../core/snmp.h"
+
+#ifdef MB_VECTOR
+static const uint32_t md5_k[64] = {
+  0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee, 0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501,
+  0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be, 0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821,
+  0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa, 0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+  0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed, 0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a,
+  0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c, 0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70,
+  0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05, 0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+  0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039, 0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
+  0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1, 0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391,
+};
+
+static const unsigned char md5_s[4][4] = {
+  { 7, 12, 17, 22 }, { 5, 9, 14, 20 }, { 4, 11, 16, 23 }, { 6, 10, 15, 21 },
+};
+
+/* Word of the message block used by each step */
+static const unsigned char md5_g[64] = {
+  0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15,
+  1, 6, 11, 0, 5, 10, 15, 4, 9, 14, 3, 8, 13, 2, 7, 12,
+  5, 8, 11, 14, 1, 4, 7, 10, 13, 0, 3, 6, 9, 12, 15, 2,
+  0, 7, 14, 5, 12, 3, 10, 1, 8, 15, 6, 13, 4, 11, 2, 9,
+};
+
+/* One block of each lane, state of lanes out of mask is kept */
+static inline __attribute__((always_inline)) void
+md5_mb_body(uint32_t st[4][MB_LANES], const uint32_t w[16][MB_LANES], const uint32_t mask[MB_LANES])
+{
+  mb_u32 a, b, c, d, f, t, m, h[4], x[16];
+  int i;
+
+  for (i = 0; i < 4; i++) {
+    memcpy(&h[i], st[i], sizeof(mb_u32));
+  }
+  for (i = 0; i < 16; i++) {
+    memcpy(&x[i], w[i], sizeof(mb_u32));
+  }
+  memcpy(&m, mask, sizeof(mb_u32));
+
+  a = h[0]; b = h[1]; c = h[2]; d = h[3];
+  for (i = 0; i < 64; i++) {
+    switch (i >> 4) {
+    case 0:
+      f = d ^ (b & (c ^ d));
+      break;
+    case 1:
+      f = c ^ (d & (b ^ c));
+      break;
+    case 2:
+      f = b ^ c ^ d;
+      break;
+    default:
+      f = c ^ (b | ~d);
+      break;
+    }
+    t = a + f + md5_k[i] + x[md5_g[i]];
+    a = d; d = c; c = b;
+    b += MB_ROTL(t, md5_s[i >> 4][i & 3]);
+  }
+
+  h[0] = (h[0] & ~m) | ((h[0] + a) & m);
+  h[1] = (h[1] & ~m) | ((h[1] + b) & m);
+  h[2] = (h[2] & ~m) | ((h[2] + c) & m);
+  h[3] = (h[3] & ~m) | ((h[3] + d) & m);
+  for (i = 0; i < 4; i++) {
+    memcpy(st[i], &h[i], sizeof(mb_u32));
+  }
+}
+
+typedef void (*md5_mb_block_f)(uint32_t st[4][MB_LANES], const uint32_t w[16][MB_LANES], const uint32_t mask[MB_LANES]);
+
+static void
+md5_mb_block_soft(uint32_t st[4][MB_LANES], const uint32_t w[16][MB_LANES], const uint32_t mask[MB_LANES])
+{
+  md5_mb_body(st, w, mask);
+}
+
+#ifdef MB_HW_AVX2
+__attribute__((target("avx2")))
+static void
+md5_mb_block_avx2(uint32_t st[4][MB_LANES], const uint32_t w[16][MB_LANES], const uint32_t mask[MB_LANES])
+{
+  md5_mb_body(st, w, mask);
+}
+#endif
+
+/* Block function picked by cpu features at first use, min_lanes is the
+ * fewest messages it is worth for */
+static md5_mb_block_f
+md5_mb_block(unsigned int *min_lanes)
+{
+  static md5_mb_block_f block;
+  static unsigned int min;
+
+  if (block == NULL) {
+#ifdef MB_HW_AVX2
+    if (mb_avx2_supported()) {
+      block = md5_mb_block_avx2;
+      min = MB_MIN_LANES_AVX2;
+    } else {
+      block = md5_mb_block_soft;
+      min = MB_MIN_LANES;
+    }
+#else
+    block = md5_mb_block_soft;
+    min = MB_MIN_LANES;
+#endif
+  }
+  if (min_lanes != NULL) {
+    *min_lanes = min;
+  }
+  return block;
+}
+
+static inline uint32_t
+md5_mb_load(const unsigned char *p)
+{
+  return p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+/* HMAC of up to MB_LANES messages */
+static void
+md5_mb_hmac(const struct hmac_job *jobs, unsigned int n, size_t maclen)
+{
+  static const unsigned char zero[MB_BLOCK];
+  md5_mb_block_f block = md5_mb_block(NULL);
+  struct mb_lane lanes[MB_LANES];
+  uint32_t st[4][MB_LANES], w[16][MB_LANES], mask[MB_LANES];
+  unsigned char digest[MD5_DIGEST_LENGTH];
+  size_t b, blocks = 0;
+  unsigned int l;
+  int i;
+
+  /* Inner hash, resumed after the ipad block */
+  memset(st, 0, sizeof(st));
+  for (l = 0; l < n; l++) {
+    mb_lane_init(&lanes[l], jobs[l].data, jobs[l].len, MD5_CBLOCK, 0);
+    if (lanes[l].blocks > blocks) {
+      blocks = lanes[l].blocks;
+    }
+    for (i = 0; i < 4; i++) {
+      st[i][l] = jobs[l].ipad[i];
+    }
+  }
+
+  for (b = 0; b < blocks; b++) {
+    for (l = 0; l < MB_LANES; l++) {
+      const unsigned char *p = l < n ? mb_lane_block(&lanes[l], b) : NULL;
+      mask[l] = p != NULL ? 0xffffffff : 0;
+      if (p == NULL) {
+        p = zero;
+      }
+      for (i = 0; i < 16; i++) {
+        w[i][l] = md5_mb_load(p + 4 * i);
+      }
+    }
+    block(st, (const uint32_t (*)[MB_LANES])w, mask);
+  }
+
+  /* Outer hash of the inner digest, one block for every lane */
+  memset(w, 0, sizeof(w));
+  for (l = 0; l < n; l++) {
+    for (i = 0; i < 4; i++) {
+      w[i][l] = st[i][l];
+      st[i][l] = jobs[l].opad[i];
+    }
+    w[4][l] = 0x80;
+    w[14][l] = (MD5_CBLOCK + MD5_DIGEST_LENGTH) * 8;
+    mask[l] = 0xffffffff;
+  }
+  block(st, (const uint32_t (*)[MB_LANES])w, mask);
+
+  for (l = 0; l < n; l++) {
+    for (i = 0; i < 16; i++) {
+      digest[i] = st[i / 4][l] >> (8 * (i % 4));
+    }
+    memcpy(jobs[l].mac, digest, maclen);
+  }
+}
+#endif
+
+/*
+ * MD5_hmac_prepared_mb(jobs, n, maclen): MD5_hmac_prepared of n
+ * independent messages, several at a time in vector lanes.
+ */
+int
+MD5_hmac_prepared_mb(const struct hmac_job *jobs,  /* IN  - messages, pad states and mac buffers */
+                     unsigned int n,               /* IN  - number of messages */
+                     size_t maclen)                /* IN  - length of each mac */
+{
+  unsigned int i, cnt, min_lanes = MB_LANES + 1;
+
+  if (jobs == NULL || maclen <= 0 || maclen > MD5_SECRETKEYLEN) {
+    return -1;
+  }
+  for (i = 0; i < n; i++) {
+    if (jobs[i].data == NULL || jobs[i].len <= 0 || jobs[i].mac == NULL) {
+      return -1;
+    }
+  }
+
+#ifdef MB_VECTOR
+  md5_mb_block(&min_lanes);
+#endif
+
+  for (i = 0; i < n; i += cnt) {
+    cnt = n - i < MB_LANES ? n - i : MB_LANES;
+#ifdef MB_VECTOR
+    if (cnt >= min_lanes) {
+      md5_mb_hmac(jobs + i, cnt, maclen);
+      continue;
+    }
+#endif
+    MD5_hmac_prepared(jobs[i].data, jobs[i].len, jobs[i].mac, maclen, jobs[i].ipad, jobs[i].opad);
+    cnt = 1;
+  }
+
+  return 0;
+}
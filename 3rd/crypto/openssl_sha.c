@@ -200,3 +200,76 @@ update_end:
 
   return rc;
 }
+
+/*
+ * SHA1_hmac_prepare(secret, ipad, opad): hash the ipad and opad blocks of
+ * the key once, so that each message only costs hashing itself.
+ */
+void
+SHA1_hmac_prepare(const unsigned char *secret,  /* IN  - pointer to usrAuthKey */
+                  size_t secretlen,             /* IN  - length of usrAuthKey */
+                  uint32_t *ipad,               /* OUT - hash state after ipad block */
+                  uint32_t *opad)               /* OUT - hash state after opad block */
+{
+  SHA_CTX        SH;
+  unsigned char  K[SHA1_HASHKEYLEN];
+  size_t         i;
+
+  memset(K, 0, SHA1_HASHKEYLEN);
+  memcpy(K, secret, secretlen < SHA1_HASHKEYLEN ? secretlen : SHA1_HASHKEYLEN);
+
+  for (i = 0; i < SHA1_HASHKEYLEN; i++)
+      K[i] ^= 0x36;
+  SHA1_Init(&SH);
+  SHA1_Update(&SH, K, SHA1_HASHKEYLEN);
+  ipad[0] = SH.h0; ipad[1] = SH.h1; ipad[2] = SH.h2; ipad[3] = SH.h3; ipad[4] = SH.h4;
+
+  for (i = 0; i < SHA1_HASHKEYLEN; i++)
+      K[i] ^= 0x36 ^ 0x5c;
+  SHA1_Init(&SH);
+  SHA1_Update(&SH, K, SHA1_HASHKEYLEN);
+  opad[0] = SH.h0; opad[1] = SH.h1; opad[2] = SH.h2; opad[3] = SH.h3; opad[4] = SH.h4;
+
+  memset(K, 0, SHA1_HASHKEYLEN);
+}
+
+/* Resume hashing after the pad block of state */
+static void
+SHA1_hmac_resume(SHA_CTX *SH, const uint32_t *state)
+{
+  memset(SH, 0, sizeof(*SH));
+  SH->h0 = state[0]; SH->h1 = state[1]; SH->h2 = state[2]; SH->h3 = state[3]; SH->h4 = state[4];
+  SH->Nl = SHA1_HASHKEYLEN * 8;
+}
+
+/*
+ * SHA1_hmac_prepared(data, len, mac, maclen, ipad, opad): SHA1_hmac with
+ * the pad states given by SHA1_hmac_prepare.
+ */
+int
+SHA1_hmac_prepared(const unsigned char *data,  /* IN  - pointer to message */
+                   size_t len,                 /* IN  - length of messege */
+                   unsigned char *mac,         /* OUT - pointer to caller 20-octet buffer */
+                   size_t maclen,              /* IN  - length of mac */
+                   const uint32_t *ipad,       /* IN  - hash state after ipad block */
+                   const uint32_t *opad)       /* IN  - hash state after opad block */
+{
+  SHA_CTX        SH;
+  unsigned char  buf[SHA1_SECRETKEYLEN];
+
+  if (mac == NULL || data == NULL || len <= 0 ||
+      maclen <= 0 || maclen > SHA1_SECRETKEYLEN) {
+      return -1;
+  }
+
+  SHA1_hmac_resume(&SH, ipad);
+  SHA1_Update(&SH, data, len);
+  SHA1_Final(buf, &SH);
+
+  SHA1_hmac_resume(&SH, opad);
+  SHA1_Update(&SH, buf, SHA1_SECRETKEYLEN);
+  SHA1_Final(buf, &SH);
+  memcpy(mac, buf, maclen);
+
+  return 0;
+}
@@ -0,0 +1,666 @@
+/*
+ * This file is part of SmithSNMP
+ * Copyright (C) 2014, Credo Semiconductor Inc.
+ * Copyright (C) 2015, Leo Ma <begeekmyfriend@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ */
+
+
+/*
+ * SHA-224/256/384/512 digests (FIPS 180-4) and their HMAC based USM
+ * authentication of RFC 7860. SHA-224/256 blocks run on the SHA
+ * extensions of x86 when the CPU has them.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "openssl_sha.h"
+
+#include "../../core/snmp.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+# define SHA256_HW_SHANI
+# include <cpuid.h>
+# include <immintrin.h>
+# ifndef bit_SHA
+#  define bit_SHA (1 << 29)
+# endif
+#endif
+
+#define ROR32(x, n)  (((x) >> (n)) | ((x) << (32 - (n))))
+#define ROR64(x, n)  (((x) >> (n)) | ((x) << (64 - (n))))
+
+static const uint32_t K256[64] = {
+  0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+  0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+  0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+  0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+  0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+  0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+  0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+  0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+static const uint64_t K512[80] = {
+  U64(0x428a2f98d728ae22), U64(0x7137449123ef65cd), U64(0xb5c0fbcfec4d3b2f), U64(0xe9b5dba58189dbbc),
+  U64(0x3956c25bf348b538), U64(0x59f111f1b605d019), U64(0x923f82a4af194f9b), U64(0xab1c5ed5da6d8118),
+  U64(0xd807aa98a3030242), U64(0x12835b0145706fbe), U64(0x243185be4ee4b28c), U64(0x550c7dc3d5ffb4e2),
+  U64(0x72be5d74f27b896f), U64(0x80deb1fe3b1696b1), U64(0x9bdc06a725c71235), U64(0xc19bf174cf692694),
+  U64(0xe49b69c19ef14ad2), U64(0xefbe4786384f25e3), U64(0x0fc19dc68b8cd5b5), U64(0x240ca1cc77ac9c65),
+  U64(0x2de92c6f592b0275), U64(0x4a7484aa6ea6e483), U64(0x5cb0a9dcbd41fbd4), U64(0x76f988da831153b5),
+  U64(0x983e5152ee66dfab), U64(0xa831c66d2db43210), U64(0xb00327c898fb213f), U64(0xbf597fc7beef0ee4),
+  U64(0xc6e00bf33da88fc2), U64(0xd5a79147930aa725), U64(0x06ca6351e003826f), U64(0x142929670a0e6e70),
+  U64(0x27b70a8546d22ffc), U64(0x2e1b21385c26c926), U64(0x4d2c6dfc5ac42aed), U64(0x53380d139d95b3df),
+  U64(0x650a73548baf63de), U64(0x766a0abb3c77b2a8), U64(0x81c2c92e47edaee6), U64(0x92722c851482353b),
+  U64(0xa2bfe8a14cf10364), U64(0xa81a664bbc423001), U64(0xc24b8b70d0f89791), U64(0xc76c51a30654be30),
+  U64(0xd192e819d6ef5218), U64(0xd69906245565a910), U64(0xf40e35855771202a), U64(0x106aa07032bbd1b8),
+  U64(0x19a4c116b8d2d0c8), U64(0x1e376c085141ab53), U64(0x2748774cdf8eeb99), U64(0x34b0bcb5e19b48a8),
+  U64(0x391c0cb3c5c95a63), U64(0x4ed8aa4ae3418acb), U64(0x5b9cca4f7763e373), U64(0x682e6ff3d6b2b8a3),
+  U64(0x748f82ee5defb2fc), U64(0x78a5636f43172f60), U64(0x84c87814a1f0ab72), U64(0x8cc702081a6439ec),
+  U64(0x90befffa23631e28), U64(0xa4506cebde82bde9), U64(0xbef9a3f7b2c67915), U64(0xc67178f2e372532b),
+  U64(0xca273eceea26619c), U64(0xd186b8c721c0c207), U64(0xeada7dd6cde0eb1e), U64(0xf57d4f7fee6ed178),
+  U64(0x06f067aa72176fba), U64(0x0a637dc5a2c898a6), U64(0x113f9804bef90dae), U64(0x1b710b35131c471b),
+  U64(0x28db77f523047d84), U64(0x32caab7b40c72493), U64(0x3c9ebe0a15c9bebc), U64(0x431d67c49c100d4c),
+  U64(0x4cc5d4becb3e42b6), U64(0x597f299cfc657e2a), U64(0x5fcb6fab3ad6faec), U64(0x6c44198c4a475817),
+};
+
+static inline uint32_t
+load_be32(const unsigned char *p)
+{
+  return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static inline uint64_t
+load_be64(const unsigned char *p)
+{
+  return ((uint64_t)load_be32(p) << 32) | load_be32(p + 4);
+}
+
+static inline void
+store_be32(unsigned char *p, uint32_t v)
+{
+  p[0] = v >> 24; p[1] = v >> 16; p[2] = v >> 8; p[3] = v;
+}
+
+static inline void
+store_be64(unsigned char *p, uint64_t v)
+{
+  store_be32(p, v >> 32);
+  store_be32(p + 4, v);
+}
+
+/* Portable SHA-256 compression of num blocks */
+static void
+sha256_blocks_soft(SHA_LONG *h, const unsigned char *in, size_t num)
+{
+  uint32_t a, b, c, d, e, f, g, k, t1, t2, w[64];
+  int i;
+
+  for (; num > 0; num--, in += SHA256_CBLOCK) {
+    for (i = 0; i < 16; i++) {
+      w[i] = load_be32(in + 4 * i);
+    }
+    for (; i < 64; i++) {
+      t1 = ROR32(w[i - 2], 17) ^ ROR32(w[i - 2], 19) ^ (w[i - 2] >> 10);
+      t2 = ROR32(w[i - 15], 7) ^ ROR32(w[i - 15], 18) ^ (w[i - 15] >> 3);
+      w[i] = t1 + w[i - 7] + t2 + w[i - 16];
+    }
+
+    a = h[0]; b = h[1]; c = h[2]; d = h[3];
+    e = h[4]; f = h[5]; g = h[6]; k = h[7];
+    for (i = 0; i < 64; i++) {
+      t1 = k + (ROR32(e, 6) ^ ROR32(e, 11) ^ ROR32(e, 25)) + ((e & f) ^ (~e & g)) + K256[i] + w[i];
+      t2 = (ROR32(a, 2) ^ ROR32(a, 13) ^ ROR32(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+      k = g; g = f; f = e; e = d + t1;
+      d = c; c = b; b = a; a = t1 + t2;
+    }
+    h[0] += a; h[1] += b; h[2] += c; h[3] += d;
+    h[4] += e; h[5] += f; h[6] += g; h[7] += k;
+  }
+}
+
+#ifdef SHA256_HW_SHANI
+/* SHA-256 compression of num blocks on SHA extensions */
+__attribute__((target("sha,sse4.1,ssse3")))
+static void
+sha256_blocks_hw(SHA_LONG *h, const unsigned char *in, size_t num)
+{
+  const __m128i mask = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+  __m128i state0, state1, abef, cdgh, msg, tmp, w[4];
+  int i;
+
+  /* Rounds instructions take the state as ABEF and CDGH */
+  tmp = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)&h[0]), 0xb1);
+  state1 = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)&h[4]), 0x1b);
+  state0 = _mm_alignr_epi8(tmp, state1, 8);
+  state1 = _mm_blend_epi16(state1, tmp, 0xf0);
+
+  for (; num > 0; num--, in += SHA256_CBLOCK) {
+    abef = state0;
+    cdgh = state1;
+
+    /* Four rounds at a time, message schedule kept four words ahead */
+    for (i = 0; i < 16; i++) {
+      if (i < 4) {
+        w[i] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(in + 16 * i)), mask);
+      }
+      msg = _mm_add_epi32(w[i & 3], _mm_loadu_si128((const __m128i *)&K256[4 * i]));
+      state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+      if (i >= 3 && i < 15) {
+        tmp = _mm_alignr_epi8(w[i & 3], w[(i - 1) & 3], 4);
+        w[(i + 1) & 3] = _mm_add_epi32(w[(i + 1) & 3], tmp);
+        w[(i + 1) & 3] = _mm_sha256msg2_epu32(w[(i + 1) & 3], w[i & 3]);
+      }
+      msg = _mm_shuffle_epi32(msg, 0x0e);
+      state0 = _mm_sha256rnds2_epu32(state0, state1, msg);
+      if (i >= 1 && i < 13) {
+        w[(i - 1) & 3] = _mm_sha256msg1_epu32(w[(i - 1) & 3], w[i & 3]);
+      }
+    }
+
+    state0 = _mm_add_epi32(state0, abef);
+    state1 = _mm_add_epi32(state1, cdgh);
+  }
+
+  tmp = _mm_shuffle_epi32(state0, 0x1b);
+  state1 = _mm_shuffle_epi32(state1, 0xb1);
+  state0 = _mm_blend_epi16(tmp, state1, 0xf0);
+  state1 = _mm_alignr_epi8(state1, tmp, 8);
+  _mm_storeu_si128((__m128i *)&h[0], state0);
+  _mm_storeu_si128((__m128i *)&h[4], state1);
+}
+
+static int
+sha256_hw_supported(void)
+{
+  unsigned int a, b, c, d;
+
+  if (sizeof(SHA_LONG) != sizeof(uint32_t) || __get_cpuid_max(0, NULL) < 7) {
+    return 0;
+  }
+  __cpuid(1, a, b, c, d);
+  if (!(c & bit_SSSE3) || !(c & bit_SSE4_1)) {
+    return 0;
+  }
+  __cpuid_count(7, 0, a, b, c, d);
+  return (b & bit_SHA) != 0;
+}
+#endif
+
+typedef void (*sha256_blocks_f)(SHA_LONG *h, const unsigned char *in, size_t num);
+
+static void
+sha256_blocks(SHA_LONG *h, const unsigned char *in, size_t num)
+{
+  static sha256_blocks_f blocks;
+
+  if (blocks == NULL) {
+#ifdef SHA256_HW_SHANI
+    blocks = sha256_hw_supported() ? sha256_blocks_hw : sha256_blocks_soft;
+#else
+    blocks = sha256_blocks_soft;
+#endif
+  }
+  blocks(h, in, num);
+}
+
+int
+SHA224_Init(SHA256_CTX *c)
+{
+  memset(c, 0, sizeof(*c));
+  c->h[0] = 0xc1059ed8; c->h[1] = 0x367cd507; c->h[2] = 0x3070dd17; c->h[3] = 0xf70e5939;
+  c->h[4] = 0xffc00b31; c->h[5] = 0x68581511; c->h[6] = 0x64f98fa7; c->h[7] = 0xbefa4fa4;
+  c->md_len = SHA224_DIGEST_LENGTH;
+  return 1;
+}
+
+int
+SHA256_Init(SHA256_CTX *c)
+{
+  memset(c, 0, sizeof(*c));
+  c->h[0] = 0x6a09e667; c->h[1] = 0xbb67ae85; c->h[2] = 0x3c6ef372; c->h[3] = 0xa54ff53a;
+  c->h[4] = 0x510e527f; c->h[5] = 0x9b05688c; c->h[6] = 0x1f83d9ab; c->h[7] = 0x5be0cd19;
+  c->md_len = SHA256_DIGEST_LENGTH;
+  return 1;
+}
+
+int
+SHA256_Update(SHA256_CTX *c, const void *data_, size_t len)
+{
+  const unsigned char *data = data_;
+  unsigned char *p = (unsigned char *)c->data;
+  size_t n;
+
+  if (len == 0) {
+    return 1;
+  }
+
+  /* Bit count */
+  n = (c->Nl + ((SHA_LONG)len << 3)) & 0xffffffff;
+  if (n < c->Nl) {
+    c->Nh++;
+  }
+  c->Nh += (SHA_LONG)((uint64_t)len >> 29);
+  c->Nl = n;
+
+  if (c->num != 0) {
+    n = SHA256_CBLOCK - c->num;
+    if (len < n) {
+      memcpy(p + c->num, data, len);
+      c->num += len;
+      return 1;
+    }
+    memcpy(p + c->num, data, n);
+    sha256_blocks(c->h, p, 1);
+    data += n;
+    len -= n;
+    c->num = 0;
+  }
+
+  n = len / SHA256_CBLOCK;
+  if (n > 0) {
+    sha256_blocks(c->h, data, n);
+    data += n * SHA256_CBLOCK;
+    len -= n * SHA256_CBLOCK;
+  }
+
+  if (len != 0) {
+    memcpy(p, data, len);
+    c->num = len;
+  }
+  return 1;
+}
+
+int
+SHA256_Final(unsigned char *md, SHA256_CTX *c)
+{
+  unsigned char *p = (unsigned char *)c->data;
+  size_t n = c->num;
+  unsigned int i;
+
+  p[n++] = 0x80;
+  if (n > SHA256_CBLOCK - 8) {
+    memset(p + n, 0, SHA256_CBLOCK - n);
+    sha256_blocks(c->h, p, 1);
+    n = 0;
+  }
+  memset(p + n, 0, SHA256_CBLOCK - 8 - n);
+  store_be32(p + SHA256_CBLOCK - 8, c->Nh);
+  store_be32(p + SHA256_CBLOCK - 4, c->Nl);
+  sha256_blocks(c->h, p, 1);
+
+  for (i = 0; i < c->md_len / 4; i++) {
+    store_be32(md + 4 * i, c->h[i]);
+  }
+  c->num = 0;
+  return 1;
+}
+
+int
+SHA224_Update(SHA256_CTX *c, const void *data, size_t len)
+{
+  return SHA256_Update(c, data, len);
+}
+
+int
+SHA224_Final(unsigned char *md, SHA256_CTX *c)
+{
+  return SHA256_Final(md, c);
+}
+
+/* SHA-512 compression of num blocks */
+static void
+sha512_blocks(SHA_LONG64 *h, const unsigned char *in, size_t num)
+{
+  uint64_t a, b, c, d, e, f, g, k, t1, t2, w[80];
+  int i;
+
+  for (; num > 0; num--, in += SHA512_CBLOCK) {
+    for (i = 0; i < 16; i++) {
+      w[i] = load_be64(in + 8 * i);
+    }
+    for (; i < 80; i++) {
+      t1 = ROR64(w[i - 2], 19) ^ ROR64(w[i - 2], 61) ^ (w[i - 2] >> 6);
+      t2 = ROR64(w[i - 15], 1) ^ ROR64(w[i - 15], 8) ^ (w[i - 15] >> 7);
+      w[i] = t1 + w[i - 7] + t2 + w[i - 16];
+    }
+
+    a = h[0]; b = h[1]; c = h[2]; d = h[3];
+    e = h[4]; f = h[5]; g = h[6]; k = h[7];
+    for (i = 0; i < 80; i++) {
+      t1 = k + (ROR64(e, 14) ^ ROR64(e, 18) ^ ROR64(e, 41)) + ((e & f) ^ (~e & g)) + K512[i] + w[i];
+      t2 = (ROR64(a, 28) ^ ROR64(a, 34) ^ ROR64(a, 39)) + ((a & b) ^ (a & c) ^ (b & c));
+      k = g; g = f; f = e; e = d + t1;
+      d = c; c = b; b = a; a = t1 + t2;
+    }
+    h[0] += a; h[1] += b; h[2] += c; h[3] += d;
+    h[4] += e; h[5] += f; h[6] += g; h[7] += k;
+  }
+}
+
+int
+SHA384_Init(SHA512_CTX *c)
+{
+  memset(c, 0, sizeof(*c));
+  c->h[0] = U64(0xcbbb9d5dc1059ed8); c->h[1] = U64(0x629a292a367cd507);
+  c->h[2] = U64(0x9159015a3070dd17); c->h[3] = U64(0x152fecd8f70e5939);
+  c->h[4] = U64(0x67332667ffc00b31); c->h[5] = U64(0x8eb44a8768581511);
+  c->h[6] = U64(0xdb0c2e0d64f98fa7); c->h[7] = U64(0x47b5481dbefa4fa4);
+  c->md_len = SHA384_DIGEST_LENGTH;
+  return 1;
+}
+
+int
+SHA512_Init(SHA512_CTX *c)
+{
+  memset(c, 0, sizeof(*c));
+  c->h[0] = U64(0x6a09e667f3bcc908); c->h[1] = U64(0xbb67ae8584caa73b);
+  c->h[2] = U64(0x3c6ef372fe94f82b); c->h[3] = U64(0xa54ff53a5f1d36f1);
+  c->h[4] = U64(0x510e527fade682d1); c->h[5] = U64(0x9b05688c2b3e6c1f);
+  c->h[6] = U64(0x1f83d9abfb41bd6b); c->h[7] = U64(0x5be0cd19137e2179);
+  c->md_len = SHA512_DIGEST_LENGTH;
+  return 1;
+}
+
+int
+SHA512_Update(SHA512_CTX *c, const void *data_, size_t len)
+{
+  const unsigned char *data = data_;
+  unsigned char *p = c->u.p;
+  SHA_LONG64 l;
+  size_t n;
+
+  if (len == 0) {
+    return 1;
+  }
+
+  /* Bit count */
+  l = c->Nl + ((SHA_LONG64)len << 3);
+  if (l < c->Nl) {
+    c->Nh++;
+  }
+  c->Nh += (SHA_LONG64)len >> 61;
+  c->Nl = l;
+
+  if (c->num != 0) {
+    n = SHA512_CBLOCK - c->num;
+    if (len < n) {
+      memcpy(p + c->num, data, len);
+      c->num += len;
+      return 1;
+    }
+    memcpy(p + c->num, data, n);
+    sha512_blocks(c->h, p, 1);
+    data += n;
+    len -= n;
+    c->num = 0;
+  }
+
+  n = len / SHA512_CBLOCK;
+  if (n > 0) {
+    sha512_blocks(c->h, data, n);
+    data += n * SHA512_CBLOCK;
+    len -= n * SHA512_CBLOCK;
+  }
+
+  if (len != 0) {
+    memcpy(p, data, len);
+    c->num = len;
+  }
+  return 1;
+}
+
+int
+SHA512_Final(unsigned char *md, SHA512_CTX *c)
+{
+  unsigned char *p = c->u.p;
+  size_t n = c->num;
+  unsigned int i;
+
+  p[n++] = 0x80;
+  if (n > SHA512_CBLOCK - 16) {
+    memset(p + n, 0, SHA512_CBLOCK - n);
+    sha512_blocks(c->h, p, 1);
+    n = 0;
+  }
+  memset(p + n, 0, SHA512_CBLOCK - 16 - n);
+  store_be64(p + SHA512_CBLOCK - 16, c->Nh);
+  store_be64(p + SHA512_CBLOCK - 8, c->Nl);
+  sha512_blocks(c->h, p, 1);
+
+  for (i = 0; i < c->md_len / 8; i++) {
+    store_be64(md + 8 * i, c->h[i]);
+  }
+  c->num = 0;
+  return 1;
+}
+
+int
+SHA384_Update(SHA512_CTX *c, const void *data, size_t len)
+{
+  return SHA512_Update(c, data, len);
+}
+
+int
+SHA384_Final(unsigned char *md, SHA512_CTX *c)
+{
+  return SHA512_Final(md, c);
+}
+
+/* One of the SHA-2 digests picked by digest length */
+struct sha2_ctx {
+  unsigned int md_len;
+  union {
+    SHA256_CTX s256;
+    SHA512_CTX s512;
+  } u;
+};
+
+static int
+sha2_init(struct sha2_ctx *c, unsigned int md_len)
+{
+  c->md_len = md_len;
+  switch (md_len) {
+  case SHA224_DIGEST_LENGTH:
+    return SHA224_Init(&c->u.s256);
+  case SHA256_DIGEST_LENGTH:
+    return SHA256_Init(&c->u.s256);
+  case SHA384_DIGEST_LENGTH:
+    return SHA384_Init(&c->u.s512);
+  case SHA512_DIGEST_LENGTH:
+    return SHA512_Init(&c->u.s512);
+  default:
+    return 0;
+  }
+}
+
+static void
+sha2_update(struct sha2_ctx *c, const void *data, size_t len)
+{
+  if (c->md_len <= SHA256_DIGEST_LENGTH) {
+    SHA256_Update(&c->u.s256, data, len);
+  } else {
+    SHA512_Update(&c->u.s512, data, len);
+  }
+}
+
+static void
+sha2_final(unsigned char *md, struct sha2_ctx *c)
+{
+  if (c->md_len <= SHA256_DIGEST_LENGTH) {
+    SHA256_Final(md, &c->u.s256);
+  } else {
+    SHA512_Final(md, &c->u.s512);
+  }
+}
+
+/* Bytes of the block hashed by the digest */
+static unsigned int
+sha2_block_len(unsigned int md_len)
+{
+  return md_len <= SHA256_DIGEST_LENGTH ? SHA256_CBLOCK : SHA512_CBLOCK;
+}
+
+/* Hash state as words, big 64 bit words first */
+static void
+sha2_state_save(const struct sha2_ctx *c, uint32_t *state)
+{
+  int i;
+
+  for (i = 0; i < 8; i++) {
+    if (c->md_len <= SHA256_DIGEST_LENGTH) {
+      state[i] = c->u.s256.h[i];
+    } else {
+      state[2 * i] = c->u.s512.h[i] >> 32;
+      state[2 * i + 1] = c->u.s512.h[i];
+    }
+  }
+}
+
+/* Resume hashing after the pad block of state */
+static void
+sha2_state_resume(struct sha2_ctx *c, unsigned int md_len, const uint32_t *state)
+{
+  int i;
+
+  sha2_init(c, md_len);
+  for (i = 0; i < 8; i++) {
+    if (md_len <= SHA256_DIGEST_LENGTH) {
+      c->u.s256.h[i] = state[i];
+    } else {
+      c->u.s512.h[i] = ((SHA_LONG64)state[2 * i] << 32) | state[2 * i + 1];
+    }
+  }
+  if (md_len <= SHA256_DIGEST_LENGTH) {
+    c->u.s256.Nl = SHA256_CBLOCK * 8;
+  } else {
+    c->u.s512.Nl = SHA512_CBLOCK * 8;
+  }
+}
+
+/*
+ * SHA2_key(md_len, password, engineID, key): password to key algorithm
+ * of RFC 3414 over the SHA-2 digest of md_len bytes, localized with the
+ * engine ID into a key of md_len bytes.
+ */
+void
+SHA2_key(unsigned int md_len,               /* IN  - digest length in bytes */
+         const unsigned char *password,     /* IN */
+         unsigned int passwordlen,          /* IN */
+         const unsigned char *engineID,     /* IN  - pointer to snmpEngineID  */
+         unsigned int engineLength,         /* IN  - length of snmpEngineID */
+         unsigned char *key)                /* OUT - pointer to caller md_len-octet buffer */
+{
+  struct sha2_ctx c;
+  unsigned char buf[SHA256_CBLOCK];
+  unsigned long count, i, index = 0;
+
+  if (!sha2_init(&c, md_len) || passwordlen == 0) {
+    return;
+  }
+
+  /* Digest of 1 Megabyte of repeated password */
+  for (count = 0; count < 1048576; count += sizeof(buf)) {
+    for (i = 0; i < sizeof(buf); i++) {
+      buf[i] = password[index++ % passwordlen];
+    }
+    sha2_update(&c, buf, sizeof(buf));
+  }
+  sha2_final(key, &c);
+
+  /* Localize with engine ID */
+  sha2_init(&c, md_len);
+  sha2_update(&c, key, md_len);
+  sha2_update(&c, engineID, engineLength);
+  sha2_update(&c, key, md_len);
+  sha2_final(key, &c);
+}
+
+/*
+ * SHA2_hmac_prepare(md_len, secret, ipad, opad): hash the ipad and opad
+ * blocks of the key once, so that each message only costs hashing itself.
+ */
+void
+SHA2_hmac_prepare(unsigned int md_len,            /* IN  - digest length in bytes */
+                  const unsigned char *secret,    /* IN  - pointer to usrAuthKey */
+                  size_t secretlen,               /* IN  - length of usrAuthKey */
+                  uint32_t *ipad,                 /* OUT - hash state after ipad block */
+                  uint32_t *opad)                 /* OUT - hash state after opad block */
+{
+  struct sha2_ctx c;
+  unsigned char K[SHA512_CBLOCK];
+  unsigned int i, block = sha2_block_len(md_len);
+
+  memset(K, 0, sizeof(K));
+  if (secretlen > block) {
+    /* Keys longer than a block are hashed first */
+    sha2_init(&c, md_len);
+    sha2_update(&c, secret, secretlen);
+    sha2_final(K, &c);
+  } else {
+    memcpy(K, secret, secretlen);
+  }
+
+  for (i = 0; i < block; i++)
+      K[i] ^= 0x36;
+  sha2_init(&c, md_len);
+  sha2_update(&c, K, block);
+  sha2_state_save(&c, ipad);
+
+  for (i = 0; i < block; i++)
+      K[i] ^= 0x36 ^ 0x5c;
+  sha2_init(&c, md_len);
+  sha2_update(&c, K, block);
+  sha2_state_save(&c, opad);
+
+  memset(K, 0, sizeof(K));
+}
+
+/*
+ * SHA2_hmac_prepared(md_len, data, len, mac, maclen, ipad, opad): HMAC
+ * over the SHA-2 digest of md_len bytes with the pad states given by
+ * SHA2_hmac_prepare.
+ */
+int
+SHA2_hmac_prepared(unsigned int md_len,         /* IN  - digest length in bytes */
+                   const unsigned char *data,   /* IN  - pointer to message */
+                   size_t len,                  /* IN  - length of messege */
+                   unsigned char *mac,          /* OUT - pointer to caller buffer */
+                   size_t maclen,               /* IN  - length of mac */
+                   const uint32_t *ipad,        /* IN  - hash state after ipad block */
+                   const uint32_t *opad)        /* IN  - hash state after opad block */
+{
+  struct sha2_ctx c;
+  unsigned char buf[SHA512_DIGEST_LENGTH];
+
+  if (mac == NULL || data == NULL || len <= 0 ||
+      maclen <= 0 || maclen > md_len || !sha2_init(&c, md_len)) {
+      return -1;
+  }
+
+  sha2_state_resume(&c, md_len, ipad);
+  sha2_update(&c, data, len);
+  sha2_final(buf, &c);
+
+  sha2_state_resume(&c, md_len, opad);
+  sha2_update(&c, buf, md_len);
+  sha2_final(buf, &c);
+  memcpy(mac, buf, maclen);
+
+  return 0;
+}
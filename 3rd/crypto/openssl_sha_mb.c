@@ -0,0 +1,236 @@
+/*
+ * This file is part of SmithSNMP
+ * Copyright (C) 2014, Credo Semiconductor Inc.
+ * Copyright (C) 2015, Leo Ma <begeekmyfriend@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ */
+
+
+/*
+ * Multi-buffer HMAC-SHA1, the messages of a batch are hashed together in
+ * the lanes of one vector, see openssl_mb_local.h.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "openssl_sha.h"
+#include "openssl_mb_local.h"
+
+#include "../../core/snmp.h"
+
+#ifdef MB_VECTOR
+static const uint32_t sha1_k[4] = {
+  0x5a827999, 0x6ed9eba1, 0x8f1bbcdc, 0xca62c1d6,
+};
+
+/* One block of each lane, state of lanes out of mask is kept */
+static inline __attribute__((always_inline)) void
+sha1_mb_body(uint32_t st[5][MB_LANES], const uint32_t w[16][MB_LANES], const uint32_t mask[MB_LANES])
+{
+  mb_u32 a, b, c, d, e, f, t, m, h[5], x[16];
+  int i;
+
+  for (i = 0; i < 5; i++) {
+    memcpy(&h[i], st[i], sizeof(mb_u32));
+  }
+  for (i = 0; i < 16; i++) {
+    memcpy(&x[i], w[i], sizeof(mb_u32));
+  }
+  memcpy(&m, mask, sizeof(mb_u32));
+
+  a = h[0]; b = h[1]; c = h[2]; d = h[3]; e = h[4];
+  for (i = 0; i < 80; i++) {
+    if (i >= 16) {
+      t = x[(i - 3) & 15] ^ x[(i - 8) & 15] ^ x[(i - 14) & 15] ^ x[i & 15];
+      x[i & 15] = MB_ROTL(t, 1);
+    }
+    switch (i / 20) {
+    case 0:
+      f = d ^ (b & (c ^ d));
+      break;
+    case 2:
+      f = (b & c) | (d & (b | c));
+      break;
+    default:
+      f = b ^ c ^ d;
+      break;
+    }
+    t = MB_ROTL(a, 5) + f + e + sha1_k[i / 20] + x[i & 15];
+    e = d; d = c; c = MB_ROTL(b, 30); b = a; a = t;
+  }
+
+  h[0] = (h[0] & ~m) | ((h[0] + a) & m);
+  h[1] = (h[1] & ~m) | ((h[1] + b) & m);
+  h[2] = (h[2] & ~m) | ((h[2] + c) & m);
+  h[3] = (h[3] & ~m) | ((h[3] + d) & m);
+  h[4] = (h[4] & ~m) | ((h[4] + e) & m);
+  for (i = 0; i < 5; i++) {
+    memcpy(st[i], &h[i], sizeof(mb_u32));
+  }
+}
+
+typedef void (*sha1_mb_block_f)(uint32_t st[5][MB_LANES], const uint32_t w[16][MB_LANES], const uint32_t mask[MB_LANES]);
+
+static void
+sha1_mb_block_soft(uint32_t st[5][MB_LANES], const uint32_t w[16][MB_LANES], const uint32_t mask[MB_LANES])
+{
+  sha1_mb_body(st, w, mask);
+}
+
+#ifdef MB_HW_AVX2
+__attribute__((target("avx2")))
+static void
+sha1_mb_block_avx2(uint32_t st[5][MB_LANES], const uint32_t w[16][MB_LANES], const uint32_t mask[MB_LANES])
+{
+  sha1_mb_body(st, w, mask);
+}
+#endif
+
+/* Block function picked by cpu features at first use, min_lanes is the
+ * fewest messages it is worth for */
+static sha1_mb_block_f
+sha1_mb_block(unsigned int *min_lanes)
+{
+  static sha1_mb_block_f block;
+  static unsigned int min;
+
+  if (block == NULL) {
+#ifdef MB_HW_AVX2
+    if (mb_avx2_supported()) {
+      block = sha1_mb_block_avx2;
+      min = MB_MIN_LANES_AVX2;
+    } else {
+      block = sha1_mb_block_soft;
+      min = MB_MIN_LANES;
+    }
+#else
+    block = sha1_mb_block_soft;
+    min = MB_MIN_LANES;
+#endif
+  }
+  if (min_lanes != NULL) {
+    *min_lanes = min;
+  }
+  return block;
+}
+
+static inline uint32_t
+sha1_mb_load(const unsigned char *p)
+{
+  return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+/* HMAC of up to MB_LANES messages */
+static void
+sha1_mb_hmac(const struct hmac_job *jobs, unsigned int n, size_t maclen)
+{
+  static const unsigned char zero[MB_BLOCK];
+  sha1_mb_block_f block = sha1_mb_block(NULL);
+  struct mb_lane lanes[MB_LANES];
+  uint32_t st[5][MB_LANES], w[16][MB_LANES], mask[MB_LANES];
+  unsigned char digest[SHA_DIGEST_LENGTH];
+  size_t b, blocks = 0;
+  unsigned int l;
+  int i;
+
+  /* Inner hash, resumed after the ipad block */
+  memset(st, 0, sizeof(st));
+  for (l = 0; l < n; l++) {
+    mb_lane_init(&lanes[l], jobs[l].data, jobs[l].len, SHA_CBLOCK, 1);
+    if (lanes[l].blocks > blocks) {
+      blocks = lanes[l].blocks;
+    }
+    for (i = 0; i < 5; i++) {
+      st[i][l] = jobs[l].ipad[i];
+    }
+  }
+
+  for (b = 0; b < blocks; b++) {
+    for (l = 0; l < MB_LANES; l++) {
+      const unsigned char *p = l < n ? mb_lane_block(&lanes[l], b) : NULL;
+      mask[l] = p != NULL ? 0xffffffff : 0;
+      if (p == NULL) {
+        p = zero;
+      }
+      for (i = 0; i < 16; i++) {
+        w[i][l] = sha1_mb_load(p + 4 * i);
+      }
+    }
+    block(st, (const uint32_t (*)[MB_LANES])w, mask);
+  }
+
+  /* Outer hash of the inner digest, one block for every lane */
+  memset(w, 0, sizeof(w));
+  for (l = 0; l < n; l++) {
+    for (i = 0; i < 5; i++) {
+      w[i][l] = st[i][l];
+      st[i][l] = jobs[l].opad[i];
+    }
+    w[5][l] = 0x80000000;
+    w[15][l] = (SHA_CBLOCK + SHA_DIGEST_LENGTH) * 8;
+    mask[l] = 0xffffffff;
+  }
+  block(st, (const uint32_t (*)[MB_LANES])w, mask);
+
+  for (l = 0; l < n; l++) {
+    for (i = 0; i < SHA_DIGEST_LENGTH; i++) {
+      digest[i] = st[i / 4][l] >> (24 - 8 * (i % 4));
+    }
+    memcpy(jobs[l].mac, digest, maclen);
+  }
+}
+#endif
+
+/*
+ * SHA1_hmac_prepared_mb(jobs, n, maclen): SHA1_hmac_prepared of n
+ * independent messages, several at a time in vector lanes.
+ */
+int
+SHA1_hmac_prepared_mb(const struct hmac_job *jobs,  /* IN  - messages, pad states and mac buffers */
+                      unsigned int n,               /* IN  - number of messages */
+                      size_t maclen)                /* IN  - length of each mac */
+{
+  unsigned int i, cnt, min_lanes = MB_LANES + 1;
+
+  if (jobs == NULL || maclen <= 0 || maclen > SHA1_SECRETKEYLEN) {
+    return -1;
+  }
+  for (i = 0; i < n; i++) {
+    if (jobs[i].data == NULL || jobs[i].len <= 0 || jobs[i].mac == NULL) {
+      return -1;
+    }
+  }
+
+#ifdef MB_VECTOR
+  sha1_mb_block(&min_lanes);
+#endif
+
+  for (i = 0; i < n; i += cnt) {
+    cnt = n - i < MB_LANES ? n - i : MB_LANES;
+#ifdef MB_VECTOR
+    if (cnt >= min_lanes) {
+      sha1_mb_hmac(jobs + i, cnt, maclen);
+      continue;
+    }
+#endif
+    SHA1_hmac_prepared(jobs[i].data, jobs[i].len, jobs[i].mac, maclen, jobs[i].ipad, jobs[i].opad);
+    cnt = 1;
+  }
+
+  return 0;
+}
@@ -31,24 +31,25 @@
 #include "protocol.h"
 
 struct agentx_datagram agentx_datagram;
+struct arena_stats agentx_arena_stats;
 
 /* Receive agentX request datagram from transport layer */
 static void
-agentx_receive(uint8_t *buf, int len)
+agentx_receive(uint8_t *buf, int len, void *peer)
 {
   agentx_recv(buf, len);
 }
 
 /* Send agentX response datagram to transport layer */
 static void
-agentx_send(uint8_t *buf, int len)
+agentx_send(uint8_t *buf, int len, void *peer)
 {
-  agentx_transp_ops.send(buf, len);
+  agentx_transp_ops.send(buf, len, peer);
 }
 
 /* Register mib group node */
 static int
-agentx_mib_node_reg(const oid_t *grp_id, int id_len, int grp_cb)
+agentx_mib_node_reg(const oid_t *grp_id, int id_len, int grp_cb, int bulk)
 {
   struct x_pdu_buf x_pdu;
 
@@ -81,7 +82,7 @@ agentx_mib_node_reg(const oid_t *grp_id, int id_len, int grp_cb)
   }
 
   /* Register node */
-  return mib_node_reg(grp_id, id_len, grp_cb);
+  return mib_node_reg(grp_id, id_len, grp_cb, bulk);
 }
 
 /* Unregister mib group node */
@@ -130,6 +131,7 @@ agentx_init(int port)
   INIT_LIST_HEAD(&agentx_datagram.vb_out_list);
   INIT_LIST_HEAD(&agentx_datagram.sr_in_list);
   INIT_LIST_HEAD(&agentx_datagram.sr_out_list);
+  agentx_datagram.arena = arena_new(AGENTX_ARENA_SIZE, &agentx_arena_stats);
   return agentx_transp_ops.init(port);
 }
 
@@ -192,6 +194,8 @@ agentx_close(void)
   }
   
   agentx_transp_ops.close();
+  arena_free(agentx_datagram.arena);
+  agentx_datagram.arena = NULL;
   return 0;
 }
 
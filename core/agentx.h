@@ -22,10 +22,13 @@
 #ifndef _AGENTX_H_
 #define _AGENTX_H_
 
+#include "arena.h"
 #include "asn1.h"
 #include "list.h"
 #include "utils.h"
 
+#define AGENTX_ARENA_SIZE  (4096)
+
 /* AgentX PDU flags */
 #define INSTANCE_REGISTRATION  0x1
 #define NEW_INDEX              0x2
@@ -208,9 +211,13 @@ struct agentx_datagram {
   uint32_t sr_out_cnt;
   struct list_head sr_in_list;
   struct list_head sr_out_list;
+
+  /* Storage of search values, reset per PDU */
+  struct mem_arena *arena;
 };
 
 extern struct agentx_datagram agentx_datagram;
+extern struct arena_stats agentx_arena_stats;
 
 static inline struct x_var_bind *
 vb_new(uint32_t oid_len, uint32_t val_len)
@@ -58,6 +58,10 @@ agentx_datagram_clear(struct agentx_datagram *xdg)
   sr_list_free(&xdg->sr_out_list);
   xdg->sr_in_cnt = 0;
   xdg->sr_out_cnt = 0;
+  /* free search values */
+  if (xdg->arena != NULL) {
+    arena_reset(xdg->arena);
+  }
   /* clear some fields */
   xdg->u.response.sys_up_time = 0;
   xdg->u.response.error = 0;
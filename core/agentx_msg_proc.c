@@ -47,8 +47,11 @@ agentx_get(struct agentx_datagram *xdg)
   struct x_var_bind *vb_out;
   struct x_search_range *sr_in;
   struct oid_search_res ret_oid;
+  oid_t oid_buf[ASN1_OID_MAX_LEN];
 
   memset(&ret_oid, 0, sizeof(ret_oid));
+  ret_oid.oid = oid_buf;
+  ret_oid.arena = xdg->arena;
   ret_oid.request = SNMP_REQ_GET; 
 
   list_for_each(curr, &xdg->sr_in_list) {
@@ -60,7 +63,7 @@ agentx_get(struct agentx_datagram *xdg)
 
     val_len = agentx_value_enc_try(length(&ret_oid.var), tag(&ret_oid.var));
     vb_out = xmalloc(sizeof(*vb_out) + val_len);
-    vb_out->oid = ret_oid.oid;
+    vb_out->oid = oid_dup(ret_oid.oid, ret_oid.id_len);
     vb_out->oid_len = ret_oid.id_len;
     vb_out->val_type = tag(&ret_oid.var);
     vb_out->val_len = agentx_value_enc(value(&ret_oid.var), length(&ret_oid.var), tag(&ret_oid.var), vb_out->value);
@@ -93,10 +96,6 @@ mib_getnext(struct agentx_datagram *xdg, struct x_search_range *sr_in, struct oi
   /* Search at the included start oid */
   if (sr_in->start_include) {
     mib_tree_search(&view, sr_in->start, sr_in->start_len, ret_oid);
-    if (ret_oid->err_stat || !ASN1_TAG_VALID(tag(&ret_oid->var))) {
-      /* Invalid query */
-      free(ret_oid->oid);
-    }
   }
 
   /* If start oid not included or not exist, search the next one */
@@ -125,8 +124,11 @@ agentx_getnext(struct agentx_datagram *xdg)
   struct x_var_bind *vb_out;
   struct x_search_range *sr_in;
   struct oid_search_res ret_oid;
+  oid_t oid_buf[ASN1_OID_MAX_LEN];
 
   memset(&ret_oid, 0, sizeof(ret_oid));
+  ret_oid.oid = oid_buf;
+  ret_oid.arena = xdg->arena;
   ret_oid.request = SNMP_REQ_GETNEXT;
 
   list_for_each(curr, &xdg->sr_in_list) {
@@ -138,7 +140,7 @@ agentx_getnext(struct agentx_datagram *xdg)
 
     val_len = agentx_value_enc_try(length(&ret_oid.var), tag(&ret_oid.var));
     vb_out = xmalloc(sizeof(*vb_out) + val_len);
-    vb_out->oid = ret_oid.oid;
+    vb_out->oid = oid_dup(ret_oid.oid, ret_oid.id_len);
     vb_out->oid_len = ret_oid.id_len;
     vb_out->val_type = tag(&ret_oid.var);
     vb_out->val_len = agentx_value_enc(value(&ret_oid.var), length(&ret_oid.var), tag(&ret_oid.var), vb_out->value);
@@ -178,26 +180,28 @@ agentx_set(struct agentx_datagram *xdg)
   struct list_head *curr;
   struct x_var_bind *vb_in, *vb_out;
   struct oid_search_res ret_oid;
+  oid_t oid_buf[ASN1_OID_MAX_LEN];
 
   memset(&ret_oid, 0, sizeof(ret_oid));
+  ret_oid.oid = oid_buf;
+  ret_oid.arena = xdg->arena;
   ret_oid.request = SNMP_REQ_SET;
 
   list_for_each(curr, &xdg->vb_in_list) {
     vb_in = list_entry(curr, struct x_var_bind, link);
     vb_in_cnt++;
 
-    /* Decode the setting value ahead */
+    /* The setting value is decoded ahead */
     tag(&ret_oid.var) = vb_in->val_type;
     length(&ret_oid.var) = vb_in->val_len;
-    val_len = agentx_value_enc_try(length(&ret_oid.var), tag(&ret_oid.var));
-    memcpy(value(&ret_oid.var), vb_in->value, val_len);
+    mib_value_ref(&ret_oid.var, vb_in->value);
 
     /* Search at the input oid and set it */
     mib_set(xdg, vb_in, &ret_oid);
     
     val_len = agentx_value_enc_try(length(&ret_oid.var), tag(&ret_oid.var));
     vb_out = xmalloc(sizeof(*vb_out) + val_len);
-    vb_out->oid = ret_oid.oid;
+    vb_out->oid = oid_dup(ret_oid.oid, ret_oid.id_len);
     vb_out->oid_len = ret_oid.id_len;
     vb_out->val_type = vb_in->val_type;
     vb_out->val_len = agentx_value_enc(value(&ret_oid.var), val_len, tag(&ret_oid.var), vb_out->value);
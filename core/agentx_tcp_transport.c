@@ -88,12 +88,12 @@ agentx_read_handler(int sock, unsigned char flag, void *ud)
   }
 
   /* Parse agentX PDU in decoder */
-  agentx_prot_ops.receive(buf, len);
+  agentx_prot_ops.receive(buf, len, NULL);
 }
 
 /* Send angentX PDU to the remote */
 static void
-transport_send(uint8_t *buf, int len)
+transport_send(uint8_t *buf, int len, void *peer)
 {
   agentx_entry.buf = buf;
   agentx_entry.len = len;
@@ -0,0 +1,142 @@
+/*
+ * This file is part of SmithSNMP
+ * Copyright (C) 2014, Credo Semiconductor Inc.
+ * Copyright (C) 2015, Leo Ma <begeekmyfriend@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ */
+
+#ifndef _ARENA_H_
+#define _ARENA_H_
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "utils.h"
+
+#define ARENA_ALIGN  8
+
+/* Allocation counters, mallocs stays still once the arena is warmed up */
+struct arena_stats {
+  unsigned long allocs;
+  unsigned long mallocs;
+  unsigned long resets;
+  unsigned long peak;
+};
+
+struct arena_chunk {
+  struct arena_chunk *next;
+  size_t size;
+  size_t used;
+  uint8_t data[];
+};
+
+/* Bump allocator, everything allocated is released at once by arena_reset() */
+struct mem_arena {
+  /* Current chunk, older chunks are linked behind */
+  struct arena_chunk *chunk;
+  /* Bytes handed out since last reset */
+  size_t used;
+  struct arena_stats *stats;
+};
+
+static inline struct arena_chunk *
+arena_chunk_new(struct mem_arena *arena, size_t size)
+{
+  struct arena_chunk *c = xmalloc(sizeof(*c) + size);
+  c->next = NULL;
+  c->size = size;
+  c->used = 0;
+  arena->stats->mallocs++;
+  return c;
+}
+
+static inline struct mem_arena *
+arena_new(size_t size, struct arena_stats *stats)
+{
+  struct mem_arena *arena = xmalloc(sizeof(*arena));
+  arena->stats = stats;
+  arena->used = 0;
+  arena->chunk = arena_chunk_new(arena, size);
+  return arena;
+}
+
+static inline void *
+arena_alloc(struct mem_arena *arena, size_t size)
+{
+  struct arena_chunk *c = arena->chunk;
+  uintptr_t base = (uintptr_t)c->data;
+  uintptr_t p = (base + c->used + ARENA_ALIGN - 1) & ~(uintptr_t)(ARENA_ALIGN - 1);
+
+  if (p + size > base + c->size) {
+    /* Chunk exhausted, chain a larger one */
+    size_t n = c->size * 2;
+    if (n < size + ARENA_ALIGN) {
+      n = size + ARENA_ALIGN;
+    }
+    c = arena_chunk_new(arena, n);
+    c->next = arena->chunk;
+    arena->chunk = c;
+    base = (uintptr_t)c->data;
+    p = (base + ARENA_ALIGN - 1) & ~(uintptr_t)(ARENA_ALIGN - 1);
+  }
+
+  c->used = p + size - base;
+  arena->used += size;
+  arena->stats->allocs++;
+  return (void *)p;
+}
+
+/* Release all allocations. Chained chunks are merged into a single one as
+ * large as all of them, so the next round fits without growing. */
+static inline void
+arena_reset(struct mem_arena *arena)
+{
+  struct arena_chunk *c = arena->chunk, *n;
+  size_t size = 0;
+
+  if (arena->used > arena->stats->peak) {
+    arena->stats->peak = arena->used;
+  }
+  arena->used = 0;
+  arena->stats->resets++;
+
+  if (c->next == NULL) {
+    c->used = 0;
+    return;
+  }
+
+  for (; c != NULL; c = n) {
+    n = c->next;
+    size += c->size;
+    free(c);
+  }
+  arena->chunk = arena_chunk_new(arena, size);
+}
+
+static inline void
+arena_free(struct mem_arena *arena)
+{
+  struct arena_chunk *c, *n;
+
+  for (c = arena->chunk; c != NULL; c = n) {
+    n = c->next;
+    free(c);
+  }
+  free(arena);
+}
+
+#endif /* _ARENA_H_ */
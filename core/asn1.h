@@ -73,7 +73,13 @@ typedef unsigned long count64_t;
 typedef unsigned int gauge_t;
 typedef unsigned int timeticks_t;
 
-/* variable as TLV */
+/* Tags whose value is an array kept out of the variable */
+#define ASN1_TAG_ARRAY(tag)  ((tag) == ASN1_TAG_OCTSTR || (tag) == ASN1_TAG_BITSTR || \
+                              (tag) == ASN1_TAG_IPADDR || (tag) == ASN1_TAG_OBJID || \
+                              (tag) == ASN1_TAG_OPAQ)
+
+/* variable as TLV, scalars are held inline while strings, oids and opaques
+ * point to storage owned by whoever fills the variable */
 typedef struct {
   uint8_t tag;
   /* Number of elements according to tag */
@@ -83,18 +89,19 @@ typedef struct {
     count_t c;
     count32_t c32;
     count64_t c64;
-    ipaddr_t ip[6];
-    octstr_t s[ASN1_VALUE_MAX_LEN];
-    opaq_t o[ASN1_VALUE_MAX_LEN];
-    oid_t id[ASN1_OID_MAX_LEN];
     gauge_t g;
     timeticks_t t;
+    ipaddr_t *ip;
+    octstr_t *s;
+    opaq_t *o;
+    oid_t *id;
+    void *p;
   } value;
 } Variable;
 
 #define tag(var) ((var)->tag)
 #define length(var) ((var)->len)
-#define value(var) ((void *)&((var)->value))
+#define value(var) (ASN1_TAG_ARRAY(tag(var)) ? (var)->value.p : (void *)&((var)->value))
 #define integer(var) ((var)->value.i)
 #define opaque(var) ((var)->value.o)
 #define octstr(var) ((var)->value.s)
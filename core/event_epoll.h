@@ -48,6 +48,8 @@ __ev_add(struct snmp_event *event, unsigned char flag)
   struct epoll_event ee;
   int op = event->flag == SNMP_EV_NONE ? EPOLL_CTL_ADD : EPOLL_CTL_MOD;
 
+  /* Keep the interests already registered */
+  flag |= event->flag;
   ee.events = 0;
   ee.data.u64 = 0;  /* avoid valgrind warning */
   ee.data.fd = event->fd;
@@ -65,14 +67,16 @@ __ev_remove(struct snmp_event *event, unsigned char flag)
 {
   struct epoll_event ee;
 
-  ee.events = EPOLLIN | EPOLLOUT;
+  /* Keep the interests not being removed */
+  flag = event->flag & ~flag;
+  ee.events = 0;
   ee.data.u64 = 0;  /* avoid valgrind warning */
   ee.data.fd = event->fd;
   if (flag & SNMP_EV_READ) {
-    ee.events &= ~EPOLLIN;
+    ee.events |= EPOLLIN;
   }
   if (flag & SNMP_EV_WRITE) {
-    ee.events &= ~EPOLLOUT;
+    ee.events |= EPOLLOUT;
   }
   if (ee.events == 0) {
     epoll_ctl(env.epfd, EPOLL_CTL_DEL, event->fd, &ee);
@@ -84,7 +88,7 @@ __ev_remove(struct snmp_event *event, unsigned char flag)
 static int
 __ev_poll(struct snmp_event_loop *ev_loop)
 {
-  int i, nfds;
+  int i, j, nfds;
 
   if (ev_loop->timeout != -1) {
     nfds = epoll_wait(env.epfd, env.event, SNMP_MAX_EVENTS, ev_loop->timeout);
@@ -94,7 +98,17 @@ __ev_poll(struct snmp_event_loop *ev_loop)
 
   for (i = 0; i < nfds; i++) {
     struct epoll_event *ee = &env.event[i];
-    struct snmp_event *event = &ev_loop->event[i];
+    struct snmp_event *event = NULL;
+    /* Find the event by fd, not by the order epoll returns them */
+    for (j = 0; j < SNMP_MAX_EVENTS; j++) {
+      if (ev_loop->event[j].fd == ee->data.fd) {
+        event = &ev_loop->event[j];
+        break;
+      }
+    }
+    if (event == NULL) {
+      continue;
+    }
     if (ee->events & EPOLLIN) {
       event->read = 1;
     }
@@ -73,7 +73,7 @@ __ev_remove(struct snmp_event *event, unsigned char flag)
 static int
 __ev_poll(struct snmp_event_loop *ev_loop)
 {
-  int i, nfds;
+  int i, j, nfds;
 
   if (ev_loop->timeout != -1) {
     struct timespec tv;
@@ -86,7 +86,17 @@ __ev_poll(struct snmp_event_loop *ev_loop)
 
   for (i = 0; i < nfds; i++) {
     struct kevent *ke = &env.event[i];
-    struct snmp_event *event = &ev_loop->event[i];
+    struct snmp_event *event = NULL;
+    /* Find the event by fd, not by the order kqueue returns them */
+    for (j = 0; j < SNMP_MAX_EVENTS; j++) {
+      if (ev_loop->event[j].fd == (int)ke->ident) {
+        event = &ev_loop->event[j];
+        break;
+      }
+    }
+    if (event == NULL) {
+      continue;
+    }
     if (ke->filter == EVFILT_READ) {
       event->read = 1;
     }
@@ -161,8 +161,8 @@ snmp_event_remove(int fd, unsigned char flag)
 void
 snmp_event_timeout(long timeout)
 {
-  /* 10 milliseconds as a tick */
-  ev_loop.timeout = timeout * 10;
+  /* 10 milliseconds as a tick, no timeout if not positive */
+  ev_loop.timeout = timeout > 0 ? timeout * 10 : -1;
 }
 
 static int
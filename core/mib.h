@@ -22,6 +22,7 @@
 #ifndef _MIB_H_
 #define _MIB_H_
 
+#include "arena.h"
 #include "asn1.h"
 #include "list.h"
 #include "lua.h"
@@ -32,9 +33,20 @@
 #define MIB_OBJ_GROUP           1
 #define MIB_OBJ_INSTANCE        2
 
+/* Max arcs of oid stored inline */
+#define OID_INLINE_LEN  16
+
+/* Max instances fetched by one bulk walk call to Lua */
+#define MIB_WALK_MAX    256
+
 #define MD5_KEY_LEN   16
 #define SHA1_KEY_LEN  20
+#define SHA2_KEY_LEN  64
 #define AES_KEY_LEN   16
+/* Bytes of AES-128 round keys */
+#define AES_SCHED_LEN  (16 * 11)
+/* Words of hash state, SHA-512 has the most */
+#define AUTH_STATE_LEN  16
 
 /* MIB access attribute */
 typedef enum mib_aces_attr {
@@ -42,8 +54,53 @@ typedef enum mib_aces_attr {
   MIB_ACES_WRITE
 } MIB_ACES_ATTR_E;
 
+/* VACM security models, RFC 3411 */
+typedef enum mib_vacm_model {
+  MIB_VACM_MODEL_ANY = 0,
+  MIB_VACM_MODEL_V1,
+  MIB_VACM_MODEL_V2C,
+  MIB_VACM_MODEL_USM,
+  MIB_VACM_MODEL_MAX
+} MIB_VACM_MODEL_E;
+
+/* VACM security levels, RFC 3411 */
+typedef enum mib_vacm_level {
+  MIB_VACM_NOAUTH = 1,
+  MIB_VACM_AUTH,
+  MIB_VACM_PRIV,
+  MIB_VACM_LEVEL_MAX
+} MIB_VACM_LEVEL_E;
+
+/* Octets of view family mask, RFC 3415 */
+#define MIB_VACM_MASK_LEN  16
+
+/* Instance prefetched by bulk walk */
+struct mib_walk_row {
+  oid_t *oid;
+  uint32_t id_len;
+  uint8_t tag;
+  uint16_t len;
+  uint8_t value[0];
+};
+
+/* Instances of one group fetched ahead for a GETBULK varbind */
+struct mib_walk {
+  struct mem_arena *arena;
+  /* Instances still wanted by the request */
+  uint32_t want;
+  /* Group handler the rows come from */
+  int callback;
+  /* Error status of the last row */
+  int err_stat;
+  /* No more instances in the group after the last row */
+  uint8_t end;
+  uint32_t cnt;
+  uint32_t pos;
+  struct mib_walk_row **rows;
+};
+
 struct oid_search_res {
-  /* Return oid */
+  /* Return oid, buffer of ASN1_OID_MAX_LEN given by the caller */
   oid_t *oid;
   uint32_t id_len;
   /* Instance oid of return */
@@ -57,6 +114,14 @@ struct oid_search_res {
   int err_stat;
   /* Search return value */
   Variable var;
+  /* Storage of string and oid values for the request */
+  struct mem_arena *arena;
+  /* Prefetch buffer of bulk walk, NULL for single instance search */
+  struct mib_walk *walk;
+  /* BER encoded oid of the instance node found, which is the oid ahead
+   * of inst_id, NULL if none */
+  const uint8_t *ber_prefix;
+  uint32_t ber_prefix_len;
 };
 
 struct mib_node {
@@ -67,50 +132,134 @@ struct mib_group_node {
   uint8_t type;
   uint16_t sub_id_cap;
   uint16_t sub_id_cnt;
+  /* Arcs of the collapsed single-child chain, matched before sub-ids */
+  uint16_t prefix_len;
+  oid_t *prefix;
   oid_t *sub_id;
   void **sub_ptr;
 };
 
 struct mib_instance_node {
   uint8_t type;
+  /* Handler serves SNMP_REQ_BULKGET with a batch of instances */
+  uint8_t bulk;
+  /* BER encoded oid of the node */
+  uint16_t ber_len;
+  uint8_t *ber;
   int callback;
 };
 
+/* Node of hash table embedded in its entry, the hash is kept for lookups
+ * and growing */
+struct mib_hash_node {
+  struct mib_hash_node *next;
+  uint32_t hash;
+};
+
+/* Chained hash table doubling with the number of entries */
+struct mib_hash {
+  struct mib_hash_node **buckets;
+  /* Number of buckets, power of 2 */
+  uint32_t size;
+  uint32_t cnt;
+};
+
 struct mib_view {
-  struct mib_view *next;
+  struct mib_hash_node hnode;
   const oid_t *oid;
   uint32_t id_len;
+  /* storage of short oid, longer ones go to heap */
+  oid_t oid_inline[OID_INLINE_LEN];
   /* head of all relevant communities */
   struct list_head communities;
   /* head of all relevant users */
   struct list_head users;
 };
 
+/* View tree family, RFC 3415 */
+struct mib_vacm_family {
+  oid_t *subtree;
+  uint32_t len;
+  /* Bit i (MSB first) set if arc i must match, missing bits are set */
+  uint8_t mask[MIB_VACM_MASK_LEN];
+  uint8_t included;
+};
+
+/* Whether arc i must match the subtree of family */
+static inline int
+mib_vacm_mask_bit(const struct mib_vacm_family *f, uint32_t i)
+{
+  return i >= MIB_VACM_MASK_LEN * 8 || (f->mask[i / 8] & (0x80 >> (i % 8)));
+}
+
+/* Views of a community or user compiled into an array sorted by oid. The
+ * views do not overlap, so the one covering an oid is found in binary
+ * search. */
+struct mib_view_set {
+  struct mib_view **views;
+  uint32_t cnt;
+  /* VACM families deciding oids inside the views, in order of precedence.
+   * NULL when every oid inside the views is accessible. */
+  const struct mib_vacm_family *families;
+  uint32_t family_cnt;
+};
+
 struct mib_community {
-  struct mib_community *next;
+  struct mib_hash_node hnode;
   const char *name;
   /* head of relevant read only view */
   struct list_head ro_views;
   /* head of relevant read write view */
   struct list_head rw_views;
+  /* compiled from the lists above */
+  struct mib_view_set ro_set;
+  struct mib_view_set rw_set;
 };
 
 struct mib_user {
-  struct mib_user *next;
+  struct mib_hash_node hnode;
   const char *name;
   uint8_t auth_mode;
   uint8_t priv_mode;
   union {
     uint8_t md5[MD5_KEY_LEN];
     uint8_t sha1[SHA1_KEY_LEN];
+    uint8_t sha2[SHA2_KEY_LEN];
   } auth_key;
+  /* Bytes of localized auth key, the digest length */
+  uint8_t auth_key_len;
+  /* Bytes of MAC in messages */
+  uint8_t auth_mac_len;
+  /* HMAC hash states after the ipad and opad blocks of auth key */
+  uint32_t auth_ipad[AUTH_STATE_LEN];
+  uint32_t auth_opad[AUTH_STATE_LEN];
   union {
     uint8_t aes[AES_KEY_LEN];
   } priv_key;
+  /* Round keys expanded from priv key */
+  uint8_t priv_sched[AES_SCHED_LEN];
+  /* Keys not localized yet */
+  struct mib_key_job *key_job;
   /* head of relevant read only view */
   struct list_head ro_views;
   /* head of relevant read write view */
   struct list_head rw_views;
+  /* compiled from the lists above */
+  struct mib_view_set ro_set;
+  struct mib_view_set rw_set;
+};
+
+/* Localized keys of user to derive from pass phrases */
+struct mib_key_job {
+  const char *user;
+  uint8_t auth_mode;
+  /* Digest length of auth mode */
+  uint8_t key_len;
+  /* Copies of phrases, NULL if empty */
+  char *auth_phrase;
+  char *priv_phrase;
+  uint8_t auth_key[SHA2_KEY_LEN];
+  uint8_t priv_key[SHA2_KEY_LEN];
 };
 
 struct community_view {
@@ -131,28 +280,104 @@ struct user_view {
   struct mib_user *user;
 };
 
+/* Instance index of table */
+struct mib_index_key {
+  const oid_t *oid;
+  /* Position of arcs while building */
+  uint32_t off;
+  uint32_t len;
+};
+
+/* Sorted instance indexes of table, searched in binary */
+struct mib_index {
+  struct mib_index_key *keys;
+  uint32_t cnt;
+  uint32_t cap;
+  oid_t *arcs;
+  uint32_t arcs_cnt;
+  uint32_t arcs_cap;
+};
+
+/* Value cache counters */
+struct mib_cache_stats {
+  unsigned long hits;
+  unsigned long misses;
+  unsigned long entries;
+  /* GETNEXT searches resumed from a cursor or started from the root */
+  unsigned long cursor_hits;
+  unsigned long cursor_misses;
+};
+
+extern struct mib_cache_stats mib_cache_stats;
+
+/* Localized key store counters */
+struct mib_key_stats {
+  unsigned long hits;
+  unsigned long misses;
+  unsigned long entries;
+};
+
+extern struct mib_key_stats mib_key_stats;
+
 oid_t *oid_dup(const oid_t *oid, uint32_t len);
 oid_t *oid_cpy(oid_t *oid_dest, const oid_t *oid_src, uint32_t len);
 int oid_cmp(const oid_t *src, uint32_t src_len, const oid_t *target, uint32_t tar_len);
 int oid_cover(const oid_t *oid1, uint32_t len1, const oid_t *oid2, uint32_t len2);
+uint32_t oid_hash(const oid_t *oid, uint32_t len);
+int oid_binary_search(const oid_t *array, int n, oid_t oid);
+void mib_search_init(void);
 
 int mib_instance_search(struct oid_search_res *ret_oid);
 struct mib_node *mib_tree_search(struct mib_view *view, const oid_t *oid, uint32_t id_len, struct oid_search_res *ret_oid);
 void mib_tree_search_next(struct mib_view *view, const oid_t *oid, uint32_t id_len, struct oid_search_res *ret_oid);
 
-int mib_node_reg(const oid_t *oid, uint32_t id_len, int callback);
+int mib_node_reg(const oid_t *oid, uint32_t id_len, int callback, int bulk);
 void mib_node_unreg(const oid_t *oid, uint32_t id_len);
+void mib_hash_add(struct mib_hash *h, struct mib_hash_node *n, uint32_t hash);
+void mib_hash_del(struct mib_hash *h, struct mib_hash_node *n);
+struct mib_hash_node *mib_hash_first(const struct mib_hash *h, uint32_t hash);
+uint32_t mib_str_hash(const char *str);
+
 void mib_community_reg(const oid_t *oid, uint32_t len, const char *community, MIB_ACES_ATTR_E attribute);
 void mib_community_unreg(const char *community, MIB_ACES_ATTR_E attribute);
 void mib_user_reg(const oid_t *oid, uint32_t len, const char *community, MIB_ACES_ATTR_E attribute);
 void mib_user_unreg(const char *user, MIB_ACES_ATTR_E attribute);
 void mib_user_create(const char *user, uint8_t auth_mode, const char *auth_phrase, uint8_t priv_mode, const char *priv_phrase);
 struct mib_community *mib_community_search(const char *community);
-struct mib_view *mib_community_next_view(struct mib_community *c, MIB_ACES_ATTR_E attribute, struct mib_view *v);
-int mib_community_view_cover(struct mib_community *c, MIB_ACES_ATTR_E attribute, const oid_t *oid, uint32_t id_len);
+const struct mib_view_set *mib_community_view_set(const char *community, uint8_t version, MIB_ACES_ATTR_E attribute);
 struct mib_user *mib_user_search(const char *user);
-struct mib_view *mib_user_next_view(struct mib_user *u, MIB_ACES_ATTR_E attribute, struct mib_view *v);
-int mib_user_view_cover(struct mib_user *u, MIB_ACES_ATTR_E attribute, const oid_t *oid, uint32_t id_len);
+void mib_user_keys_flush(void);
+const struct mib_view_set *mib_user_view_set(struct mib_user *u, uint8_t level, MIB_ACES_ATTR_E attribute);
+uint32_t mib_view_set_locate(const struct mib_view_set *set, const oid_t *oid, uint32_t id_len);
+void mib_view_set_add(struct mib_view_set *set, const oid_t *oid, uint32_t id_len);
+void mib_view_set_free(struct mib_view_set *set);
+int mib_view_set_allow(const struct mib_view_set *set, const oid_t *oid, uint32_t id_len, uint32_t *skip_len);
+int mib_view_set_cover(const struct mib_view_set *set, const oid_t *oid, uint32_t id_len);
+
+int mib_vacm_view_add(const char *view, const oid_t *subtree, uint32_t len, const uint8_t *mask, uint32_t mask_len, int included);
+void mib_vacm_group_add(const char *group, uint8_t model, const char *name);
+void mib_vacm_access_add(const char *group, uint8_t model, uint8_t level, const char *read_view, const char *write_view);
+int mib_vacm_view_set(uint8_t model, const char *name, uint32_t hash, uint8_t level, MIB_ACES_ATTR_E attribute, const struct mib_view_set **set);
+
+int mib_key_store_open(const char *path);
+void mib_key_derive(struct mib_key_job **jobs, int n);
+struct mib_key_job *mib_key_job_new(const char *user, uint8_t auth_mode, uint8_t key_len, const char *auth_phrase, const char *priv_phrase);
+void mib_key_job_free(struct mib_key_job *job);
+void mib_key_wipe(void *p, size_t len);
+
+void mib_index_init(struct mib_index *idx);
+void mib_index_free(struct mib_index *idx);
+void mib_index_clear(struct mib_index *idx);
+void mib_index_add(struct mib_index *idx, const oid_t *oid, uint32_t len);
+void mib_index_sort(struct mib_index *idx);
+const struct mib_index_key *mib_index_next(const struct mib_index *idx, const oid_t *oid, uint32_t len);
+
+uint32_t mib_value_size(const Variable *var);
+void mib_value_ref(Variable *var, const void *value);
+int mib_cache_lookup(const oid_t *oid, uint32_t len, Variable *var);
+void mib_cache_store(const oid_t *oid, uint32_t len, const Variable *var, double ttl);
+void mib_cache_invalidate(const oid_t *oid, uint32_t len);
+void mib_cache_flush(void);
 
 void mib_init(lua_State *L);
 
@@ -0,0 +1,236 @@
+/*
+ * This file is part of SmithSNMP
+ * Copyright (C) 2014, Credo Semiconductor Inc.
+ * Copyright (C) 2015, Leo Ma <begeekmyfriend@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "mib.h"
+#include "utils.h"
+
+/* Number of hash buckets, must be power of 2 */
+#define MIB_CACHE_BUCKETS  256
+/* Max cached values */
+#define MIB_CACHE_MAX      1024
+
+/* Instance value cached for a while by full oid */
+struct mib_cache_entry {
+  struct mib_cache_entry *next;
+  uint32_t hash;
+  uint32_t id_len;
+  oid_t *oid;
+  oid_t oid_inline[OID_INLINE_LEN];
+  /* Monotonic time in milliseconds */
+  uint64_t expire;
+  uint8_t tag;
+  uint16_t len;
+  uint32_t size;
+  uint8_t value[0];
+};
+
+static struct mib_cache_entry *mib_cache[MIB_CACHE_BUCKETS];
+
+struct mib_cache_stats mib_cache_stats;
+
+static uint64_t
+mib_cache_now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* Bytes used by the value of variable */
+uint32_t
+mib_value_size(const Variable *var)
+{
+  switch (tag(var)) {
+  case ASN1_TAG_OCTSTR:
+  case ASN1_TAG_BITSTR:
+  case ASN1_TAG_IPADDR:
+    return length(var);
+  case ASN1_TAG_OBJID:
+    return length(var) * sizeof(oid_t);
+  case ASN1_TAG_OPAQ:
+    return length(var) * sizeof(opaq_t);
+  case ASN1_TAG_CNT64:
+    return sizeof(count64_t);
+  default:
+    return sizeof(integer_t);
+  }
+}
+
+/* Point the array value of var to the bytes given, scalars are copied */
+void
+mib_value_ref(Variable *var, const void *value)
+{
+  if (ASN1_TAG_ARRAY(tag(var))) {
+    var->value.p = (void *)value;
+  } else {
+    memcpy(&var->value, value, mib_value_size(var));
+  }
+}
+
+static void
+mib_cache_entry_free(struct mib_cache_entry *e)
+{
+  if (e->oid != e->oid_inline) {
+    free(e->oid);
+  }
+  free(e);
+  mib_cache_stats.entries--;
+}
+
+/* Drop expired entries */
+static void
+mib_cache_expire(uint64_t now)
+{
+  int i;
+  struct mib_cache_entry **p, *e;
+
+  for (i = 0; i < MIB_CACHE_BUCKETS; i++) {
+    p = &mib_cache[i];
+    while ((e = *p) != NULL) {
+      if (e->expire <= now) {
+        *p = e->next;
+        mib_cache_entry_free(e);
+      } else {
+        p = &e->next;
+      }
+    }
+  }
+}
+
+static struct mib_cache_entry **
+mib_cache_find(const oid_t *oid, uint32_t len, uint32_t hash)
+{
+  struct mib_cache_entry **p, *e;
+
+  for (p = &mib_cache[hash & (MIB_CACHE_BUCKETS - 1)]; (e = *p) != NULL; p = &e->next) {
+    if (e->hash == hash && !oid_cmp(e->oid, e->id_len, oid, len)) {
+      break;
+    }
+  }
+  return p;
+}
+
+/* Fill var with the cached value of oid, return 1 on hit. The value of
+ * strings and oids stays in the cache until the next store. */
+int
+mib_cache_lookup(const oid_t *oid, uint32_t len, Variable *var)
+{
+  struct mib_cache_entry **p, *e;
+
+  p = mib_cache_find(oid, len, oid_hash(oid, len));
+  e = *p;
+  if (e != NULL && e->expire <= mib_cache_now()) {
+    *p = e->next;
+    mib_cache_entry_free(e);
+    e = NULL;
+  }
+
+  if (e == NULL) {
+    mib_cache_stats.misses++;
+    return 0;
+  }
+
+  tag(var) = e->tag;
+  length(var) = e->len;
+  mib_value_ref(var, e->value);
+  mib_cache_stats.hits++;
+  return 1;
+}
+
+/* Keep the value of oid for ttl seconds */
+void
+mib_cache_store(const oid_t *oid, uint32_t len, const Variable *var, double ttl)
+{
+  struct mib_cache_entry **p, *e;
+  uint32_t hash, size;
+  uint64_t now;
+
+  now = mib_cache_now();
+  hash = oid_hash(oid, len);
+  p = mib_cache_find(oid, len, hash);
+  if (*p != NULL) {
+    e = *p;
+    *p = e->next;
+    mib_cache_entry_free(e);
+  }
+
+  if (mib_cache_stats.entries >= MIB_CACHE_MAX) {
+    mib_cache_expire(now);
+    if (mib_cache_stats.entries >= MIB_CACHE_MAX) {
+      /* Full of live values */
+      return;
+    }
+  }
+
+  size = mib_value_size(var);
+  e = xmalloc(sizeof(*e) + size);
+  e->hash = hash;
+  e->id_len = len;
+  if (len <= OID_INLINE_LEN) {
+    e->oid = oid_cpy(e->oid_inline, oid, len);
+  } else {
+    e->oid = oid_dup(oid, len);
+  }
+  e->expire = now + (uint64_t)(ttl * 1000);
+  e->tag = tag(var);
+  e->len = length(var);
+  e->size = size;
+  memcpy(e->value, value(var), size);
+
+  p = &mib_cache[hash & (MIB_CACHE_BUCKETS - 1)];
+  e->next = *p;
+  *p = e;
+  mib_cache_stats.entries++;
+}
+
+/* Forget the value of oid, e.g. when it is set */
+void
+mib_cache_invalidate(const oid_t *oid, uint32_t len)
+{
+  struct mib_cache_entry **p, *e;
+
+  p = mib_cache_find(oid, len, oid_hash(oid, len));
+  if ((e = *p) != NULL) {
+    *p = e->next;
+    mib_cache_entry_free(e);
+  }
+}
+
+/* Forget all values, e.g. when mib tree changes */
+void
+mib_cache_flush(void)
+{
+  int i;
+  struct mib_cache_entry *e, *n;
+
+  for (i = 0; i < MIB_CACHE_BUCKETS; i++) {
+    for (e = mib_cache[i]; e != NULL; e = n) {
+      n = e->next;
+      mib_cache_entry_free(e);
+    }
+    mib_cache[i] = NULL;
+  }
+}
@@ -0,0 +1,112 @@
+/*
+ * This file is part of SmithSNMP
+ * Copyright (C) 2014, Credo Semiconductor Inc.
+ * Copyright (C) 2015, Leo Ma <begeekmyfriend@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mib.h"
+#include "utils.h"
+
+static int
+mib_index_key_cmp(const void *a, const void *b)
+{
+  const struct mib_index_key *k1 = a, *k2 = b;
+  return oid_cmp(k1->oid, k1->len, k2->oid, k2->len);
+}
+
+void
+mib_index_init(struct mib_index *idx)
+{
+  memset(idx, 0, sizeof(*idx));
+}
+
+void
+mib_index_free(struct mib_index *idx)
+{
+  free(idx->keys);
+  free(idx->arcs);
+  mib_index_init(idx);
+}
+
+/* Drop all keys, buffers are kept for the next build */
+void
+mib_index_clear(struct mib_index *idx)
+{
+  idx->cnt = 0;
+  idx->arcs_cnt = 0;
+}
+
+/* Append one key, sorted later by mib_index_sort() */
+void
+mib_index_add(struct mib_index *idx, const oid_t *oid, uint32_t len)
+{
+  if (len == 0) {
+    return;
+  }
+
+  if (idx->cnt + 1 > idx->cap) {
+    idx->cap = alloc_nr(idx->cap);
+    idx->keys = xrealloc(idx->keys, idx->cap * sizeof(*idx->keys));
+  }
+  if (idx->arcs_cnt + len > idx->arcs_cap) {
+    while (idx->arcs_cnt + len > idx->arcs_cap) {
+      idx->arcs_cap = alloc_nr(idx->arcs_cap);
+    }
+    idx->arcs = xrealloc(idx->arcs, idx->arcs_cap * sizeof(oid_t));
+  }
+
+  /* Arcs may move on growing, key points into them after sort */
+  idx->keys[idx->cnt].off = idx->arcs_cnt;
+  idx->keys[idx->cnt].len = len;
+  idx->cnt++;
+  oid_cpy(idx->arcs + idx->arcs_cnt, oid, len);
+  idx->arcs_cnt += len;
+}
+
+void
+mib_index_sort(struct mib_index *idx)
+{
+  uint32_t i;
+
+  for (i = 0; i < idx->cnt; i++) {
+    idx->keys[i].oid = idx->arcs + idx->keys[i].off;
+  }
+  qsort(idx->keys, idx->cnt, sizeof(*idx->keys), mib_index_key_cmp);
+}
+
+/* The first key greater than oid, NULL if none */
+const struct mib_index_key *
+mib_index_next(const struct mib_index *idx, const oid_t *oid, uint32_t len)
+{
+  uint32_t low = 0, high = idx->cnt;
+
+  while (low < high) {
+    uint32_t mid = low + (high - low) / 2;
+    if (oid_cmp(idx->keys[mid].oid, idx->keys[mid].len, oid, len) <= 0) {
+      low = mid + 1;
+    } else {
+      high = mid;
+    }
+  }
+
+  return low < idx->cnt ? &idx->keys[low] : NULL;
+}
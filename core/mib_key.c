@@ -0,0 +1,494 @@
+/*
+ * This file is part of SmithSNMP
+ * Copyright (C) 2014, Credo Semiconductor Inc.
+ * Copyright (C) 2015, Leo Ma <begeekmyfriend@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#ifdef USE_PTHREAD
+#include <pthread.h>
+#endif
+
+#include "mib.h"
+#include "snmp.h"
+
+/*
+ * Localized USM keys are derived from pass phrases by hashing a megabyte of
+ * the phrase (RFC 3414 A.2), which dominates startup with many users. Keys
+ * are kept in a store file, one per line:
+ *
+ *   <auth mode> <engine id hex> <fingerprint hex> <key hex> <user>
+ *
+ * The fingerprint is the HMAC of user name and engine id keyed by the
+ * phrase, so the phrase itself is never written. The store holds key
+ * material and is created with mode 0600.
+ */
+
+/* Number of hash buckets, must be power of 2 */
+#define MIB_KEY_BUCKETS  256
+/* Max threads deriving keys missed in store */
+#define MIB_KEY_THREADS  16
+
+struct mib_key_entry {
+  struct mib_key_entry *next;
+  uint8_t auth_mode;
+  uint8_t key_len;
+  uint8_t fp[SHA2_KEY_LEN];
+  uint8_t key[SHA2_KEY_LEN];
+};
+
+/* One phrase to localize */
+struct mib_key_task {
+  uint8_t auth_mode;
+  uint8_t key_len;
+  const char *user;
+  const char *phrase;
+  uint8_t fp[SHA2_KEY_LEN];
+  /* Fingerprint taken, key can be stored */
+  uint8_t fp_ok;
+  uint8_t *key;
+};
+
+static struct mib_key_entry *mib_key_store[MIB_KEY_BUCKETS];
+static char *mib_key_store_path;
+
+struct mib_key_stats mib_key_stats;
+
+/* Clear secrets in a way the compiler does not drop */
+void
+mib_key_wipe(void *p, size_t len)
+{
+  volatile uint8_t *b = p;
+  while (len-- > 0) {
+    *b++ = 0;
+  }
+}
+
+static inline uint32_t
+mib_key_bucket(const uint8_t *fp)
+{
+  return fp[0] & (MIB_KEY_BUCKETS - 1);
+}
+
+static struct mib_key_entry *
+mib_key_find(uint8_t auth_mode, uint8_t key_len, const uint8_t *fp)
+{
+  struct mib_key_entry *e;
+
+  for (e = mib_key_store[mib_key_bucket(fp)]; e != NULL; e = e->next) {
+    if (e->auth_mode == auth_mode && e->key_len == key_len && !memcmp(e->fp, fp, key_len)) {
+      return e;
+    }
+  }
+  return NULL;
+}
+
+static void
+mib_key_insert(uint8_t auth_mode, uint8_t key_len, const uint8_t *fp, const uint8_t *key)
+{
+  struct mib_key_entry *e, **p;
+
+  e = mib_key_find(auth_mode, key_len, fp);
+  if (e == NULL) {
+    e = xmalloc(sizeof(*e));
+    e->auth_mode = auth_mode;
+    e->key_len = key_len;
+    memcpy(e->fp, fp, key_len);
+    p = &mib_key_store[mib_key_bucket(fp)];
+    e->next = *p;
+    *p = e;
+    mib_key_stats.entries++;
+  }
+  /* Later lines override earlier ones */
+  memcpy(e->key, key, key_len);
+}
+
+/* Decode hex string into buf, return number of bytes or -1 */
+static int
+hex_dec(const char *str, uint8_t *buf, uint32_t size)
+{
+  uint32_t i, len = strlen(str);
+
+  if (len % 2 || len / 2 > size) {
+    return -1;
+  }
+  for (i = 0; i < len / 2; i++) {
+    unsigned int byte;
+    if (sscanf(str + 2 * i, "%2x", &byte) != 1) {
+      return -1;
+    }
+    buf[i] = byte;
+  }
+  return len / 2;
+}
+
+static void
+mib_key_store_clear(void)
+{
+  int i;
+  struct mib_key_entry *e, *n;
+
+  for (i = 0; i < MIB_KEY_BUCKETS; i++) {
+    for (e = mib_key_store[i]; e != NULL; e = n) {
+      n = e->next;
+      mib_key_wipe(e, sizeof(*e));
+      free(e);
+    }
+    mib_key_store[i] = NULL;
+  }
+  mib_key_stats.entries = 0;
+}
+
+/* Load localized keys of this engine from store file, which is created on
+ * first save. Return -1 if the file exists and can not be read. */
+int
+mib_key_store_open(const char *path)
+{
+  FILE *fp;
+  char line[512], engine[128], fp_hex[2 * SHA2_KEY_LEN + 2], key_hex[2 * SHA2_KEY_LEN + 2];
+  uint8_t engine_id[64], fprint[SHA2_KEY_LEN], key[SHA2_KEY_LEN];
+  unsigned int auth_mode;
+  int len;
+
+  mib_key_store_clear();
+  free(mib_key_store_path);
+  mib_key_store_path = NULL;
+
+  fp = fopen(path, "r");
+  if (fp == NULL) {
+    if (access(path, F_OK) == 0) {
+      SMARTSNMP_LOG(L_WARNING, "Can not read key store %s\n", path);
+      return -1;
+    }
+  } else {
+    while (fgets(line, sizeof(line), fp) != NULL) {
+      if (sscanf(line, "%u %127s %129s %129s", &auth_mode, engine, fp_hex, key_hex) != 4) {
+        continue;
+      }
+      /* Keys of other engines are kept in file only */
+      len = hex_dec(engine, engine_id, sizeof(engine_id));
+      if (len != sizeof(snmpv3_engine_id) || memcmp(engine_id, snmpv3_engine_id, len)) {
+        continue;
+      }
+      len = hex_dec(key_hex, key, sizeof(key));
+      if (len <= 0 || hex_dec(fp_hex, fprint, sizeof(fprint)) != len) {
+        continue;
+      }
+      mib_key_insert(auth_mode, len, fprint, key);
+    }
+    mib_key_wipe(line, sizeof(line));
+    mib_key_wipe(key_hex, sizeof(key_hex));
+    mib_key_wipe(key, sizeof(key));
+    fclose(fp);
+  }
+
+  mib_key_store_path = xmalloc(strlen(path) + 1);
+  strcpy(mib_key_store_path, path);
+  return 0;
+}
+
+#ifndef DISABLE_CRYPTO
+/* Fingerprint of phrase for user and engine id. The phrase is both the
+ * HMAC key and part of the message, since keys longer than a block are cut
+ * by the prepare functions of MD5 and SHA-1. */
+static int
+mib_key_fingerprint(struct mib_key_task *t)
+{
+  const uint8_t *phrase = (const uint8_t *)t->phrase;
+  uint32_t ipad[AUTH_STATE_LEN], opad[AUTH_STATE_LEN];
+  uint32_t ulen = strlen(t->user);
+  uint32_t plen = strlen(t->phrase);
+  uint32_t len = ulen + 1 + sizeof(snmpv3_engine_id) + plen;
+  uint8_t *data = xmalloc(len);
+  int ret = -1;
+
+  memcpy(data, t->user, ulen + 1);
+  memcpy(data + ulen + 1, snmpv3_engine_id, sizeof(snmpv3_engine_id));
+  memcpy(data + ulen + 1 + sizeof(snmpv3_engine_id), phrase, plen);
+
+  switch (t->auth_mode) {
+#ifndef DISABLE_MD5
+  case SNMP_USER_AUTH_MD5:
+    MD5_hmac_prepare(phrase, plen, ipad, opad);
+    ret = MD5_hmac_prepared(data, len, t->fp, t->key_len, ipad, opad);
+    break;
+#endif
+#ifndef DISABLE_SHA
+  case SNMP_USER_AUTH_SHA1:
+    SHA1_hmac_prepare(phrase, plen, ipad, opad);
+    ret = SHA1_hmac_prepared(data, len, t->fp, t->key_len, ipad, opad);
+    break;
+  case SNMP_USER_AUTH_SHA224:
+  case SNMP_USER_AUTH_SHA256:
+  case SNMP_USER_AUTH_SHA384:
+  case SNMP_USER_AUTH_SHA512:
+    SHA2_hmac_prepare(t->key_len, phrase, plen, ipad, opad);
+    ret = SHA2_hmac_prepared(t->key_len, data, len, t->fp, t->key_len, ipad, opad);
+    break;
+#endif
+  default:
+    break;
+  }
+
+  mib_key_wipe(ipad, sizeof(ipad));
+  mib_key_wipe(opad, sizeof(opad));
+  mib_key_wipe(data, len);
+  free(data);
+  return ret;
+}
+
+/* RFC 3414 password to key algorithm with localization */
+static void
+mib_key_localize(struct mib_key_task *t)
+{
+  const uint8_t *password = (const uint8_t *)t->phrase;
+  uint32_t len = strlen(t->phrase);
+
+  switch (t->auth_mode) {
+#ifndef DISABLE_MD5
+  case SNMP_USER_AUTH_MD5:
+    MD5_key(password, len, snmpv3_engine_id, sizeof(snmpv3_engine_id), t->key);
+    break;
+#endif
+#ifndef DISABLE_SHA
+  case SNMP_USER_AUTH_SHA1:
+    SHA1_key(password, len, snmpv3_engine_id, sizeof(snmpv3_engine_id), t->key);
+    break;
+  case SNMP_USER_AUTH_SHA224:
+  case SNMP_USER_AUTH_SHA256:
+  case SNMP_USER_AUTH_SHA384:
+  case SNMP_USER_AUTH_SHA512:
+    SHA2_key(t->key_len, password, len, snmpv3_engine_id, sizeof(snmpv3_engine_id), t->key);
+    break;
+#endif
+  default:
+    break;
+  }
+}
+
+static void
+hex_enc(FILE *fp, const uint8_t *buf, uint32_t len)
+{
+  while (len-- > 0) {
+    fprintf(fp, "%02x", *buf++);
+  }
+}
+
+/* Append keys derived for store misses */
+static void
+mib_key_store_save(struct mib_key_task *tasks, int n)
+{
+  FILE *fp;
+  int i, fd;
+
+  fd = open(mib_key_store_path, O_WRONLY | O_CREAT | O_APPEND, 0600);
+  if (fd < 0 || (fp = fdopen(fd, "a")) == NULL) {
+    SMARTSNMP_LOG(L_WARNING, "Can not write key store %s\n", mib_key_store_path);
+    if (fd >= 0) {
+      close(fd);
+    }
+    return;
+  }
+
+  for (i = 0; i < n; i++) {
+    struct mib_key_task *t = &tasks[i];
+    if (!t->fp_ok) {
+      continue;
+    }
+    mib_key_insert(t->auth_mode, t->key_len, t->fp, t->key);
+    fprintf(fp, "%u ", t->auth_mode);
+    hex_enc(fp, snmpv3_engine_id, sizeof(snmpv3_engine_id));
+    fputc(' ', fp);
+    hex_enc(fp, t->fp, t->key_len);
+    fputc(' ', fp);
+    hex_enc(fp, t->key, t->key_len);
+    fprintf(fp, " %s\n", t->user);
+  }
+  fclose(fp);
+}
+
+/* Tasks shared by the threads deriving keys */
+struct mib_key_pool {
+  struct mib_key_task *tasks;
+  int n;
+  int next;
+#ifdef USE_PTHREAD
+  pthread_mutex_t lock;
+#endif
+};
+
+static void *
+mib_key_worker(void *arg)
+{
+  struct mib_key_pool *pool = arg;
+  int i;
+
+  for (;;) {
+#ifdef USE_PTHREAD
+    pthread_mutex_lock(&pool->lock);
+#endif
+    i = pool->next++;
+#ifdef USE_PTHREAD
+    pthread_mutex_unlock(&pool->lock);
+#endif
+    if (i >= pool->n) {
+      break;
+    }
+    mib_key_localize(&pool->tasks[i]);
+  }
+  return NULL;
+}
+
+/* Localize the keys of tasks, spread over online cores if built with
+ * USE_PTHREAD. The calling thread takes part. */
+static void
+mib_key_localize_all(struct mib_key_task *tasks, int n)
+{
+  struct mib_key_pool pool;
+
+  pool.tasks = tasks;
+  pool.n = n;
+  pool.next = 0;
+
+#ifdef USE_PTHREAD
+  pthread_t tids[MIB_KEY_THREADS];
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  int i, threads = 0;
+
+  if (cpus > MIB_KEY_THREADS) {
+    cpus = MIB_KEY_THREADS;
+  }
+  if (cpus > n) {
+    cpus = n;
+  }
+
+  pthread_mutex_init(&pool.lock, NULL);
+  for (i = 1; i < cpus; i++) {
+    if (pthread_create(&tids[threads], NULL, mib_key_worker, &pool) == 0) {
+      threads++;
+    }
+  }
+  mib_key_worker(&pool);
+  for (i = 0; i < threads; i++) {
+    pthread_join(tids[i], NULL);
+  }
+  pthread_mutex_destroy(&pool.lock);
+#else
+  mib_key_worker(&pool);
+#endif
+}
+
+static void
+mib_key_task_add(struct mib_key_task *t, const struct mib_key_job *job, const char *phrase, uint8_t *key)
+{
+  t->auth_mode = job->auth_mode;
+  t->key_len = job->key_len;
+  t->user = job->user;
+  t->phrase = phrase;
+  t->key = key;
+}
+#endif
+
+/* Fill in localized keys of jobs, from store or derived from phrases */
+void
+mib_key_derive(struct mib_key_job **jobs, int n)
+{
+#ifndef DISABLE_CRYPTO
+  struct mib_key_task *tasks;
+  struct mib_key_entry *e;
+  int i, cnt, miss;
+
+  tasks = xmalloc(2 * n * sizeof(*tasks));
+  for (i = cnt = 0; i < n; i++) {
+    struct mib_key_job *job = jobs[i];
+    if (job->auth_phrase != NULL) {
+      mib_key_task_add(&tasks[cnt++], job, job->auth_phrase, job->auth_key);
+    }
+    if (job->priv_phrase != NULL) {
+      mib_key_task_add(&tasks[cnt++], job, job->priv_phrase, job->priv_key);
+    }
+  }
+
+  /* Move misses to the front */
+  for (i = miss = 0; i < cnt; i++) {
+    struct mib_key_task *t = &tasks[i];
+    t->fp_ok = mib_key_store_path != NULL && mib_key_fingerprint(t) >= 0;
+    if (t->fp_ok && (e = mib_key_find(t->auth_mode, t->key_len, t->fp)) != NULL) {
+      memcpy(t->key, e->key, t->key_len);
+      mib_key_stats.hits++;
+    } else {
+      if (i != miss) {
+        struct mib_key_task tmp = tasks[miss];
+        tasks[miss] = *t;
+        *t = tmp;
+      }
+      miss++;
+    }
+  }
+  mib_key_stats.misses += miss;
+
+  mib_key_localize_all(tasks, miss);
+
+  if (mib_key_store_path != NULL && miss > 0) {
+    mib_key_store_save(tasks, miss);
+  }
+
+  mib_key_wipe(tasks, 2 * n * sizeof(*tasks));
+  free(tasks);
+#endif
+}
+
+/* New job of user keys, phrases are copied */
+struct mib_key_job *
+mib_key_job_new(const char *user, uint8_t auth_mode, uint8_t key_len, const char *auth_phrase, const char *priv_phrase)
+{
+  struct mib_key_job *job = xcalloc(1, sizeof(*job));
+
+  job->user = user;
+  job->auth_mode = auth_mode;
+  job->key_len = key_len;
+  if (strlen(auth_phrase)) {
+    job->auth_phrase = xmalloc(strlen(auth_phrase) + 1);
+    strcpy(job->auth_phrase, auth_phrase);
+    if (strlen(priv_phrase)) {
+      job->priv_phrase = xmalloc(strlen(priv_phrase) + 1);
+      strcpy(job->priv_phrase, priv_phrase);
+    }
+  }
+  return job;
+}
+
+void
+mib_key_job_free(struct mib_key_job *job)
+{
+  if (job->auth_phrase != NULL) {
+    mib_key_wipe(job->auth_phrase, strlen(job->auth_phrase));
+    free(job->auth_phrase);
+  }
+  if (job->priv_phrase != NULL) {
+    mib_key_wipe(job->priv_phrase, strlen(job->priv_phrase));
+    free(job->priv_phrase);
+  }
+  mib_key_wipe(job, sizeof(*job));
+  free(job);
+}
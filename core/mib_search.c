@@ -0,0 +1,145 @@
+/*
+ * This file is part of SmithSNMP
+ * Copyright (C) 2014, Credo Semiconductor Inc.
+ * Copyright (C) 2015, Leo Ma <begeekmyfriend@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "mib.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && !defined(DISABLE_SIMD)
+#define OID_SEARCH_SIMD
+#include <immintrin.h>
+#endif
+
+/* Group nodes with at least so many sub-ids are searched with SIMD,
+ * must not be less than the widest SIMD window. */
+#define OID_SEARCH_WIDE  32
+
+/* Index of the first sub-id not less than target */
+static int
+oid_lower_bound(const oid_t *array, int n, oid_t oid)
+{
+  int low = -1;
+  int high = n;
+
+  /* Search the last position that fits target. */
+  while (low + 1 < high) {
+    int mid = low + (high - low) / 2;
+    if (array[mid] < oid) {
+      low = mid;
+    } else {
+      high = mid;
+    }
+  }
+
+  return high;
+}
+
+#ifdef OID_SEARCH_SIMD
+/* Narrow the range down to at most window sub-ids without branches, then
+ * return the start of a window of the array holding the lower bound. The
+ * sub-ids ahead of the window are all less than target and the ones behind
+ * not, so the lower bound is the start plus the number of less sub-ids in
+ * the window. */
+static inline const oid_t *
+oid_window(const oid_t *array, int n, oid_t oid, int window)
+{
+  const oid_t *base = array;
+  int len = n;
+
+  while (len > window) {
+    int half = len / 2;
+    base = base[half] < oid ? base + half : base;
+    len -= half;
+  }
+
+  return base + window > array + n ? array + n - window : base;
+}
+
+__attribute__((target("sse2"))) static int
+oid_lower_bound_sse2(const oid_t *array, int n, oid_t oid)
+{
+  int i, cnt = 0;
+  const oid_t *base = oid_window(array, n, oid, 16);
+  /* No unsigned compare in SSE2, flip the sign bit for signed one */
+  const __m128i bias = _mm_set1_epi32(0x80000000);
+  const __m128i key = _mm_xor_si128(_mm_set1_epi32(oid), bias);
+
+  for (i = 0; i < 16; i += 4) {
+    __m128i v = _mm_xor_si128(_mm_loadu_si128((const __m128i *)(base + i)), bias);
+    cnt += __builtin_popcount(_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(key, v))));
+  }
+
+  return base - array + cnt;
+}
+
+__attribute__((target("avx2"))) static int
+oid_lower_bound_avx2(const oid_t *array, int n, oid_t oid)
+{
+  int i, cnt = 0;
+  const oid_t *base = oid_window(array, n, oid, 32);
+  const __m256i bias = _mm256_set1_epi32(0x80000000);
+  const __m256i key = _mm256_xor_si256(_mm256_set1_epi32(oid), bias);
+
+  for (i = 0; i < 32; i += 8) {
+    __m256i v = _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)(base + i)), bias);
+    cnt += __builtin_popcount(_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(key, v))));
+  }
+
+  return base - array + cnt;
+}
+#endif
+
+/* Lower bound search for wide group nodes, selected by mib_search_init() */
+static int (*oid_lower_bound_wide)(const oid_t *array, int n, oid_t oid) = oid_lower_bound;
+
+/* Return the index of sub-id, or -(insert position) - 1 if not found */
+int
+oid_binary_search(const oid_t *array, int n, oid_t oid)
+{
+  int i;
+
+  if (n >= OID_SEARCH_WIDE) {
+    i = oid_lower_bound_wide(array, n, oid);
+  } else {
+    i = oid_lower_bound(array, n, oid);
+  }
+
+  if (i >= n || array[i] != oid) {
+    return -i - 1;
+  } else {
+    return i;
+  }
+}
+
+/* Pick the widest SIMD search the CPU supports */
+void
+mib_search_init(void)
+{
+#ifdef OID_SEARCH_SIMD
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    oid_lower_bound_wide = oid_lower_bound_avx2;
+  } else if (__builtin_cpu_supports("sse2")) {
+    oid_lower_bound_wide = oid_lower_bound_sse2;
+  }
+#endif
+}
@@ -25,16 +25,56 @@
 #include <assert.h>
 
 #include "mib.h"
+#include "snmp.h"
 #include "utils.h"
 
 /* MIB lua state */
 static lua_State *mib_lua_state;
 
+/* Group node of frozen mib-tree. The arcs are the collapsed chain, then
+ * sub-ids and then offsets of sub-nodes in the frozen tree. */
+struct mib_frozen_group {
+  uint8_t type;
+  uint8_t prefix_len;
+  uint16_t sub_id_cnt;
+  oid_t arcs[0];
+};
+
+/* Instance node of frozen mib-tree followed by BER encoded oid of the node */
+struct mib_frozen_instance {
+  uint8_t type;
+  uint8_t bulk;
+  uint16_t ber_len;
+  int callback;
+  uint8_t ber[0];
+};
+
+#define frozen_prefix(fg)       ((fg)->arcs)
+#define frozen_sub_id(fg)       ((fg)->arcs + (fg)->prefix_len)
+#define frozen_sub_node(fg, i)  ((struct mib_node *)(mib_frozen + (fg)->arcs[(fg)->prefix_len + (fg)->sub_id_cnt + (i)]))
+
+/* Read-only copy of mib-tree searched by requests. Nodes are laid out breadth
+ * first in one array and linked by 32-bit offsets, the root at offset 0. */
+static uint32_t *mib_frozen;
+/* Set when mib-tree changes, the frozen copy is rebuilt on next search */
+static int mib_frozen_dirty = 1;
+
+/* Bumped when mib tree changes, all cursors of older generation are stale */
+static uint32_t mib_cursor_generation = 1;
+
+static inline void
+mib_cursor_flush(void)
+{
+  mib_cursor_generation++;
+}
+
 /* Dummy root node */
 static struct mib_group_node mib_dummy_node = {
   MIB_OBJ_GROUP,
   1,
   0,
+  0,
+  NULL,
   NULL,
   NULL
 };
@@ -42,25 +82,25 @@ static struct mib_group_node mib_dummy_node = {
 oid_t *
 oid_dup(const oid_t *oid, uint32_t len)
 {
-  int i;
-  /* We need to allocate largest space so as to hold any oid */
-  oid_t *new_oid = xmalloc(ASN1_VALUE_MAX_LEN * sizeof(oid_t));
-  for (i = 0; i < len; i++) {
-    new_oid[i] = oid[i];
-  }
-  return new_oid;
+  /* Exactly as long as the oid */
+  oid_t *new_oid = xmalloc((len ? len : 1) * sizeof(oid_t));
+  return oid_cpy(new_oid, oid, len);
 }
 
 int
 oid_cmp(const oid_t *src, uint32_t src_len, const oid_t *target, uint32_t tar_len)
 {
-  int ret = 0;
-  while (src_len && tar_len && !(ret = (int)(*src++ - *target++))) {
+  while (src_len && tar_len) {
+    /* Arcs are unsigned, their difference may not fit in int */
+    if (*src != *target) {
+      return *src < *target ? -1 : 1;
+    }
+    src++;
+    target++;
     src_len--;
     tar_len--;
-    continue;
   }
-  return ret == 0 ? src_len - tar_len : ret;
+  return src_len - tar_len;
 }
 
 oid_t *
@@ -88,26 +128,79 @@ oid_cover(const oid_t *oid1, uint32_t len1, const oid_t *oid2, uint32_t len2)
   }
 }
 
-static int
-oid_binary_search(oid_t *array, int n, oid_t oid)
+/* FNV-1a hash of oid */
+uint32_t
+oid_hash(const oid_t *oid, uint32_t len)
 {
-  int low = -1;
-  int high = n;
-
-  /* Search the last position that fits target. */
-  while (low + 1 < high) {
-    int mid = low + (high - low) / 2;
-    if (array[mid] < oid) {
-      low = mid;
-    } else {
-      high = mid;
-    }
+  uint32_t h = 2166136261u;
+  while (len-- > 0) {
+    h = (h ^ *oid++) * 16777619u;
   }
+  return h;
+}
 
-  if (high >= n || array[high] != oid) {
-    return -high - 1;
-  } else {
-    return high;
+/* Number of leading arcs of oid matching the collapsed chain of group node */
+static inline uint32_t
+prefix_match(const oid_t *prefix, uint32_t prefix_len, const oid_t *oid, uint32_t id_len)
+{
+  uint32_t i, n = prefix_len < id_len ? prefix_len : id_len;
+
+  for (i = 0; i < n && oid[i] == prefix[i]; i++);
+  return i;
+}
+
+/* Convert the lua value at idx according to tag(var), strings point to
+ * the Lua string while ip addresses and oids are stored in arena. */
+static void
+mib_lua_value_get(lua_State *L, int idx, Variable *var, struct mem_arena *arena)
+{
+  int i;
+  size_t len;
+
+  switch (tag(var)) {
+  case ASN1_TAG_INT:
+    length(var) = 1;
+    integer(var) = lua_tointeger(L, idx);
+    break;
+  case ASN1_TAG_OCTSTR:
+    len = lua_objlen(L, idx);
+    length(var) = len < ASN1_VALUE_MAX_LEN ? len : ASN1_VALUE_MAX_LEN;
+    octstr(var) = (octstr_t *)lua_tostring(L, idx);
+    break;
+  case ASN1_TAG_CNT:
+    length(var) = 1;
+    count(var) = lua_tonumber(L, idx);
+    break;
+  case ASN1_TAG_IPADDR:
+    len = lua_objlen(L, idx);
+    length(var) = len < ASN1_VALUE_MAX_LEN ? len : ASN1_VALUE_MAX_LEN;
+    ipaddr(var) = arena_alloc(arena, length(var) * sizeof(ipaddr_t));
+    for (i = 0; i < length(var); i++) {
+      lua_rawgeti(L, idx, i + 1);
+      ipaddr(var)[i] = lua_tointeger(L, -1);
+      lua_pop(L, 1);
+    }
+    break;
+  case ASN1_TAG_OBJID:
+    len = lua_objlen(L, idx);
+    length(var) = len < ASN1_OID_MAX_LEN ? len : ASN1_OID_MAX_LEN;
+    oid(var) = arena_alloc(arena, length(var) * sizeof(oid_t));
+    for (i = 0; i < length(var); i++) {
+      lua_rawgeti(L, idx, i + 1);
+      oid(var)[i] = lua_tointeger(L, -1);
+      lua_pop(L, 1);
+    }
+    break;
+  case ASN1_TAG_GAU:
+    length(var) = 1;
+    gauge(var) = lua_tonumber(L, idx);
+    break;
+  case ASN1_TAG_TIMETICKS:
+    length(var) = 1;
+    timeticks(var) = lua_tonumber(L, idx);
+    break;
+  default:
+    assert(0);
   }
 }
 
@@ -116,9 +209,21 @@ int
 mib_instance_search(struct oid_search_res *ret_oid)
 {
   int i;
+  uint32_t id_len;
+  lua_Number ttl;
   Variable *var = &ret_oid->var;
   lua_State *L = mib_lua_state;
 
+  /* Values declared with ttl are served from cache without Lua */
+  id_len = ret_oid->inst_id - ret_oid->oid + ret_oid->inst_id_len;
+  if (ret_oid->request == SNMP_REQ_GET) {
+    if (mib_cache_lookup(ret_oid->oid, id_len, var)) {
+      return 0;
+    }
+  } else if (ret_oid->request == SNMP_REQ_SET) {
+    mib_cache_invalidate(ret_oid->oid, id_len);
+  }
+
   /* Empty lua stack. */
   lua_pop(L, -1);
   /* Get function. */
@@ -173,74 +278,305 @@ mib_instance_search(struct oid_search_res *ret_oid)
     lua_pushnil(L);
   }
 
-  if (lua_pcall(L, 4, 4, 0) != 0) {
+  if (lua_pcall(L, 4, 5, 0) != 0) {
     SMARTSNMP_LOG(L_ERROR, "MIB search hander %d fail: %s\n", ret_oid->callback, lua_tostring(L, -1));
     tag(var) = ASN1_TAG_NO_SUCH_OBJ;
     return 0;
   }
 
+  /* Optional time to live of the value in seconds */
+  ttl = lua_tonumber(L, -1);
+  lua_pop(L, 1);
+
   ret_oid->err_stat = lua_tointeger(L, -4);
   tag(var) = lua_tonumber(L, -1);
 
   if (!ret_oid->err_stat && ASN1_TAG_VALID(tag(var))) {
     /* Return value */
     if (ret_oid->request != SNMP_REQ_SET) {
-      switch (tag(var)) {
-      case ASN1_TAG_INT:
-        length(var) = 1;
-        integer(var) = lua_tointeger(L, -2);
-        break;
-      case ASN1_TAG_OCTSTR:
-        length(var) = lua_objlen(L, -2);
-        memcpy(octstr(var), lua_tostring(L, -2), length(var));
-        break;
-      case ASN1_TAG_CNT:
-        length(var) = 1;
-        count(var) = lua_tonumber(L, -2);
-        break;
-      case ASN1_TAG_IPADDR:
-        length(var) = lua_objlen(L, -2);
-        for (i = 0; i < length(var); i++) {
-          lua_rawgeti(L, -2, i + 1);
-          ipaddr(var)[i] = lua_tointeger(L, -1);
-          lua_pop(L, 1);
-        }
-        break;
-      case ASN1_TAG_OBJID:
-        length(var) = lua_objlen(L, -2);
-        for (i = 0; i < length(var); i++) {
-          lua_rawgeti(L, -2, i + 1);
-          oid(var)[i] = lua_tointeger(L, -1);
-          lua_pop(L, 1);
-        }
-        break;
-      case ASN1_TAG_GAU:
-        length(var) = 1;
-        gauge(var) = lua_tonumber(L, -2);
-        break;
-      case ASN1_TAG_TIMETICKS:
-        length(var) = 1;
-        timeticks(var) = lua_tonumber(L, -2);
-        break;
-      default:
-        assert(0);
-      }
+      mib_lua_value_get(L, -2, var, ret_oid->arena);
     }
 
     /* For GETNEXT request, return the new oid */
     if (ret_oid->request == SNMP_REQ_GETNEXT) {
       ret_oid->inst_id_len = lua_objlen(L, -3);
+      if (ret_oid->inst_id_len > ASN1_OID_MAX_LEN - (ret_oid->inst_id - ret_oid->oid)) {
+        /* Would overflow the return oid buffer */
+        SMARTSNMP_LOG(L_ERROR, "MIB search hander %d returns too long oid\n", ret_oid->callback);
+        tag(var) = ASN1_TAG_NO_SUCH_OBJ;
+        return 0;
+      }
       for (i = 0; i < ret_oid->inst_id_len; i++) {
         lua_rawgeti(L, -3, i + 1);
         ret_oid->inst_id[i] = lua_tointeger(L, -1);
         lua_pop(L, 1);
       }
+      id_len = ret_oid->inst_id - ret_oid->oid + ret_oid->inst_id_len;
+    }
+
+    if (ttl > 0 && ret_oid->request != SNMP_REQ_SET && !ret_oid->err_stat) {
+      mib_cache_store(ret_oid->oid, id_len, var, ttl);
+    }
+  }
+
+  return ret_oid->err_stat;
+}
+
+/* Fetch a batch of instances following the search oid in one Lua call */
+static void
+mib_walk_fetch(struct oid_search_res *ret_oid)
+{
+  int i, n;
+  uint32_t j, count, prefix_len, sub_len;
+  struct mib_walk *walk = ret_oid->walk;
+  struct mib_walk_row *row;
+  Variable *var = &ret_oid->var;
+  lua_State *L = mib_lua_state;
+
+  walk->callback = ret_oid->callback;
+  walk->err_stat = 0;
+  walk->end = 0;
+  walk->cnt = 0;
+  walk->pos = 0;
+
+  count = walk->want < 1 ? 1 : walk->want;
+  count = count > MIB_WALK_MAX ? MIB_WALK_MAX : count;
+  prefix_len = ret_oid->inst_id - ret_oid->oid;
+
+  /* Empty lua stack. */
+  lua_pop(L, -1);
+  /* Get function. */
+  lua_rawgeti(L, LUA_ENVIRONINDEX, ret_oid->callback);
+  /* op */
+  lua_pushinteger(L, SNMP_REQ_BULKGET);
+  /* req_sub_oid */
+  lua_newtable(L);
+  for (i = 0; i < ret_oid->inst_id_len; i++) {
+    lua_pushinteger(L, ret_oid->inst_id[i]);
+    lua_rawseti(L, -2, i + 1);
+  }
+  /* req_val, max number of instances */
+  lua_pushinteger(L, count);
+  /* req_val_type */
+  lua_pushnil(L);
+
+  if (lua_pcall(L, 4, 3, 0) != 0) {
+    SMARTSNMP_LOG(L_ERROR, "MIB walk hander %d fail: %s\n", ret_oid->callback, lua_tostring(L, -1));
+    walk->end = 1;
+    return;
+  }
+
+  /* err_stat, rows of {sub_oid, tag, value, ...}, number of rows */
+  walk->err_stat = lua_tointeger(L, -3);
+  n = lua_tointeger(L, -1);
+  lua_pop(L, 1);
+  if (n < 0 || !lua_istable(L, -1)) {
+    n = 0;
+  } else if (n > count) {
+    n = count;
+  }
+
+  walk->rows = arena_alloc(walk->arena, (n > 0 ? n : 1) * sizeof(*walk->rows));
+  for (i = 0; i < n; i++) {
+    lua_rawgeti(L, -1, 3 * i + 2);
+    tag(var) = lua_tointeger(L, -1);
+    lua_pop(L, 1);
+    if (!ASN1_TAG_VALID(tag(var))) {
+      break;
+    }
+
+    lua_rawgeti(L, -1, 3 * i + 1);
+    sub_len = lua_objlen(L, -1);
+    if (sub_len > ASN1_OID_MAX_LEN - prefix_len) {
+      /* Would overflow the return oid buffer */
+      SMARTSNMP_LOG(L_ERROR, "MIB walk hander %d returns too long oid\n", ret_oid->callback);
+      lua_pop(L, 1);
+      break;
+    }
+
+    lua_rawgeti(L, -2, 3 * i + 3);
+    mib_lua_value_get(L, -1, var, walk->arena);
+    lua_pop(L, 1);
+
+    row = arena_alloc(walk->arena, sizeof(*row) + mib_value_size(var));
+    row->oid = arena_alloc(walk->arena, (prefix_len + sub_len) * sizeof(oid_t));
+    row->id_len = prefix_len + sub_len;
+    oid_cpy(row->oid, ret_oid->oid, prefix_len);
+    for (j = 0; j < sub_len; j++) {
+      lua_rawgeti(L, -1, j + 1);
+      row->oid[prefix_len + j] = lua_tointeger(L, -1);
+      lua_pop(L, 1);
     }
+    lua_pop(L, 1);
+
+    row->tag = tag(var);
+    row->len = length(var);
+    memcpy(row->value, value(var), mib_value_size(var));
+    walk->rows[walk->cnt++] = row;
+  }
+
+  /* Fewer rows than asked without error means the group is exhausted */
+  if (walk->cnt < n) {
+    walk->err_stat = 0;
+    walk->end = 1;
+  } else {
+    walk->end = !walk->err_stat && walk->cnt < count;
+  }
+}
+
+/* GETNEXT search served from the rows of bulk walk, Lua is called again
+ * only when the rows run out or the search does not follow them. */
+static int
+mib_walk_search(struct oid_search_res *ret_oid)
+{
+  uint32_t id_len, prefix_len;
+  struct mib_walk *walk = ret_oid->walk;
+  struct mib_walk_row *row;
+  Variable *var = &ret_oid->var;
+
+  id_len = ret_oid->inst_id - ret_oid->oid + ret_oid->inst_id_len;
+  prefix_len = ret_oid->inst_id - ret_oid->oid;
+
+  row = walk->pos > 0 ? walk->rows[walk->pos - 1] : NULL;
+  if (walk->callback != ret_oid->callback || row == NULL ||
+      oid_cmp(row->oid, row->id_len, ret_oid->oid, id_len) ||
+      (walk->pos == walk->cnt && !walk->end)) {
+    mib_walk_fetch(ret_oid);
+  }
+
+  if (walk->pos < walk->cnt) {
+    row = walk->rows[walk->pos++];
+    ret_oid->inst_id_len = row->id_len - prefix_len;
+    oid_cpy(ret_oid->inst_id, row->oid + prefix_len, ret_oid->inst_id_len);
+    tag(var) = row->tag;
+    length(var) = row->len;
+    mib_value_ref(var, row->value);
+    ret_oid->err_stat = 0;
+  } else if (walk->end) {
+    /* No more instances in this group */
+    tag(var) = ASN1_TAG_NO_SUCH_OBJ;
+    ret_oid->err_stat = 0;
+  } else {
+    /* Instance failed in the walk, let single search report the error */
+    walk->callback = 0;
+    return mib_instance_search(ret_oid);
   }
 
   return ret_oid->err_stat;
 }
 
+/* Words taken by node in frozen tree */
+static inline uint32_t
+frozen_node_size(const struct mib_node *node)
+{
+  const struct mib_group_node *gn;
+  const struct mib_instance_node *in;
+
+  if (node->type == MIB_OBJ_INSTANCE) {
+    in = (const struct mib_instance_node *)node;
+    return (sizeof(struct mib_frozen_instance) + in->ber_len + sizeof(uint32_t) - 1) / sizeof(uint32_t);
+  }
+
+  gn = (const struct mib_group_node *)node;
+  return (sizeof(struct mib_frozen_group) + (gn->prefix_len + 2 * gn->sub_id_cnt) * sizeof(oid_t)) / sizeof(uint32_t);
+}
+
+/* Node queued for breadth first copy */
+struct frozen_entry {
+  struct mib_node *node;
+  /* Offset of the node in frozen tree */
+  uint32_t offset;
+  /* Queue index of the first sub-node */
+  uint32_t first;
+};
+
+/* Copy mib-tree into a new frozen tree */
+static uint32_t *
+mib_tree_freeze(void)
+{
+  struct frozen_entry *queue, *e;
+  struct mib_group_node *gn;
+  struct mib_frozen_group *fg;
+  struct mib_instance_node *in;
+  struct mib_frozen_instance *fi;
+  uint32_t *frozen;
+  uint32_t head, tail, cap, size;
+  int i;
+
+  cap = 64;
+  queue = xmalloc(cap * sizeof(*queue));
+  queue[0].node = (struct mib_node *)&mib_dummy_node;
+  tail = 1;
+  size = 0;
+
+  /* Place nodes breadth first */
+  for (head = 0; head < tail; head++) {
+    e = &queue[head];
+    e->offset = size;
+    size += frozen_node_size(e->node);
+    if (e->node->type == MIB_OBJ_GROUP) {
+      gn = (struct mib_group_node *)e->node;
+      assert(gn->prefix_len <= UINT8_MAX);
+      e->first = tail;
+      if (tail + gn->sub_id_cnt > cap) {
+        while (tail + gn->sub_id_cnt > cap) {
+          cap = alloc_nr(cap);
+        }
+        queue = xrealloc(queue, cap * sizeof(*queue));
+      }
+      for (i = 0; i < gn->sub_id_cnt; i++) {
+        queue[tail++].node = gn->sub_ptr[i];
+      }
+    }
+  }
+
+  /* Fill nodes with sub-node pointers turned into offsets */
+  frozen = xmalloc(size * sizeof(uint32_t));
+  for (head = 0; head < tail; head++) {
+    e = &queue[head];
+    if (e->node->type == MIB_OBJ_INSTANCE) {
+      in = (struct mib_instance_node *)e->node;
+      fi = (struct mib_frozen_instance *)(frozen + e->offset);
+      fi->type = MIB_OBJ_INSTANCE;
+      fi->bulk = in->bulk;
+      fi->ber_len = in->ber_len;
+      fi->callback = in->callback;
+      memcpy(fi->ber, in->ber, in->ber_len);
+      continue;
+    }
+    gn = (struct mib_group_node *)e->node;
+    fg = (struct mib_frozen_group *)(frozen + e->offset);
+    fg->type = MIB_OBJ_GROUP;
+    fg->prefix_len = gn->prefix_len;
+    fg->sub_id_cnt = gn->sub_id_cnt;
+    oid_cpy(fg->arcs, gn->prefix, gn->prefix_len);
+    oid_cpy(fg->arcs + gn->prefix_len, gn->sub_id, gn->sub_id_cnt);
+    for (i = 0; i < gn->sub_id_cnt; i++) {
+      fg->arcs[gn->prefix_len + gn->sub_id_cnt + i] = queue[e->first + i].offset;
+    }
+  }
+
+  free(queue);
+  return frozen;
+}
+
+/* Root node of frozen tree, rebuilt once mib-tree changes. Nodes of the
+ * old copy stay valid until then for the search in progress, e.g. when its
+ * handler registers nodes, but no cursor may keep them. */
+static struct mib_node *
+mib_frozen_root(void)
+{
+  if (mib_frozen_dirty) {
+    uint32_t *frozen = mib_tree_freeze();
+    /* Swap in the complete copy */
+    free(mib_frozen);
+    mib_frozen = frozen;
+    mib_frozen_dirty = 0;
+    mib_cursor_flush();
+  }
+  return (struct mib_node *)mib_frozen;
+}
+
 /* GET request search, depth-first traversal in mib-tree, oid must match */
 struct mib_node *
 mib_tree_search(struct mib_view *view, const oid_t *orig_oid, uint32_t orig_id_len, struct oid_search_res *ret_oid)
@@ -248,15 +584,17 @@ mib_tree_search(struct mib_view *view, const oid_t *orig_oid, uint32_t orig_id_l
   oid_t *oid;
   uint32_t id_len;
   struct mib_node *node;
-  struct mib_group_node *gn;
-  struct mib_instance_node *in;
+  const struct mib_frozen_group *fg;
+  struct mib_frozen_instance *in;
 
   assert(view != NULL && orig_oid != NULL && ret_oid != NULL);
 
-  /* Duplicate OID as return value */
-  ret_oid->oid = oid_dup(orig_oid, orig_id_len);
+  /* Copy OID as return value */
+  oid_cpy(ret_oid->oid, orig_oid, orig_id_len);
   ret_oid->id_len = orig_id_len;
   ret_oid->err_stat = 0;
+  ret_oid->ber_prefix = NULL;
+  ret_oid->ber_prefix_len = 0;
 
   /* Access control */
   if (oid_cover(view->oid, view->id_len, orig_oid, orig_id_len) <= 0) {
@@ -266,20 +604,33 @@ mib_tree_search(struct mib_view *view, const oid_t *orig_oid, uint32_t orig_id_l
   }
 
   /* Init something */
-  node = (struct mib_node *)&mib_dummy_node;
+  node = mib_frozen_root();
   oid = ret_oid->oid;
   id_len = ret_oid->id_len;
 
   while (node != NULL && id_len > 0) {
     switch (node->type) {
     case MIB_OBJ_GROUP:
-      gn = (struct mib_group_node *)node;
-      int i = oid_binary_search(gn->sub_id, gn->sub_id_cnt, *oid);
+      fg = (const struct mib_frozen_group *)node;
+      if (fg->prefix_len > 0) {
+        uint32_t k = prefix_match(frozen_prefix(fg), fg->prefix_len, oid, id_len);
+        if (k < fg->prefix_len || k == id_len) {
+          /* Oid diverges from or ends in the collapsed chain,
+           * locate at the head of chain */
+          ret_oid->inst_id = oid;
+          ret_oid->inst_id_len = id_len;
+          tag(&ret_oid->var) = ASN1_TAG_NO_SUCH_OBJ;
+          return node;
+        }
+        oid += k;
+        id_len -= k;
+      }
+      int i = oid_binary_search(frozen_sub_id(fg), fg->sub_id_cnt, *oid);
       if (i >= 0) {
         /* Sub-id found, go on loop */
         oid++;
         id_len--;
-        node = gn->sub_ptr[i];
+        node = frozen_sub_node(fg, i);
         continue;
       } else {
         /* Sub-id not found */
@@ -290,11 +641,13 @@ mib_tree_search(struct mib_view *view, const oid_t *orig_oid, uint32_t orig_id_l
       }
 
     case MIB_OBJ_INSTANCE:
-      in = (struct mib_instance_node *)node;
+      in = (struct mib_frozen_instance *)node;
       /* Find instance variable through lua handler function */
       ret_oid->inst_id = oid;
       ret_oid->inst_id_len = id_len;
       ret_oid->callback = in->callback;
+      ret_oid->ber_prefix = in->ber;
+      ret_oid->ber_prefix_len = in->ber_len;
       ret_oid->err_stat = mib_instance_search(ret_oid);
       return node;
 
@@ -319,8 +672,78 @@ struct node_backlog {
   struct mib_node *node;
   /* next sub-id index of the node */
   int n_idx;
+  /* position of the sub-id in oid */
+  int pos;
+};
+
+/* Number of cursors, must be power of 2 */
+#define MIB_CURSOR_MAX    64
+/* Deepest traversal stack kept in cursor */
+#define MIB_CURSOR_DEPTH  32
+
+/* Traversal state where GETNEXT returned an oid. Managers ask for the next
+ * oid of the one just returned, so the search resumes from here instead of
+ * descending from the root of view again. */
+struct mib_cursor {
+  uint32_t generation;
+  const struct mib_view *view;
+  /* Returned oid */
+  oid_t oid[ASN1_OID_MAX_LEN];
+  uint32_t id_len;
+  /* Instance node which returned the oid and length of its oid */
+  struct mib_frozen_instance *in;
+  uint32_t prefix_len;
+  /* Backlog from the root of view to the instance node */
+  int depth;
+  struct node_backlog stack[MIB_CURSOR_DEPTH];
 };
 
+static struct mib_cursor mib_cursors[MIB_CURSOR_MAX];
+static inline struct mib_cursor *
+mib_cursor_slot(const struct mib_view *view, const oid_t *oid, uint32_t id_len)
+{
+  uint32_t h = oid_hash(oid, id_len) ^ (uint32_t)(uintptr_t)view;
+  return &mib_cursors[h & (MIB_CURSOR_MAX - 1)];
+}
+
+static struct mib_cursor *
+mib_cursor_find(const struct mib_view *view, const oid_t *oid, uint32_t id_len)
+{
+  struct mib_cursor *cur = mib_cursor_slot(view, oid, id_len);
+
+  /* Nodes of cursors are freed with the stale frozen copy */
+  if (!mib_frozen_dirty && cur->generation == mib_cursor_generation && cur->view == view &&
+      !oid_cmp(cur->oid, cur->id_len, oid, id_len)) {
+    mib_cache_stats.cursor_hits++;
+    return cur;
+  }
+
+  mib_cache_stats.cursor_misses++;
+  return NULL;
+}
+
+static void
+mib_cursor_save(const struct mib_view *view, const struct oid_search_res *ret_oid, struct mib_frozen_instance *in,
+                const struct node_backlog *stack, int depth)
+{
+  struct mib_cursor *cur;
+
+  /* Mib-tree changed during the search, its nodes are about to be freed */
+  if (depth > MIB_CURSOR_DEPTH || mib_frozen_dirty) {
+    return;
+  }
+
+  cur = mib_cursor_slot(view, ret_oid->oid, ret_oid->id_len);
+  cur->generation = mib_cursor_generation;
+  cur->view = view;
+  oid_cpy(cur->oid, ret_oid->oid, ret_oid->id_len);
+  cur->id_len = ret_oid->id_len;
+  cur->in = in;
+  cur->prefix_len = ret_oid->inst_id - ret_oid->oid;
+  cur->depth = depth;
+  memcpy(cur->stack, stack, depth * sizeof(*stack));
+}
+
 /* GETNEXT request search, depth-first traversal in mib-tree, find the closest next oid. */
 void
 mib_tree_search_next(struct mib_view *view, const oid_t *orig_oid, uint32_t orig_id_len, struct oid_search_res *ret_oid)
@@ -331,8 +754,9 @@ mib_tree_search_next(struct mib_view *view, const oid_t *orig_oid, uint32_t orig
   struct node_backlog nbl_stack[ASN1_OID_MAX_LEN];
   struct node_backlog *top;
   struct mib_node *node;
-  struct mib_group_node *gn;
-  struct mib_instance_node *in;
+  const struct mib_frozen_group *fg;
+  struct mib_frozen_instance *in;
+  struct mib_cursor *cur;
   /* 'immediate' is the search state indicator.
    * 0 is to get the matched instance according to the given oid;
    * 1 is to get the immediate first instance regardless of the given oid. */
@@ -340,9 +764,15 @@ mib_tree_search_next(struct mib_view *view, const oid_t *orig_oid, uint32_t orig
 
   assert(view != NULL && orig_oid != NULL && ret_oid != NULL);
 
-  /* Access control */
-  if (oid_cover(view->oid, view->id_len, orig_oid, orig_id_len) > 0) {
-    /* In the range of view, search the root node at view oid */
+  /* Given oid returned by an earlier search is resumed at its instance node */
+  cur = mib_cursor_find(view, orig_oid, orig_id_len);
+  if (cur != NULL) {
+    node = (struct mib_node *)cur->in;
+    oid_cpy(ret_oid->oid, orig_oid, orig_id_len);
+    ret_oid->id_len = orig_id_len;
+    ret_oid->inst_id = ret_oid->oid + cur->prefix_len;
+  } else if (oid_cover(view->oid, view->id_len, orig_oid, orig_id_len) > 0) {
+    /* Access control, in the range of view, search the root node at view oid */
     ret_oid->request = SNMP_REQ_GET;
     node = mib_tree_search(view, view->oid, view->id_len, ret_oid);
     assert(node != NULL);
@@ -366,7 +796,7 @@ mib_tree_search_next(struct mib_view *view, const oid_t *orig_oid, uint32_t orig
     } else {
       /* END_OF_MIB_VIEW */
       node = NULL;
-      ret_oid->oid = oid_dup(view->oid, view->id_len);
+      oid_cpy(ret_oid->oid, view->oid, view->id_len);
       ret_oid->id_len = view->id_len;
     }
   }
@@ -374,6 +804,10 @@ mib_tree_search_next(struct mib_view *view, const oid_t *orig_oid, uint32_t orig
   /* Init something */
   p_nbl = NULL;
   top = nbl_stack;
+  if (cur != NULL) {
+    memcpy(nbl_stack, cur->stack, cur->depth * sizeof(*top));
+    top += cur->depth;
+  }
   ret_oid->err_stat = 0;
   oid = ret_oid->inst_id;
   id_len = ret_oid->id_len - (oid - ret_oid->oid);
@@ -383,7 +817,24 @@ mib_tree_search_next(struct mib_view *view, const oid_t *orig_oid, uint32_t orig
     if (node != NULL) {
       switch (node->type) {
       case MIB_OBJ_GROUP:
-        gn = (struct mib_group_node *)node;
+        fg = (const struct mib_frozen_group *)node;
+        if (p_nbl == NULL && fg->prefix_len > 0) {
+          /* Entering the node, walk through its collapsed chain first */
+          if (!immediate) {
+            uint32_t k = prefix_match(frozen_prefix(fg), fg->prefix_len, oid, id_len);
+            if (k < fg->prefix_len && k < id_len && oid[k] > frozen_prefix(fg)[k]) {
+              /* The whole chain is less than the target, backtrack */
+              break;
+            } else if (k < fg->prefix_len || k == id_len) {
+              /* The whole chain is greater than or covered by the target */
+              immediate = 1;
+            } else {
+              id_len -= k;
+            }
+          }
+          oid_cpy(oid, frozen_prefix(fg), fg->prefix_len);
+          oid += fg->prefix_len;
+        }
         if (immediate) {
           /* Fetch the immediate instance node. */
           /* Fetch the sub-id of the backlogged node. */
@@ -391,54 +842,58 @@ mib_tree_search_next(struct mib_view *view, const oid_t *orig_oid, uint32_t orig
           /* n_idx is not reusable */
           p_nbl = NULL;
 
+          if (fg->sub_id_cnt == 0) {
+            /* No sub-id in this group node, backtrack */
+            break;
+          }
+
           /* Backlog the current node and move on. */
-          if (i + 1 >= gn->sub_id_cnt) {
+          if (i + 1 >= fg->sub_id_cnt) {
             top->node = NULL;
             top->n_idx = 0;
           } else {
             top->node = node;
             top->n_idx = i + 1;
           }
+          top->pos = oid - ret_oid->oid;
           top++;
-          *oid++ = gn->sub_id[i];
-          node = gn->sub_ptr[i];
+          *oid++ = frozen_sub_id(fg)[i];
+          node = frozen_sub_node(fg, i);
         } else {
           /* Search the match sub-id */
-          int index = oid_binary_search(gn->sub_id, gn->sub_id_cnt, *oid);
+          int index = oid_binary_search(frozen_sub_id(fg), fg->sub_id_cnt, *oid);
           int i = index;
           if (index < 0) {
             /* Not found, switch to the immediate search mode */
             immediate = 1;
             /* Reverse the sign to locate the right position. */
             i = -i - 1;
-            if (i == gn->sub_id_cnt) {
-              /* All sub-ids are greater than the target;
-               * Backtrack and fetch the next one. */
-              break;
-            } else if (i == 0) {
+            if (i == fg->sub_id_cnt) {
               /* 1. All sub-ids are less than the target;
                * 2. No sub-id in this group node;
-               * Just switch to the immediate search mode */
-              continue;
+               * Backtrack and fetch the next one. */
+              break;
             } /* else {
-                 Target is between the two sub-ids and [i] is the next one,
-                 switch to immediate mode and move on.
+                 Target is ahead of or between the sub-ids and [i] is the
+                 next one, switch to immediate mode and move on. The chain
+                 of this node is in oid already, so do not enter it again.
             } */
           }
 
           /* Sub-id found is greater or just equal to the target,
            * Anyway, record the next node and push it into stack. */
-          if (i + 1 >= gn->sub_id_cnt) {
+          if (i + 1 >= fg->sub_id_cnt) {
             top->node = NULL;
             top->n_idx = 0;
           } else {
             top->node = node;
             top->n_idx = i + 1;
           }
+          top->pos = oid - ret_oid->oid;
           top++;
 
-          *oid++ = gn->sub_id[i];
-          node = gn->sub_ptr[i];
+          *oid++ = frozen_sub_id(fg)[i];
+          node = frozen_sub_node(fg, i);
           if (--id_len == 0 && node->type == MIB_OBJ_GROUP) {
             /* When oid length is decreased to zero, switch to the immediate mode */
             immediate = 1;
@@ -448,14 +903,20 @@ mib_tree_search_next(struct mib_view *view, const oid_t *orig_oid, uint32_t orig
         continue; /* Go on loop */
 
       case MIB_OBJ_INSTANCE:
-        in = (struct mib_instance_node *)node;
+        in = (struct mib_frozen_instance *)node;
         /* Fetch the first instance variable or 
          * search the closest instance whose oid is greater than the target */
         ret_oid->inst_id_len = immediate || id_len == 0 ? 0 : id_len;
         /* Find instance variable through lua handler function */
         ret_oid->inst_id = oid;
         ret_oid->callback = in->callback;
-        ret_oid->err_stat = mib_instance_search(ret_oid);
+        ret_oid->ber_prefix = in->ber;
+        ret_oid->ber_prefix_len = in->ber_len;
+        if (in->bulk && ret_oid->walk != NULL) {
+          ret_oid->err_stat = mib_walk_search(ret_oid);
+        } else {
+          ret_oid->err_stat = mib_instance_search(ret_oid);
+        }
         if (ASN1_TAG_VALID(tag(&ret_oid->var))) {
           ret_oid->id_len = oid - ret_oid->oid + ret_oid->inst_id_len;
           assert(ret_oid->id_len <= ASN1_OID_MAX_LEN);
@@ -463,6 +924,7 @@ mib_tree_search_next(struct mib_view *view, const oid_t *orig_oid, uint32_t orig
             /* End of mib view */
             break;
           }
+          mib_cursor_save(view, ret_oid, in, nbl_stack, top - nbl_stack);
           return;
         } else {
           /* Instance not found */
@@ -487,11 +949,13 @@ mib_tree_search_next(struct mib_view *view, const oid_t *orig_oid, uint32_t orig
       ret_oid->inst_id = NULL;
       ret_oid->inst_id_len = 0;
       ret_oid->err_stat = 0;
+      ret_oid->ber_prefix = NULL;
+      ret_oid->ber_prefix_len = 0;
       tag(&ret_oid->var) = ASN1_TAG_END_OF_MIB_VIEW;
       return;
     }
     /* OID length is ignored once backtracking. */
-    oid--;
+    oid = ret_oid->oid + p_nbl->pos;
     node = p_nbl->node;
     /* Switch to the immediate search mode. */
     immediate = 1;
@@ -570,25 +1034,100 @@ group_node_shrink(struct mib_group_node *gn, int index)
     gn->sub_id[0] = 0;
     gn->sub_ptr[0] = NULL;
     gn->sub_id_cnt = 0;
+    /* Raw group has no chain */
+    free(gn->prefix);
+    gn->prefix = NULL;
+    gn->prefix_len = 0;
   }
 }
 
+/* Allocate group node collapsing the chain of arcs given */
 static struct mib_group_node *
-mib_group_node_new(void)
+mib_group_node_new(const oid_t *prefix, uint32_t prefix_len)
 {
   struct mib_group_node *gn = xmalloc(sizeof(*gn));
   gn->type = MIB_OBJ_GROUP;
   gn->sub_id_cap = 1;
   gn->sub_id_cnt = 0;
+  gn->prefix_len = prefix_len;
+  gn->prefix = prefix_len > 0 ? oid_dup(prefix, prefix_len) : NULL;
   gn->sub_id = xcalloc(1, sizeof(oid_t));
   gn->sub_ptr = xcalloc(1, sizeof(void *));
   return gn;
 }
 
+/* Split the chain of group node at arc k, the arcs behind go to a new
+ * sub-node which takes over all sub-nodes. */
+static void
+group_node_split(struct mib_group_node *gn, uint32_t k)
+{
+  struct mib_group_node *tail;
+  oid_t *sub_id;
+  void **sub_ptr;
+
+  assert(k < gn->prefix_len);
+
+  tail = mib_group_node_new(gn->prefix + k + 1, gn->prefix_len - k - 1);
+  sub_id = tail->sub_id;
+  sub_ptr = tail->sub_ptr;
+  tail->sub_id_cap = gn->sub_id_cap;
+  tail->sub_id_cnt = gn->sub_id_cnt;
+  tail->sub_id = gn->sub_id;
+  tail->sub_ptr = gn->sub_ptr;
+
+  gn->sub_id_cap = 1;
+  gn->sub_id_cnt = 1;
+  gn->sub_id = sub_id;
+  gn->sub_ptr = sub_ptr;
+  gn->sub_id[0] = gn->prefix[k];
+  gn->sub_ptr[0] = tail;
+  gn->prefix_len = k;
+  if (k == 0) {
+    free(gn->prefix);
+    gn->prefix = NULL;
+  }
+}
+
+/* Collapse the only group sub-node into group node, root node excluded. */
+static void
+group_node_merge(struct mib_group_node *gn)
+{
+  struct mib_group_node *sub;
+  oid_t *prefix;
+
+  if (gn == &mib_dummy_node || gn->sub_id_cnt != 1) {
+    return;
+  }
+
+  sub = gn->sub_ptr[0];
+  if (sub->type != MIB_OBJ_GROUP || sub->sub_id_cnt == 0) {
+    return;
+  }
+
+  prefix = xmalloc((gn->prefix_len + 1 + sub->prefix_len) * sizeof(oid_t));
+  oid_cpy(prefix, gn->prefix, gn->prefix_len);
+  prefix[gn->prefix_len] = gn->sub_id[0];
+  oid_cpy(prefix + gn->prefix_len + 1, sub->prefix, sub->prefix_len);
+  free(gn->prefix);
+  gn->prefix = prefix;
+  gn->prefix_len += 1 + sub->prefix_len;
+
+  free(gn->sub_id);
+  free(gn->sub_ptr);
+  gn->sub_id_cap = sub->sub_id_cap;
+  gn->sub_id_cnt = sub->sub_id_cnt;
+  gn->sub_id = sub->sub_id;
+  gn->sub_ptr = sub->sub_ptr;
+
+  free(sub->prefix);
+  free(sub);
+}
+
 static void
 mib_group_node_delete(struct mib_group_node *gn)
 {
   if (gn != NULL) {
+    free(gn->prefix);
     free(gn->sub_id);
     free(gn->sub_ptr);
     free(gn);
@@ -596,10 +1135,13 @@ mib_group_node_delete(struct mib_group_node *gn)
 }
 
 static struct mib_instance_node *
-mib_instance_node_new(int callback)
+mib_instance_node_new(int callback, int bulk)
 {
   struct mib_instance_node *in = xmalloc(sizeof(*in));
   in->type = MIB_OBJ_INSTANCE;
+  in->bulk = bulk;
+  in->ber_len = 0;
+  in->ber = NULL;
   in->callback = callback;
   return in;
 }
@@ -611,6 +1153,7 @@ mib_instance_node_delete(struct mib_instance_node *in)
     /* Unrefer mib search handler */
     lua_State *L = mib_lua_state;
     luaL_unref(L, LUA_ENVIRONINDEX, in->callback);
+    free(in->ber);
     free(in);
   }
 }
@@ -635,6 +1178,24 @@ mib_tree_node_search(const oid_t *oid, uint32_t id_len, struct node_pair *pair)
     switch (node->type) {
     case MIB_OBJ_GROUP:
       gn = (struct mib_group_node *)node;
+      if (gn->prefix_len > 0) {
+        uint32_t k = prefix_match(gn->prefix, gn->prefix_len, oid, id_len);
+        if (k == id_len) {
+          /* Oid ends in the collapsed chain which goes as a whole */
+          pair->parent = parent;
+          pair->child = node;
+          pair->sub_idx = sub_idx;
+          return node;
+        } else if (k < gn->prefix_len) {
+          /* Oid diverges from the collapsed chain */
+          pair->parent = parent;
+          pair->child = node;
+          pair->sub_idx = sub_idx;
+          return NULL;
+        }
+        oid += k;
+        id_len -= k;
+      }
       int i = oid_binary_search(gn->sub_id, gn->sub_id_cnt, *oid);
       if (i >= 0) {
         /* Sub-id found, go on loop */
@@ -733,6 +1294,7 @@ __mib_tree_delete(struct node_pair *pair)
     if (p_nbl == NULL) {
       /* End of traversal. */
       group_node_shrink((struct mib_group_node *)pair->parent, pair->sub_idx);
+      group_node_merge((struct mib_group_node *)pair->parent);
       return;
     }
     node = p_nbl->node;
@@ -756,7 +1318,7 @@ mib_tree_delete(const oid_t *oid, uint32_t id_len)
  * the last id number must be the not existing instance node.
  */
 static struct mib_instance_node *
-mib_tree_instance_insert(const oid_t *oid, uint32_t id_len, int callback)
+mib_tree_instance_insert(const oid_t *oid, uint32_t id_len, int callback, int bulk)
 {
   struct mib_node *node = (struct mib_node *)&mib_dummy_node;
   struct mib_group_node *gn;
@@ -766,16 +1328,29 @@ mib_tree_instance_insert(const oid_t *oid, uint32_t id_len, int callback)
     case MIB_OBJ_GROUP:
       gn = (struct mib_group_node *)node;
 
+      if (gn->prefix_len > 0) {
+        uint32_t k = prefix_match(gn->prefix, gn->prefix_len, oid, id_len);
+        if (k == id_len) {
+          /* Oid ends in the collapsed chain */
+          return NULL;
+        } else if (k < gn->prefix_len) {
+          /* Oid diverges from the collapsed chain, split it there */
+          group_node_split(gn, k);
+        }
+        oid += k;
+        id_len -= k;
+      }
+
       if (is_raw_group(gn)) {
         gn->sub_id_cnt++;
         gn->sub_id[0] = *oid++;
         if (--id_len == 0) {
           /* Allocate new instance node */
-          node = gn->sub_ptr[0] = mib_instance_node_new(callback);
+          node = gn->sub_ptr[0] = mib_instance_node_new(callback, bulk);
           return (struct mib_instance_node *)node;
         } else {
-          /* Allocate new group node */
-          node = gn->sub_ptr[0] = mib_group_node_new();
+          /* Allocate new group node collapsing the rest arcs but the last */
+          node = gn->sub_ptr[0] = mib_group_node_new(oid, id_len - 1);
         }
       } else {
         /* Search in exist sub-ids */
@@ -794,11 +1369,11 @@ mib_tree_instance_insert(const oid_t *oid, uint32_t id_len, int callback)
           gn->sub_id[i] = *oid++;
           if (--id_len == 0) {
             /* Allocate new instance node */
-            node = gn->sub_ptr[i] = mib_instance_node_new(callback);
+            node = gn->sub_ptr[i] = mib_instance_node_new(callback, bulk);
             return (struct mib_instance_node *)node;
           } else {
-            /* Allocate new group node */
-            node = gn->sub_ptr[i] = mib_group_node_new();
+            /* Allocate new group node collapsing the rest arcs but the last */
+            node = gn->sub_ptr[i] = mib_group_node_new(oid, id_len - 1);
           }
         }
       }
@@ -819,7 +1394,7 @@ mib_tree_instance_insert(const oid_t *oid, uint32_t id_len, int callback)
 
 /* Register one instance node in mib-tree according to given oid with lua callback. */
 int
-mib_node_reg(const oid_t *oid, uint32_t len, int callback)
+mib_node_reg(const oid_t *oid, uint32_t len, int callback, int bulk)
 {
   int i;
   struct mib_instance_node *in;
@@ -839,7 +1414,10 @@ mib_node_reg(const oid_t *oid, uint32_t len, int callback)
     return -1;
   }
 
-  in = mib_tree_instance_insert(oid, len, callback);
+  mib_cache_flush();
+  mib_cursor_flush();
+  mib_frozen_dirty = 1;
+  in = mib_tree_instance_insert(oid, len, callback, bulk);
   if (in == NULL) {
     SMARTSNMP_LOG(L_WARNING, "Register group node oid: ");
     for (i = 0; i < len; i++) {
@@ -849,6 +1427,15 @@ mib_node_reg(const oid_t *oid, uint32_t len, int callback)
     return -1;
   }
 
+  /* Responses copy the encoded oid of the node ahead of instance arcs,
+   * the first two arcs share one byte so shorter oid is not worth it. */
+  if (len >= 2) {
+    uint8_t ber[ASN1_OID_MAX_LEN * 5];
+    in->ber_len = ber_value_enc(oid, len, ASN1_TAG_OBJID, ber);
+    in->ber = xmalloc(in->ber_len);
+    memcpy(in->ber, ber, in->ber_len);
+  }
+
   return 0;
 }
 
@@ -858,6 +1445,9 @@ mib_node_unreg(const oid_t *oid, uint32_t len)
 {
   assert(oid != NULL);
   mib_tree_init_check();
+  mib_cache_flush();
+  mib_cursor_flush();
+  mib_frozen_dirty = 1;
   mib_tree_delete(oid, len);
 }
 
@@ -878,5 +1468,6 @@ void
 mib_init(lua_State *L)
 {
   mib_lua_state = L;
+  mib_search_init();
   mib_dummy_node_init();
 }
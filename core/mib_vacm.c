@@ -0,0 +1,341 @@
+/*
+ * This file is part of SmithSNMP
+ * Copyright (C) 2014, Credo Semiconductor Inc.
+ * Copyright (C) 2015, Leo Ma <begeekmyfriend@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mib.h"
+
+/*
+ * View-based access control, RFC 3415. A named view is a set of families,
+ * each one a subtree with a mask of arcs which must match, included in or
+ * excluded from the view. Principals of a security model are mapped into
+ * groups, and groups are given read and write views by security level.
+ *
+ * Each view is compiled into a view set whose views are the included
+ * subtrees cut at the first wildcard arc. The tree search runs inside them
+ * as it does for plain views, and families are only checked for oids found
+ * when they exclude or mask anything.
+ */
+
+struct vacm_view {
+  struct vacm_view *next;
+  char *name;
+  struct mib_vacm_family *families;
+  uint32_t cnt;
+  struct mib_view_set set;
+};
+
+/* Access entry of group */
+struct vacm_access {
+  struct vacm_access *next;
+  uint8_t model;
+  uint8_t level;
+  char *read;
+  char *write;
+};
+
+struct vacm_group {
+  struct vacm_group *next;
+  char *name;
+  struct vacm_access *access;
+  /* Compiled views by security model and level, NULL for no access */
+  const struct mib_view_set *read[MIB_VACM_MODEL_MAX][MIB_VACM_LEVEL_MAX];
+  const struct mib_view_set *write[MIB_VACM_MODEL_MAX][MIB_VACM_LEVEL_MAX];
+};
+
+/* Principal of security model in group */
+struct vacm_member {
+  struct mib_hash_node hnode;
+  uint8_t model;
+  char *name;
+  struct vacm_group *group;
+};
+
+static struct vacm_view *vacm_views;
+static struct vacm_group *vacm_groups;
+static struct mib_hash vacm_members;
+/* Views and groups changed since last compiling */
+static int vacm_dirty;
+
+static char *
+vacm_strdup(const char *str)
+{
+  char *s = xmalloc(strlen(str) + 1);
+  return strcpy(s, str);
+}
+
+static struct vacm_view *
+vacm_view_find(const char *name)
+{
+  struct vacm_view *v;
+
+  for (v = vacm_views; v != NULL; v = v->next) {
+    if (!strcmp(v->name, name)) {
+      return v;
+    }
+  }
+  return NULL;
+}
+
+static struct vacm_group *
+vacm_group_find(const char *name, int create)
+{
+  struct vacm_group *g;
+
+  for (g = vacm_groups; g != NULL; g = g->next) {
+    if (!strcmp(g->name, name)) {
+      return g;
+    }
+  }
+
+  if (create) {
+    g = xcalloc(1, sizeof(*g));
+    g->name = vacm_strdup(name);
+    g->next = vacm_groups;
+    vacm_groups = g;
+  }
+  return g;
+}
+
+static struct vacm_member *
+vacm_member_find(uint8_t model, const char *name, uint32_t hash)
+{
+  struct mib_hash_node *n;
+
+  for (n = mib_hash_first(&vacm_members, hash); n != NULL; n = n->next) {
+    struct vacm_member *m = container_of(n, struct vacm_member, hnode);
+    if (n->hash == hash && m->model == model && !strcmp(m->name, name)) {
+      return m;
+    }
+  }
+  return NULL;
+}
+
+/* Add family of subtree to view, replacing the one of the same subtree.
+ * Return -1 if the mask is too long. */
+int
+mib_vacm_view_add(const char *view, const oid_t *subtree, uint32_t len, const uint8_t *mask, uint32_t mask_len, int included)
+{
+  struct vacm_view *v;
+  struct mib_vacm_family *f = NULL;
+  uint32_t i;
+
+  if (mask_len > MIB_VACM_MASK_LEN) {
+    return -1;
+  }
+
+  v = vacm_view_find(view);
+  if (v == NULL) {
+    v = xcalloc(1, sizeof(*v));
+    v->name = vacm_strdup(view);
+    v->next = vacm_views;
+    vacm_views = v;
+  }
+
+  for (i = 0; i < v->cnt; i++) {
+    if (!oid_cmp(v->families[i].subtree, v->families[i].len, subtree, len)) {
+      f = &v->families[i];
+      break;
+    }
+  }
+  if (f == NULL) {
+    v->families = xrealloc(v->families, (v->cnt + 1) * sizeof(*v->families));
+    f = &v->families[v->cnt++];
+    f->subtree = oid_dup(subtree, len);
+    f->len = len;
+  }
+
+  /* Missing mask bits are set */
+  memset(f->mask, 0xff, sizeof(f->mask));
+  memcpy(f->mask, mask, mask_len);
+  f->included = !!included;
+
+  vacm_dirty = 1;
+  return 0;
+}
+
+/* Map principal of security model into group */
+void
+mib_vacm_group_add(const char *group, uint8_t model, const char *name)
+{
+  struct vacm_member *m;
+  uint32_t hash = mib_str_hash(name);
+
+  m = vacm_member_find(model, name, hash);
+  if (m == NULL) {
+    m = xmalloc(sizeof(*m));
+    m->model = model;
+    m->name = vacm_strdup(name);
+    mib_hash_add(&vacm_members, &m->hnode, hash);
+  }
+  m->group = vacm_group_find(group, 1);
+}
+
+/* Give views to group for requests of security model (or any) at security
+ * level and above. Empty view names give no access. */
+void
+mib_vacm_access_add(const char *group, uint8_t model, uint8_t level, const char *read_view, const char *write_view)
+{
+  struct vacm_group *g = vacm_group_find(group, 1);
+  struct vacm_access *a;
+
+  for (a = g->access; a != NULL; a = a->next) {
+    if (a->model == model && a->level == level) {
+      free(a->read);
+      free(a->write);
+      break;
+    }
+  }
+  if (a == NULL) {
+    a = xmalloc(sizeof(*a));
+    a->model = model;
+    a->level = level;
+    a->next = g->access;
+    g->access = a;
+  }
+  a->read = vacm_strdup(read_view);
+  a->write = vacm_strdup(write_view);
+
+  vacm_dirty = 1;
+}
+
+/* Longer subtrees first, then lexicographically greater ones */
+static int
+vacm_family_cmp(const void *a, const void *b)
+{
+  const struct mib_vacm_family *f1 = a, *f2 = b;
+
+  if (f1->len != f2->len) {
+    return f1->len > f2->len ? -1 : 1;
+  }
+  return -oid_cmp(f1->subtree, f1->len, f2->subtree, f2->len);
+}
+
+static void
+vacm_view_compile(struct vacm_view *v)
+{
+  uint32_t i, k;
+  int exact = 1;
+
+  qsort(v->families, v->cnt, sizeof(*v->families), vacm_family_cmp);
+
+  mib_view_set_free(&v->set);
+  for (i = 0; i < v->cnt; i++) {
+    struct mib_vacm_family *f = &v->families[i];
+    if (!f->included) {
+      exact = 0;
+      continue;
+    }
+    /* Included oids are inside the subtree up to the first wildcard */
+    for (k = 0; k < f->len && mib_vacm_mask_bit(f, k); k++);
+    if (k < f->len) {
+      exact = 0;
+    }
+    mib_view_set_add(&v->set, f->subtree, k);
+  }
+
+  v->set.families = exact ? NULL : v->families;
+  v->set.family_cnt = exact ? 0 : v->cnt;
+}
+
+static const struct mib_view_set *
+vacm_view_set_of(const char *name)
+{
+  struct vacm_view *v;
+
+  if (*name == '\0' || (v = vacm_view_find(name)) == NULL) {
+    return NULL;
+  }
+  return &v->set;
+}
+
+/* Access entry for requests of model and level. Entries of the very model
+ * go before the ones of any, then higher levels before lower ones. */
+static const struct vacm_access *
+vacm_access_best(const struct vacm_group *g, uint8_t model, uint8_t level)
+{
+  const struct vacm_access *a, *best = NULL;
+
+  for (a = g->access; a != NULL; a = a->next) {
+    if ((a->model != model && a->model != MIB_VACM_MODEL_ANY) || a->level > level) {
+      continue;
+    }
+    if (best == NULL || (a->model == model && best->model != model)
+        || (a->model == best->model && a->level > best->level)) {
+      best = a;
+    }
+  }
+  return best;
+}
+
+static void
+vacm_compile(void)
+{
+  struct vacm_view *v;
+  struct vacm_group *g;
+  uint8_t model, level;
+
+  for (v = vacm_views; v != NULL; v = v->next) {
+    vacm_view_compile(v);
+  }
+
+  for (g = vacm_groups; g != NULL; g = g->next) {
+    for (model = MIB_VACM_MODEL_V1; model < MIB_VACM_MODEL_MAX; model++) {
+      for (level = MIB_VACM_NOAUTH; level < MIB_VACM_LEVEL_MAX; level++) {
+        const struct vacm_access *a = vacm_access_best(g, model, level);
+        g->read[model][level] = a != NULL ? vacm_view_set_of(a->read) : NULL;
+        g->write[model][level] = a != NULL ? vacm_view_set_of(a->write) : NULL;
+      }
+    }
+  }
+
+  vacm_dirty = 0;
+}
+
+/* Look up the views of principal of model by name and its hash. Return 0
+ * if it is in no group, otherwise set is given the views for requests of
+ * security level, NULL if there is no access. */
+int
+mib_vacm_view_set(uint8_t model, const char *name, uint32_t hash, uint8_t level, MIB_ACES_ATTR_E attribute, const struct mib_view_set **set)
+{
+  struct vacm_member *m;
+
+  if (vacm_members.cnt == 0 || (m = vacm_member_find(model, name, hash)) == NULL) {
+    return 0;
+  }
+
+  if (vacm_dirty) {
+    vacm_compile();
+  }
+  if (level >= MIB_VACM_LEVEL_MAX) {
+    level = MIB_VACM_PRIV;
+  }
+
+  if (attribute == MIB_ACES_READ) {
+    *set = m->group->read[model][level];
+  } else {
+    *set = m->group->write[model][level];
+  }
+  return 1;
+}
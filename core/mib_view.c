@@ -27,17 +27,94 @@
 #include "mib.h"
 #include "snmp.h"
 
-static struct mib_view *mib_views;
-static struct mib_community *mib_communities;
-static struct mib_user *mib_users;
+/* Initial number of hash buckets, must be power of 2 */
+#define MIB_HASH_BUCKETS  64
+
+static struct mib_hash mib_views;
+static struct mib_hash mib_communities;
+static struct mib_hash mib_users;
+/* Users with keys not localized yet */
+static int mib_user_keys_pending;
+
+uint32_t
+mib_str_hash(const char *str)
+{
+  /* FNV-1a */
+  uint32_t h = 2166136261u;
+  while (*str) {
+    h = (h ^ (uint8_t)*str++) * 16777619u;
+  }
+  return h;
+}
+
+/* First node in the bucket of hash, chains are walked comparing hashes
+ * before keys */
+struct mib_hash_node *
+mib_hash_first(const struct mib_hash *h, uint32_t hash)
+{
+  if (h->size == 0) {
+    return NULL;
+  }
+  return h->buckets[hash & (h->size - 1)];
+}
+
+static void
+mib_hash_grow(struct mib_hash *h)
+{
+  struct mib_hash_node **buckets, *n, *next;
+  uint32_t i, size = h->size ? h->size * 2 : MIB_HASH_BUCKETS;
+
+  buckets = xcalloc(size, sizeof(*buckets));
+  for (i = 0; i < h->size; i++) {
+    for (n = h->buckets[i]; n != NULL; n = next) {
+      next = n->next;
+      n->next = buckets[n->hash & (size - 1)];
+      buckets[n->hash & (size - 1)] = n;
+    }
+  }
+  free(h->buckets);
+  h->buckets = buckets;
+  h->size = size;
+}
+
+void
+mib_hash_add(struct mib_hash *h, struct mib_hash_node *n, uint32_t hash)
+{
+  struct mib_hash_node **p;
+
+  /* Keep chains about one node long */
+  if (h->cnt >= h->size) {
+    mib_hash_grow(h);
+  }
+  n->hash = hash;
+  p = &h->buckets[hash & (h->size - 1)];
+  n->next = *p;
+  *p = n;
+  h->cnt++;
+}
+
+void
+mib_hash_del(struct mib_hash *h, struct mib_hash_node *n)
+{
+  struct mib_hash_node **p;
+
+  for (p = &h->buckets[n->hash & (h->size - 1)]; *p != NULL; p = &(*p)->next) {
+    if (*p == n) {
+      *p = n->next;
+      h->cnt--;
+      return;
+    }
+  }
+}
 
 static struct mib_view *
-mib_view_search(const oid_t *oid, uint32_t id_len)
+mib_view_search(const oid_t *oid, uint32_t id_len, uint32_t hash)
 {
-  struct mib_view *v;
+  struct mib_hash_node *n;
 
-  for (v = mib_views; v != NULL; v = v->next) {
-    if (!oid_cmp(v->oid, v->id_len, oid, id_len)) {
+  for (n = mib_hash_first(&mib_views, hash); n != NULL; n = n->next) {
+    struct mib_view *v = container_of(n, struct mib_view, hnode);
+    if (n->hash == hash && !oid_cmp(v->oid, v->id_len, oid, id_len)) {
       return v;
     }
   }
@@ -49,35 +126,219 @@ static struct mib_view *
 view_create(const oid_t *oid, uint32_t id_len)
 {
   struct mib_view *v;
+  uint32_t hash = oid_hash(oid, id_len);
 
-  v = mib_view_search(oid, id_len);
+  v = mib_view_search(oid, id_len, hash);
   if (v == NULL) {
     v = xmalloc(sizeof(*v));
-    v->oid = oid_dup(oid, id_len);
+    if (id_len <= OID_INLINE_LEN) {
+      v->oid = oid_cpy(v->oid_inline, oid, id_len);
+    } else {
+      v->oid = oid_dup(oid, id_len);
+    }
     v->id_len = id_len;
     INIT_LIST_HEAD(&v->communities);
     INIT_LIST_HEAD(&v->users);
-    v->next = mib_views;
-    mib_views = v;
+    mib_hash_add(&mib_views, &v->hnode, hash);
   }
 
   return v;
 }
 
+/* Index of the first view covering oid or ahead of it, cnt if all views
+ * are behind oid */
+uint32_t
+mib_view_set_locate(const struct mib_view_set *set, const oid_t *oid, uint32_t id_len)
+{
+  uint32_t lo = 0, hi = set->cnt;
+
+  /* First view greater than oid */
+  while (lo < hi) {
+    uint32_t mid = lo + (hi - lo) / 2;
+    const struct mib_view *v = set->views[mid];
+    if (oid_cmp(v->oid, v->id_len, oid, id_len) > 0) {
+      hi = mid;
+    } else {
+      lo = mid + 1;
+    }
+  }
+
+  if (lo > 0) {
+    const struct mib_view *v = set->views[lo - 1];
+    if (oid_cover(v->oid, v->id_len, oid, id_len) > 0) {
+      return lo - 1;
+    }
+  }
+  return lo;
+}
+
+/* Whether families let oid inside the views be accessed. When an exclusion
+ * holds for the whole subtree of the first skip_len arcs of oid, skip_len
+ * is set for callers to go on after that subtree, otherwise it is 0. */
+int
+mib_view_set_allow(const struct mib_view_set *set, const oid_t *oid, uint32_t id_len, uint32_t *skip_len)
+{
+  const struct mib_vacm_family *f, *g;
+  uint32_t i;
+
+  *skip_len = 0;
+  if (set->families == NULL) {
+    return 1;
+  }
+
+  /* The first family matching in order of precedence decides */
+  for (f = set->families; f < set->families + set->family_cnt; f++) {
+    if (f->len > id_len) {
+      continue;
+    }
+    for (i = 0; i < f->len; i++) {
+      if (mib_vacm_mask_bit(f, i) && f->subtree[i] != oid[i]) {
+        break;
+      }
+    }
+    if (i == f->len) {
+      break;
+    }
+  }
+
+  if (f == set->families + set->family_cnt) {
+    return 0;
+  }
+  if (f->included) {
+    return 1;
+  }
+
+  /* Longer families come first, none of them may match in the subtree */
+  for (g = set->families; g < f; g++) {
+    if (g->len <= f->len) {
+      continue;
+    }
+    for (i = 0; i < f->len; i++) {
+      if (mib_vacm_mask_bit(g, i) && g->subtree[i] != oid[i]) {
+        break;
+      }
+    }
+    if (i == f->len) {
+      return 0;
+    }
+  }
+  *skip_len = f->len;
+  return 0;
+}
+
+/* Whether oid can be accessed through the view set */
+int
+mib_view_set_cover(const struct mib_view_set *set, const oid_t *oid, uint32_t id_len)
+{
+  uint32_t i = mib_view_set_locate(set, oid, id_len);
+  uint32_t skip_len;
+
+  return i < set->cnt && oid_cover(set->views[i]->oid, set->views[i]->id_len, oid, id_len) > 0
+         && mib_view_set_allow(set, oid, id_len, &skip_len);
+}
+
+/* Add the subtree of oid to the view set, covered views are merged */
+void
+mib_view_set_add(struct mib_view_set *set, const oid_t *oid, uint32_t id_len)
+{
+  uint32_t i, j;
+
+  i = mib_view_set_locate(set, oid, id_len);
+  if (i < set->cnt && oid_cover(set->views[i]->oid, set->views[i]->id_len, oid, id_len) > 0) {
+    /* Covered by a view already */
+    return;
+  }
+
+  /* Drop views covered by the new one, they follow it in order */
+  for (j = i; j < set->cnt && oid_cover(oid, id_len, set->views[j]->oid, set->views[j]->id_len) > 0; j++);
+  if (j == i) {
+    set->views = xrealloc(set->views, (set->cnt + 1) * sizeof(*set->views));
+    memmove(set->views + i + 1, set->views + i, (set->cnt - i) * sizeof(*set->views));
+    set->cnt++;
+  } else {
+    memmove(set->views + i + 1, set->views + j, (set->cnt - j) * sizeof(*set->views));
+    set->cnt -= j - i - 1;
+  }
+  set->views[i] = view_create(oid, id_len);
+}
+
+void
+mib_view_set_free(struct mib_view_set *set)
+{
+  free(set->views);
+  set->views = NULL;
+  set->cnt = 0;
+}
+
+static void
+community_view_set_build(struct mib_view_set *set, struct list_head *views)
+{
+  struct list_head *pos;
+  uint32_t n = 0;
+
+  list_for_each(pos, views) {
+    n++;
+  }
+  mib_view_set_free(set);
+  if (n > 0) {
+    set->views = xmalloc(n * sizeof(*set->views));
+    list_for_each(pos, views) {
+      struct community_view *cv = list_entry(pos, struct community_view, clink);
+      set->views[set->cnt++] = cv->view;
+    }
+  }
+}
+
+static void
+user_view_set_build(struct mib_view_set *set, struct list_head *views)
+{
+  struct list_head *pos;
+  uint32_t n = 0;
+
+  list_for_each(pos, views) {
+    n++;
+  }
+  mib_view_set_free(set);
+  if (n > 0) {
+    set->views = xmalloc(n * sizeof(*set->views));
+    list_for_each(pos, views) {
+      struct user_view *uv = list_entry(pos, struct user_view, ulink);
+      set->views[set->cnt++] = uv->view;
+    }
+  }
+}
+
+static struct mib_community *
+community_find(const char *community, uint32_t hash)
+{
+  struct mib_hash_node *n;
+
+  for (n = mib_hash_first(&mib_communities, hash); n != NULL; n = n->next) {
+    struct mib_community *c = container_of(n, struct mib_community, hnode);
+    if (n->hash == hash && !strcmp(c->name, community)) {
+      return c;
+    }
+  }
+
+  return NULL;
+}
+
 static struct mib_community *
 community_create(const char *community)
 {
   struct mib_community *c;
+  uint32_t hash = mib_str_hash(community);
 
-  c = mib_community_search(community);
+  c = community_find(community, hash);
   if (c == NULL) {
     c = xmalloc(sizeof(*c));
     char *name = xmalloc(strlen(community) + 1);
     c->name = strcpy(name, community);
     INIT_LIST_HEAD(&c->ro_views);
     INIT_LIST_HEAD(&c->rw_views);
-    c->next = mib_communities;
-    mib_communities = c;
+    memset(&c->ro_set, 0, sizeof(c->ro_set));
+    memset(&c->rw_set, 0, sizeof(c->rw_set));
+    mib_hash_add(&mib_communities, &c->hnode, hash);
   }
 
   return c;
@@ -179,31 +440,32 @@ mib_community_reg(const oid_t *oid, uint32_t id_len, const char *community, MIB_
     community_view_bind(oid, id_len, c, MIB_ACES_WRITE);
   }
   community_view_bind(oid, id_len, c, MIB_ACES_READ);
+
+  community_view_set_build(&c->ro_set, &c->ro_views);
+  community_view_set_build(&c->rw_set, &c->rw_views);
 }
 
 void
 mib_community_unreg(const char *community, MIB_ACES_ATTR_E attribute)
 {
-  struct mib_community **cc = &mib_communities;
+  struct mib_community *c;
 
   assert(community != NULL);
 
-  while (*cc != NULL) {
-    struct mib_community *c = *cc;
-    if (!strcmp(c->name, community)) {
-      /* Delete all community views */
-      if (attribute == MIB_ACES_READ) {
-        community_view_remove(&c->ro_views);
-      }
-      community_view_remove(&c->rw_views);
-
-      /* If both RW views emtpy, delete this community string */
-      if (list_empty(&c->ro_views) && list_empty(&c->rw_views)) {
-        *cc = c->next;
-        free(c);
-      }
-    } else {
-      cc = &c->next;
+  c = community_find(community, mib_str_hash(community));
+  if (c != NULL) {
+    /* Delete all community views */
+    if (attribute == MIB_ACES_READ) {
+      community_view_remove(&c->ro_views);
+    }
+    community_view_remove(&c->rw_views);
+    community_view_set_build(&c->ro_set, &c->ro_views);
+    community_view_set_build(&c->rw_set, &c->rw_views);
+
+    /* If both RW views emtpy, delete this community string */
+    if (list_empty(&c->ro_views) && list_empty(&c->rw_views)) {
+      mib_hash_del(&mib_communities, &c->hnode);
+      free(c);
     }
   }
 }
@@ -211,72 +473,67 @@ mib_community_unreg(const char *community, MIB_ACES_ATTR_E attribute)
 struct mib_community *
 mib_community_search(const char *community)
 {
-  struct mib_community *c;
-
   if (community != NULL) {
-    for (c = mib_communities; c != NULL; c = c->next) {
-      if (!strcmp(c->name, community)) {
-        return c;
-      }
-    }
+    return community_find(community, mib_str_hash(community));
   }
 
   return NULL;
 }
 
-int
-mib_community_view_cover(struct mib_community *c, MIB_ACES_ATTR_E attribute, const oid_t *oid, uint32_t id_len)
+/* Views of community for a v1 or v2c request, the ones of its VACM group
+ * if it is in one. NULL if not accessible at all. */
+const struct mib_view_set *
+mib_community_view_set(const char *community, uint8_t version, MIB_ACES_ATTR_E attribute)
 {
-  struct list_head *pos, *views;
+  const struct mib_view_set *set;
+  struct mib_community *c;
+  uint32_t hash;
 
-  if (c != NULL) {
-    /* Access attribute */
-    if (attribute == MIB_ACES_READ) {
-      views = &c->ro_views;
-    } else {
-      views = &c->rw_views;
-    }
+  if (community == NULL) {
+    return NULL;
+  }
 
-    list_for_each(pos, views) {
-      struct community_view *cv = list_entry(pos, struct community_view, clink);
-      struct mib_view *v = cv->view;
-      if (oid_cover(v->oid, v->id_len, oid, id_len) > 0) {
-        return 1;
-      }
-    }
+  hash = mib_str_hash(community);
+  if (mib_vacm_view_set(version == 0 ? MIB_VACM_MODEL_V1 : MIB_VACM_MODEL_V2C,
+                        community, hash, MIB_VACM_NOAUTH, attribute, &set)) {
+    return set;
   }
 
-  return 0;
+  c = community_find(community, hash);
+  if (c == NULL) {
+    return NULL;
+  }
+  return attribute == MIB_ACES_READ ? &c->ro_set : &c->rw_set;
 }
 
-struct mib_view*
-mib_community_next_view(struct mib_community *c, MIB_ACES_ATTR_E attribute, struct mib_view *v)
+#ifndef DISABLE_CRYPTO
+/* Digest and MAC length in bytes of SHA-2 auth modes, RFC 7860 */
+static const struct {
+  uint8_t key_len;
+  uint8_t mac_len;
+} sha2_auth_lens[] = {
+  [SNMP_USER_AUTH_SHA224] = { SHA224_SECRETKEYLEN, 16 },
+  [SNMP_USER_AUTH_SHA256] = { SHA256_SECRETKEYLEN, 24 },
+  [SNMP_USER_AUTH_SHA384] = { SHA384_SECRETKEYLEN, 32 },
+  [SNMP_USER_AUTH_SHA512] = { SHA512_SECRETKEYLEN, 48 },
+};
+
+static inline int
+auth_mode_is_sha2(uint8_t auth_mode)
 {
-  struct list_head *pos, *views;
+  return auth_mode >= SNMP_USER_AUTH_SHA224 && auth_mode <= SNMP_USER_AUTH_SHA512;
+}
+#endif
 
-  if (c != NULL) {
-    /* Access attribute */
-    if (attribute == MIB_ACES_READ) {
-      views = &c->ro_views;
-    } else {
-      views = &c->rw_views;
-    }
+static struct mib_user *
+mib_user_find(const char *user, uint32_t hash)
+{
+  struct mib_hash_node *n;
 
-    list_for_each(pos, views) {
-      struct community_view *cv = list_entry(pos, struct community_view, clink);
-      if (v == NULL) {
-        /* Return first view */
-        pos = views->next;
-        cv = list_entry(pos, struct community_view, clink);
-        return cv->view;
-      } else if (v == cv->view) {
-        if (!list_is_last(&cv->clink, views)) {
-          /* Return next view */
-          pos = cv->clink.next;
-          cv = list_entry(pos, struct community_view, clink);
-          return cv->view;
-        }
-      }
+  for (n = mib_hash_first(&mib_users, hash); n != NULL; n = n->next) {
+    struct mib_user *u = container_of(n, struct mib_user, hnode);
+    if (n->hash == hash && !strcmp(u->name, user)) {
+      return u;
     }
   }
 
@@ -287,60 +544,134 @@ void
 mib_user_create(const char *user, uint8_t auth_mode, const char *auth_phrase, uint8_t priv_mode, const char *priv_phrase)
 {
   struct mib_user *u;
+  uint32_t hash = mib_str_hash(user);
 
-  u = mib_user_search(user);
+  u = mib_user_find(user, hash);
   if (u == NULL) {
     u = xmalloc(sizeof(*u));
     char *name = xmalloc(strlen(user) + 1);
     u->name = strcpy(name, user);
+    u->key_job = NULL;
     INIT_LIST_HEAD(&u->ro_views);
     INIT_LIST_HEAD(&u->rw_views);
-    u->next = mib_users;
-    mib_users = u;
+    memset(&u->ro_set, 0, sizeof(u->ro_set));
+    memset(&u->rw_set, 0, sizeof(u->rw_set));
+    mib_hash_add(&mib_users, &u->hnode, hash);
   }
 
 #ifndef DISABLE_CRYPTO
-  /* Generate and localize authentication key */
+  /* Keys are localized later all at once, see mib_user_keys_flush() */
   if (strlen(auth_phrase)) {
-    const uint8_t *password = (const uint8_t *)auth_phrase;
-    const uint8_t *engine_id = (const uint8_t *)snmpv3_engine_id;
+    uint8_t key_len = 0;
 
     u->auth_mode = auth_mode;
+    u->auth_mac_len = SNMP_MSG_AUTH_PARA_LEN;
     if (auth_mode == SNMP_USER_AUTH_MD5) {
 #ifndef DISABLE_MD5
-      MD5_key(password, strlen(auth_phrase), engine_id, sizeof(snmpv3_engine_id), u->auth_key.md5);
+      key_len = MD5_SECRETKEYLEN;
 #endif
     } else if (auth_mode == SNMP_USER_AUTH_SHA1) {
 #ifndef DISABLE_SHA
-      SHA1_key(password, strlen(auth_phrase), engine_id, sizeof(snmpv3_engine_id), u->auth_key.sha1);
+      key_len = SHA1_SECRETKEYLEN;
+#endif
+    } else if (auth_mode_is_sha2(auth_mode)) {
+      u->auth_mac_len = sha2_auth_lens[auth_mode].mac_len;
+#ifndef DISABLE_SHA
+      key_len = sha2_auth_lens[auth_mode].key_len;
 #endif
     }
+    if (auth_mode_is_sha2(auth_mode)) {
+      u->auth_key_len = sha2_auth_lens[auth_mode].key_len;
+    } else {
+      u->auth_key_len = key_len;
+    }
 
-    /* Generate and localize privacy key for encryption */
     if (strlen(priv_phrase)) {
-      uint8_t secret_key[SHA1_SECRETKEYLEN];
-      password = (const uint8_t *)priv_phrase;
-      engine_id = (const uint8_t *)snmpv3_engine_id;
+      u->priv_mode = priv_mode;
+    }
+
+    if (u->key_job != NULL) {
+      mib_key_job_free(u->key_job);
+      u->key_job = NULL;
+    }
+    if (key_len > 0) {
+      u->key_job = mib_key_job_new(u->name, auth_mode, key_len, auth_phrase, priv_phrase);
+      mib_user_keys_pending = 1;
+    }
+  }
+#endif
+
+  return;
+}
 
-      if (auth_mode == SNMP_USER_AUTH_MD5) {
+/* Localize keys of all users created since last flush, from the key store
+ * or from pass phrases in parallel */
+void
+mib_user_keys_flush(void)
+{
+  struct mib_user **users;
+  struct mib_key_job **jobs;
+  struct mib_hash_node *node;
+  uint32_t i;
+  int k, n = 0;
+
+  if (!mib_user_keys_pending) {
+    return;
+  }
+  mib_user_keys_pending = 0;
+
+  users = xmalloc(mib_users.cnt * sizeof(*users));
+  jobs = xmalloc(mib_users.cnt * sizeof(*jobs));
+  for (i = 0; i < mib_users.size; i++) {
+    for (node = mib_users.buckets[i]; node != NULL; node = node->next) {
+      struct mib_user *u = container_of(node, struct mib_user, hnode);
+      if (u->key_job != NULL) {
+        users[n] = u;
+        jobs[n++] = u->key_job;
+      }
+    }
+  }
+  if (n > 0) {
+    mib_key_derive(jobs, n);
+  }
+
+  for (k = 0; k < n; k++) {
+    struct mib_user *u = users[k];
+    struct mib_key_job *job = jobs[k];
+
+#ifndef DISABLE_CRYPTO
+    if (job->auth_mode == SNMP_USER_AUTH_MD5) {
 #ifndef DISABLE_MD5
-        MD5_key(password, strlen(priv_phrase), engine_id, sizeof(snmpv3_engine_id), secret_key);
+      memcpy(u->auth_key.md5, job->auth_key, sizeof(u->auth_key.md5));
+      MD5_hmac_prepare(u->auth_key.md5, sizeof(u->auth_key.md5), u->auth_ipad, u->auth_opad);
 #endif
-      } else if (auth_mode == SNMP_USER_AUTH_SHA1) {
+    } else if (job->auth_mode == SNMP_USER_AUTH_SHA1) {
 #ifndef DISABLE_SHA
-        SHA1_key(password, strlen(priv_phrase), engine_id, sizeof(snmpv3_engine_id), secret_key);
+      memcpy(u->auth_key.sha1, job->auth_key, sizeof(u->auth_key.sha1));
+      SHA1_hmac_prepare(u->auth_key.sha1, sizeof(u->auth_key.sha1), u->auth_ipad, u->auth_opad);
 #endif
-      }
+    } else if (auth_mode_is_sha2(job->auth_mode)) {
+#ifndef DISABLE_SHA
+      memcpy(u->auth_key.sha2, job->auth_key, job->key_len);
+      SHA2_hmac_prepare(job->key_len, u->auth_key.sha2, job->key_len, u->auth_ipad, u->auth_opad);
+#endif
+    }
 
-      u->priv_mode = priv_mode;
 #ifndef DISABLE_AES
-      memcpy(u->priv_key.aes, secret_key, AES_SECRETKEYLEN);
-#endif
+    /* Privacy key for encryption */
+    if (job->priv_phrase != NULL) {
+      memcpy(u->priv_key.aes, job->priv_key, AES_SECRETKEYLEN);
+      AES_Schedule(u->priv_key.aes, sizeof(u->priv_key.aes), u->priv_sched);
     }
-  }
+#endif
 #endif
 
-  return;
+    u->key_job = NULL;
+    mib_key_job_free(job);
+  }
+
+  free(users);
+  free(jobs);
 }
 
 static int
@@ -432,39 +763,43 @@ mib_user_reg(const oid_t *oid, uint32_t id_len, const char *user, MIB_ACES_ATTR_
   assert(oid != NULL && user != NULL);
 
   /* User must exists */
-  u = mib_user_search(user);
+  u = mib_user_find(user, mib_str_hash(user));
   if (u != NULL) {
     /* Bind user-view */
     if (attribute == MIB_ACES_WRITE) {
       user_view_bind(oid, id_len, u, MIB_ACES_WRITE);
     }
     user_view_bind(oid, id_len, u, MIB_ACES_READ);
+
+    user_view_set_build(&u->ro_set, &u->ro_views);
+    user_view_set_build(&u->rw_set, &u->rw_views);
   }
 }
 
 void
 mib_user_unreg(const char *user, MIB_ACES_ATTR_E attribute)
 {
-  struct mib_user **uu = &mib_users;
+  struct mib_user *u;
 
   assert(user != NULL);
 
-  while (*uu != NULL) {
-    struct mib_user *u = *uu;
-    if (!strcmp(u->name, user)) {
-      /* Delete all user views */
-      if (attribute == MIB_ACES_READ) {
-        user_view_remove(&u->ro_views);
-      }
-      user_view_remove(&u->rw_views);
-
-      /* If both RW views emtpy, delete this user */
-      if (list_empty(&u->ro_views) && list_empty(&u->rw_views)) {
-        *uu = u->next;
-        free(u);
+  u = mib_user_find(user, mib_str_hash(user));
+  if (u != NULL) {
+    /* Delete all user views */
+    if (attribute == MIB_ACES_READ) {
+      user_view_remove(&u->ro_views);
+    }
+    user_view_remove(&u->rw_views);
+    user_view_set_build(&u->ro_set, &u->ro_views);
+    user_view_set_build(&u->rw_set, &u->rw_views);
+
+    /* If both RW views emtpy, delete this user */
+    if (list_empty(&u->ro_views) && list_empty(&u->rw_views)) {
+      mib_hash_del(&mib_users, &u->hnode);
+      if (u->key_job != NULL) {
+        mib_key_job_free(u->key_job);
       }
-    } else {
-      uu = &u->next;
+      free(u);
     }
   }
 }
@@ -472,74 +807,28 @@ mib_user_unreg(const char *user, MIB_ACES_ATTR_E attribute)
 struct mib_user *
 mib_user_search(const char *user)
 {
-  struct mib_user *u;
-
   if (user != NULL) {
-    for (u = mib_users; u != NULL; u = u->next) {
-      if (!strcmp(u->name, user)) {
-        return u;
-      }
-    }
+    /* Users are looked up by requests once keys are ready */
+    mib_user_keys_flush();
+    return mib_user_find(user, mib_str_hash(user));
   }
 
   return NULL;
 }
 
-int
-mib_user_view_cover(struct mib_user *u, MIB_ACES_ATTR_E attribute, const oid_t *oid, uint32_t id_len)
+/* Views of user for a request of security level, the ones of its VACM group
+ * if it is in one. NULL if not accessible at all. */
+const struct mib_view_set *
+mib_user_view_set(struct mib_user *u, uint8_t level, MIB_ACES_ATTR_E attribute)
 {
-  struct list_head *pos, *views;
+  const struct mib_view_set *set;
 
-  if (u != NULL) {
-    /* Access attribute */
-    if (attribute == MIB_ACES_READ) {
-      views = &u->ro_views;
-    } else {
-      views = &u->rw_views;
-    }
-
-    list_for_each(pos, views) {
-      struct user_view *uv = list_entry(pos, struct user_view, ulink);
-      struct mib_view *v = uv->view;
-      if (oid_cover(v->oid, v->id_len, oid, id_len) > 0) {
-        return 1;
-      }
-    }
+  if (u == NULL) {
+    return NULL;
   }
 
-  return 0;
-}
-
-struct mib_view *
-mib_user_next_view(struct mib_user *u, MIB_ACES_ATTR_E attribute, struct mib_view *v)
-{
-  struct list_head *pos, *views;
-
-  if (u != NULL) {
-    /* Access attribute */
-    if (attribute == MIB_ACES_READ) {
-      views = &u->ro_views;
-    } else {
-      views = &u->rw_views;
-    }
-
-    list_for_each(pos, views) {
-      struct user_view *uv = list_entry(pos, struct user_view, ulink);
-      if (v == NULL) {
-        /* Return first view */
-        pos = views->next;
-        uv = list_entry(pos, struct user_view, ulink);
-        return uv->view;
-      } else if (v == uv->view) {
-        if (!list_is_last(&uv->ulink, views)) {
-          /* Return next view */
-          pos = uv->ulink.next;
-          uv = list_entry(pos, struct user_view, ulink);
-          return uv->view;
-        }
-      }
-    }
+  if (mib_vacm_view_set(MIB_VACM_MODEL_USM, u->name, u->hnode.hash, level, attribute, &set)) {
+    return set;
   }
-
-  return NULL;
+  return attribute == MIB_ACES_READ ? &u->ro_set : &u->rw_set;
 }
@@ -34,11 +34,14 @@ struct protocol_operation {
   int (*open)(void);
   int (*close)(void);
   void (*run)(void);
-  int (*reg)(const oid_t *grp_id, int id_len, int grp_cb);
+  int (*reg)(const oid_t *grp_id, int id_len, int grp_cb, int bulk);
   int (*unreg)(const oid_t *grp_id, int id_len);
-  void (*receive)(uint8_t *buf, int len);
-  void (*send)(uint8_t *buf, int len);
+  void (*receive)(uint8_t *buf, int len, void *peer);
+  void (*send)(uint8_t *buf, int len, void *peer);
   int  (*step)(long timeout);
+  int  (*fork)(int workers);
+  /* Optional, receives datagrams of one transport batch together */
+  void (*receive_batch)(uint8_t **bufs, const int *lens, void **peers, int n);
 };
 
 extern struct protocol_operation snmp_prot_ops;
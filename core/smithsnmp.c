@@ -22,15 +22,21 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <ctype.h>
 #include <assert.h>
 
 #include "mib.h"
 #include "protocol.h"
+#include "transport.h"
+#include "snmp.h"
 #ifndef DISABLE_TRAP
 #include "trap.h"
 #endif
 #include "utils.h"
 
+/* Metatable of sorted index set userdata */
+#define MIB_INDEX_MT  "smithsnmp.index"
+
 struct protocol_operation *smithsnmp_prot_ops;
 struct trap_operation *smithsnmp_trap_ops;
 
@@ -89,7 +95,35 @@ smithsnmp_open(lua_State *L)
 int
 smithsnmp_run(lua_State *L)
 {
+  int worker = 0;
+  int workers = luaL_optint(L, 1, 1);
+
+  /* Localize keys of users once for all workers */
+  mib_user_keys_flush();
+
+  /* Pre-fork worker processes */
+  if (workers > 1) {
+    if (smithsnmp_prot_ops->fork == NULL) {
+      return luaL_error(L, "%s agent can not run in multiple workers", smithsnmp_prot_ops->name);
+    }
+    worker = smithsnmp_prot_ops->fork(workers);
+    if (worker < 0) {
+      return luaL_error(L, "fail to fork %d workers", workers);
+    }
+#ifndef DISABLE_TRAP
+    /* Traps are probed and sent by the parent only */
+    if (worker > 0) {
+      smithsnmp_trap_ops->close();
+    }
+#endif
+  }
+
   smithsnmp_prot_ops->run();
+
+  /* Forked workers never return to the caller */
+  if (worker > 0) {
+    exit(EXIT_SUCCESS);
+  }
   return 0;  
 }
 
@@ -108,15 +142,186 @@ smithsnmp_exit(lua_State *L)
   return 0;
 }
 
+/* SNMP transport counters */
+int
+smithsnmp_transport_stats(lua_State *L)
+{
+  lua_newtable(L);
+  lua_pushnumber(L, snmp_transp_stats.rx_calls);
+  lua_setfield(L, -2, "rx_calls");
+  lua_pushnumber(L, snmp_transp_stats.rx_dgrams);
+  lua_setfield(L, -2, "rx_dgrams");
+  lua_pushnumber(L, snmp_transp_stats.rx_pauses);
+  lua_setfield(L, -2, "rx_pauses");
+  lua_pushnumber(L, snmp_transp_stats.tx_calls);
+  lua_setfield(L, -2, "tx_calls");
+  lua_pushnumber(L, snmp_transp_stats.tx_dgrams);
+  lua_setfield(L, -2, "tx_dgrams");
+  lua_pushnumber(L, snmp_transp_stats.tx_drops);
+  lua_setfield(L, -2, "tx_drops");
+  lua_pushnumber(L, snmp_transp_stats.tx_queued);
+  lua_setfield(L, -2, "tx_queued");
+  return 1;
+}
+
+/* SNMP request arena counters */
+int
+smithsnmp_arena_stats(lua_State *L)
+{
+  lua_newtable(L);
+  lua_pushnumber(L, snmp_arena_stats.allocs);
+  lua_setfield(L, -2, "allocs");
+  lua_pushnumber(L, snmp_arena_stats.mallocs);
+  lua_setfield(L, -2, "mallocs");
+  lua_pushnumber(L, snmp_arena_stats.resets);
+  lua_setfield(L, -2, "resets");
+  lua_pushnumber(L, snmp_arena_stats.peak);
+  lua_setfield(L, -2, "peak");
+  return 1;
+}
+
+/* MIB value cache counters */
+int
+smithsnmp_cache_stats(lua_State *L)
+{
+  lua_newtable(L);
+  lua_pushnumber(L, mib_cache_stats.hits);
+  lua_setfield(L, -2, "hits");
+  lua_pushnumber(L, mib_cache_stats.misses);
+  lua_setfield(L, -2, "misses");
+  lua_pushnumber(L, mib_cache_stats.entries);
+  lua_setfield(L, -2, "entries");
+  lua_pushnumber(L, mib_cache_stats.cursor_hits);
+  lua_setfield(L, -2, "cursor_hits");
+  lua_pushnumber(L, mib_cache_stats.cursor_misses);
+  lua_setfield(L, -2, "cursor_misses");
+  return 1;
+}
+
+/* Localized key store counters */
+int
+smithsnmp_key_stats(lua_State *L)
+{
+  lua_newtable(L);
+  lua_pushnumber(L, mib_key_stats.hits);
+  lua_setfield(L, -2, "hits");
+  lua_pushnumber(L, mib_key_stats.misses);
+  lua_setfield(L, -2, "misses");
+  lua_pushnumber(L, mib_key_stats.entries);
+  lua_setfield(L, -2, "entries");
+  return 1;
+}
+
+/* New sorted index set of table instances */
+int
+smithsnmp_index_new(lua_State *L)
+{
+  struct mib_index *idx = lua_newuserdata(L, sizeof(*idx));
+  mib_index_init(idx);
+  luaL_getmetatable(L, MIB_INDEX_MT);
+  lua_setmetatable(L, -2);
+  return 1;
+}
+
+static int
+smithsnmp_index_gc(lua_State *L)
+{
+  mib_index_free(luaL_checkudata(L, 1, MIB_INDEX_MT));
+  return 0;
+}
+
+/* Rebuild index set from the keys of table, numbers or strings like "10.0.0.1.22" */
+int
+smithsnmp_index_build(lua_State *L)
+{
+  struct mib_index *idx = luaL_checkudata(L, 1, MIB_INDEX_MT);
+  oid_t oid[ASN1_OID_MAX_LEN];
+  uint32_t len;
+  const char *s;
+  char *end;
+
+  luaL_checktype(L, 2, LUA_TTABLE);
+  mib_index_clear(idx);
+
+  lua_pushnil(L);
+  while (lua_next(L, 2) != 0) {
+    /* Only key is needed */
+    lua_pop(L, 1);
+    len = 0;
+    if (lua_type(L, -1) == LUA_TNUMBER) {
+      oid[len++] = lua_tointeger(L, -1);
+    } else if (lua_type(L, -1) == LUA_TSTRING) {
+      s = lua_tostring(L, -1);
+      while (*s != '\0' && len < ASN1_OID_MAX_LEN) {
+        if (isdigit((unsigned char)*s)) {
+          oid[len++] = strtoul(s, &end, 10);
+          s = end;
+        } else {
+          s++;
+        }
+      }
+    }
+    mib_index_add(idx, oid, len);
+  }
+
+  mib_index_sort(idx);
+  return 0;
+}
+
+/* The closest index greater than oid[offset...], table of ids or nil */
+int
+smithsnmp_index_next(lua_State *L)
+{
+  struct mib_index *idx = luaL_checkudata(L, 1, MIB_INDEX_MT);
+  const struct mib_index_key *key;
+  oid_t oid[ASN1_OID_MAX_LEN];
+  int i, n, offset;
+  uint32_t len = 0;
+
+  luaL_checktype(L, 2, LUA_TTABLE);
+  offset = luaL_checkint(L, 3);
+  n = lua_objlen(L, 2);
+  for (i = offset; i <= n && len < ASN1_OID_MAX_LEN; i++) {
+    lua_rawgeti(L, 2, i);
+    oid[len++] = lua_tointeger(L, -1);
+    lua_pop(L, 1);
+  }
+
+  key = mib_index_next(idx, oid, len);
+  if (key == NULL) {
+    lua_pushnil(L);
+    return 1;
+  }
+
+  lua_createtable(L, key->len, 0);
+  for (i = 0; i < key->len; i++) {
+    lua_pushinteger(L, key->oid[i]);
+    lua_rawseti(L, -2, i + 1);
+  }
+  return 1;
+}
+
+/* Number of indexes in set */
+int
+smithsnmp_index_count(lua_State *L)
+{
+  struct mib_index *idx = luaL_checkudata(L, 1, MIB_INDEX_MT);
+  lua_pushinteger(L, idx->cnt);
+  return 1;
+}
+
 /* Register mib nodes from Lua */
 int
 smithsnmp_mib_node_reg(lua_State *L)
 {
   oid_t *grp_id;
-  int i, grp_id_len, grp_cb;
+  int i, grp_id_len, grp_cb, bulk;
 
   /* Check if the first argument is a table. */
   luaL_checktype(L, 1, LUA_TTABLE);
+  /* Optional flag that handler serves bulk walk */
+  bulk = lua_toboolean(L, 3);
+  lua_settop(L, 2);
   /* Get oid length */
   grp_id_len = lua_objlen(L, 1);
   /* Get oid */
@@ -134,7 +339,7 @@ smithsnmp_mib_node_reg(lua_State *L)
   grp_cb = luaL_ref(L, LUA_ENVIRONINDEX);
 
   /* Register group node */
-  i = smithsnmp_prot_ops->reg(grp_id, grp_id_len, grp_cb);
+  i = smithsnmp_prot_ops->reg(grp_id, grp_id_len, grp_cb, bulk);
   free(grp_id);
 
   /* Return value */
@@ -245,6 +450,16 @@ smithsnmp_mib_user_create(lua_State *L)
   return 1;
 }
 
+/* Open store of localized user keys from Lua */
+int
+smithsnmp_mib_user_key_store(lua_State *L)
+{
+  const char *path = luaL_checkstring(L, 1);
+
+  lua_pushboolean(L, mib_key_store_open(path) == 0);
+  return 1;
+}
+
 /* Register mib user from Lua */
 int
 smithsnmp_mib_user_reg(lua_State *L)
@@ -288,6 +503,75 @@ smithsnmp_mib_user_unreg(lua_State *L)
   return 0;
 }
 
+/* Add family of VACM view from Lua */
+int
+smithsnmp_mib_vacm_view_add(lua_State *L)
+{
+  oid_t *oid;
+  int i, id_len, ret;
+  const char *view;
+  const char *mask;
+  size_t mask_len;
+
+  view = luaL_checkstring(L, 1);
+  /* Subtree oid */
+  luaL_checktype(L, 2, LUA_TTABLE);
+  id_len = lua_objlen(L, 2);
+  oid = xmalloc((id_len + 1) * sizeof(oid_t));
+  for (i = 0; i < id_len; i++) {
+    lua_rawgeti(L, 2, i + 1);
+    oid[i] = lua_tointeger(L, -1);
+    lua_pop(L, 1);
+  }
+  /* Mask octets and included or excluded */
+  mask = luaL_checklstring(L, 3, &mask_len);
+
+  ret = mib_vacm_view_add(view, oid, id_len, (const uint8_t *)mask, mask_len, lua_toboolean(L, 4));
+  free(oid);
+
+  lua_pushboolean(L, ret == 0);
+  return 1;
+}
+
+/* Map community or user into VACM group from Lua */
+int
+smithsnmp_mib_vacm_group_add(lua_State *L)
+{
+  const char *group = luaL_checkstring(L, 1);
+  int model = luaL_checkint(L, 2);
+  const char *name = luaL_checkstring(L, 3);
+
+  if (model <= MIB_VACM_MODEL_ANY || model >= MIB_VACM_MODEL_MAX) {
+    lua_pushboolean(L, 0);
+    return 1;
+  }
+  mib_vacm_group_add(group, model, name);
+
+  lua_pushboolean(L, 1);
+  return 1;
+}
+
+/* Give VACM group views by security model and level from Lua */
+int
+smithsnmp_mib_vacm_access_add(lua_State *L)
+{
+  const char *group = luaL_checkstring(L, 1);
+  int model = luaL_checkint(L, 2);
+  int level = luaL_checkint(L, 3);
+  const char *read_view = luaL_checkstring(L, 4);
+  const char *write_view = luaL_checkstring(L, 5);
+
+  if (model < MIB_VACM_MODEL_ANY || model >= MIB_VACM_MODEL_MAX ||
+      level < MIB_VACM_NOAUTH || level >= MIB_VACM_LEVEL_MAX) {
+    lua_pushboolean(L, 0);
+    return 1;
+  }
+  mib_vacm_access_add(group, model, level, read_view, write_view);
+
+  lua_pushboolean(L, 1);
+  return 1;
+}
+
 #ifndef DISABLE_TRAP
 /* Enable trap feature */
 int
@@ -327,6 +611,7 @@ smithsnmp_trap_varbind(lua_State *L)
   oid_t *oid;
   int i, oid_len;
   Variable var;
+  void *val = NULL;
 
   /* varbind oid */
   luaL_checktype(L, 1, LUA_TTABLE);
@@ -349,7 +634,7 @@ smithsnmp_trap_varbind(lua_State *L)
     break;
   case ASN1_TAG_OCTSTR:
     length(&var) = lua_objlen(L, 3);
-    memcpy(octstr(&var), lua_tostring(L, 3), length(&var));
+    octstr(&var) = (octstr_t *)lua_tostring(L, 3);
     break;
   case ASN1_TAG_CNT:
     length(&var) = 1;
@@ -357,6 +642,7 @@ smithsnmp_trap_varbind(lua_State *L)
     break;
   case ASN1_TAG_IPADDR:
     length(&var) = lua_objlen(L, 3);
+    ipaddr(&var) = val = xmalloc(length(&var) * sizeof(ipaddr_t));
     for (i = 0; i < length(&var); i++) {
       lua_rawgeti(L, 3, i + 1);
       ipaddr(&var)[i] = lua_tointeger(L, -1);
@@ -365,6 +651,7 @@ smithsnmp_trap_varbind(lua_State *L)
     break;
   case ASN1_TAG_OBJID:
     length(&var) = lua_objlen(L, 3);
+    oid(&var) = val = xmalloc(length(&var) * sizeof(oid_t));
     for (i = 0; i < length(&var); i++) {
       lua_rawgeti(L, 3, i + 1);
       oid(&var)[i] = lua_tointeger(L, -1);
@@ -384,6 +671,7 @@ smithsnmp_trap_varbind(lua_State *L)
   }
 
   smithsnmp_trap_ops->varbind(oid, oid_len, &var);
+  free(val);
   free(oid);
 
   return 0;
@@ -434,13 +722,25 @@ static const luaL_Reg smithsnmp_func[] = {
   { "run", smithsnmp_run },
   { "step", smithsnmp_step },
   { "exit", smithsnmp_exit },
+  { "transport_stats", smithsnmp_transport_stats },
+  { "arena_stats", smithsnmp_arena_stats },
+  { "cache_stats", smithsnmp_cache_stats },
+  { "key_stats", smithsnmp_key_stats },
+  { "index_new", smithsnmp_index_new },
+  { "index_build", smithsnmp_index_build },
+  { "index_next", smithsnmp_index_next },
+  { "index_count", smithsnmp_index_count },
   { "mib_node_reg", smithsnmp_mib_node_reg },
   { "mib_node_unreg", smithsnmp_mib_node_unreg },
   { "mib_community_reg", smithsnmp_mib_community_reg },
   { "mib_community_unreg", smithsnmp_mib_community_unreg },
   { "mib_user_create", smithsnmp_mib_user_create },
+  { "mib_user_key_store", smithsnmp_mib_user_key_store },
   { "mib_user_reg", smithsnmp_mib_user_reg },
   { "mib_user_unreg", smithsnmp_mib_user_unreg },
+  { "mib_vacm_view_add", smithsnmp_mib_vacm_view_add },
+  { "mib_vacm_group_add", smithsnmp_mib_vacm_group_add },
+  { "mib_vacm_access_add", smithsnmp_mib_vacm_access_add },
 #ifndef DISABLE_TRAP
   { "trap_open", smithsnmp_trap_open },
   { "trap_close", smithsnmp_trap_close },
@@ -458,6 +758,12 @@ luaopen_smithsnmp_core(lua_State *L)
   lua_newtable(L);
   lua_replace(L, LUA_ENVIRONINDEX);
 
+  /* Metatable of index set */
+  luaL_newmetatable(L, MIB_INDEX_MT);
+  lua_pushcfunction(L, smithsnmp_index_gc);
+  lua_setfield(L, -2, "__gc");
+  lua_pop(L, 1);
+
   /* Register smithsnmp_func into lua */
   luaL_register(L, "smithsnmp_lib", smithsnmp_func);
 
@@ -28,7 +28,12 @@
 #include "transport.h"
 #include "protocol.h"
 
-struct snmp_datagram snmp_datagram;
+/* Context of the request being processed */
+static struct snmp_datagram *snmpd_datagram;
+/* Contexts of a batch of requests, created as batches grow */
+static struct snmp_datagram *snmpd_batch[SNMP_BATCH_MAX];
+struct arena_stats snmp_arena_stats;
+
 const uint8_t snmpv3_engine_id[] = {
   0x80, 0x00, 0x00, 0x00,
   /* Text tag */
@@ -39,23 +44,45 @@ const uint8_t snmpv3_engine_id[] = {
 
 /* Receive SNMP request datagram from transport layer */
 static void
-snmpd_receive(uint8_t *buf, int len)
+snmpd_receive(uint8_t *buf, int len, void *peer)
 {
-  snmp_recv(buf, len);
+  snmp_recv(snmpd_datagram, buf, len, peer);
+}
+
+/* Receive SNMP request datagrams of one transport batch */
+static void
+snmpd_receive_batch(uint8_t **bufs, const int *lens, void **peers, int n)
+{
+  int i, cnt;
+
+  if (n == 1) {
+    snmp_recv(snmpd_datagram, bufs[0], lens[0], peers[0]);
+    return;
+  }
+
+  for (; n > 0; bufs += cnt, lens += cnt, peers += cnt, n -= cnt) {
+    cnt = n < SNMP_BATCH_MAX ? n : SNMP_BATCH_MAX;
+    for (i = 0; i < cnt; i++) {
+      if (snmpd_batch[i] == NULL) {
+        snmpd_batch[i] = snmp_datagram_new();
+      }
+    }
+    snmp_recv_batch(snmpd_batch, bufs, lens, peers, cnt);
+  }
 }
 
 /* Send SNMP response datagram to transport layer */
 static void
-snmpd_send(uint8_t *buf, int len)
+snmpd_send(uint8_t *buf, int len, void *peer)
 {
-  snmp_transp_ops.send(buf, len);
+  snmp_transp_ops.send(buf, len, peer);
 }
 
 /* Register mib group node */
 static int
-snmpd_mib_node_reg(const oid_t *grp_id, int id_len, int grp_cb)
+snmpd_mib_node_reg(const oid_t *grp_id, int id_len, int grp_cb, int bulk)
 {
-  return mib_node_reg(grp_id, id_len, grp_cb);
+  return mib_node_reg(grp_id, id_len, grp_cb, bulk);
 }
 
 /* Unregister mib group nodes */
@@ -69,8 +96,9 @@ snmpd_mib_node_unreg(const oid_t *grp_id, int id_len)
 static int
 snmpd_init(int port)
 {
-  INIT_LIST_HEAD(&snmp_datagram.vb_in_list);
-  INIT_LIST_HEAD(&snmp_datagram.vb_out_list);
+  if (snmpd_datagram == NULL) {
+    snmpd_datagram = snmp_datagram_new();
+  }
   return snmp_transp_ops.init(port);
 }
 
@@ -100,6 +128,12 @@ snmpd_step(long timeout)
   return snmp_transp_ops.step(timeout);
 }
 
+static int
+snmpd_fork(int workers)
+{
+  return snmp_transp_ops.fork(workers);
+}
+
 struct protocol_operation snmp_prot_ops = {
   "snmp",
   snmpd_init,
@@ -111,4 +145,6 @@ struct protocol_operation snmp_prot_ops = {
   snmpd_receive,
   snmpd_send,
   snmpd_step,
+  snmpd_fork,
+  snmpd_receive_batch,
 };
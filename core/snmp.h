@@ -22,6 +22,7 @@
 #ifndef _SNMP_H_
 #define _SNMP_H_
 
+#include "arena.h"
 #include "asn1.h"
 #include "list.h"
 #include "utils.h"
@@ -30,9 +31,28 @@
 #define MD5_SECRETKEYLEN   16
 #define SHA1_HASHKEYLEN    64
 #define SHA1_SECRETKEYLEN  20
+#define SHA224_SECRETKEYLEN  28
+#define SHA256_SECRETKEYLEN  32
+#define SHA384_SECRETKEYLEN  48
+#define SHA512_SECRETKEYLEN  64
 #define AES_SECRETKEYLEN   16
 
+/* Max datagrams received, authenticated and answered together */
+#define SNMP_BATCH_MAX  32
+
+/* Initial size of the per-request arena */
+#define SNMP_ARENA_SIZE  (65536)
+
+/* Response buffer, the varbind list grows behind the headroom and headers
+ * are encoded backward in front of it */
+#define SNMP_OUT_BUF_SIZE  (8192)
+#define SNMP_HDR_MAX_LEN   (512)
+/* Sequence, oid and value of a varbind, each with tag and length */
+#define SNMP_VB_MAX_LEN    (3 * 6 + ASN1_OID_MAX_LEN * 5 + ASN1_VALUE_MAX_LEN)
+
 #define SNMP_MSG_AUTH_PARA_LEN     12
+/* Longest MAC, of HMAC-SHA-512 in RFC 7860 */
+#define SNMP_MSG_AUTH_PARA_MAX_LEN  48
 #define SNMP_MSG_ENCRYPT_PARA_LEN  8
 
 #define SNMP_SECUR_FLAG_AUTH     0x1
@@ -42,6 +62,11 @@
 typedef enum snmp_user_auth_mode {
   SNMP_USER_AUTH_MD5,
   SNMP_USER_AUTH_SHA1 = 1,
+  /* HMAC-SHA-2 of RFC 7860 */
+  SNMP_USER_AUTH_SHA224 = 2,
+  SNMP_USER_AUTH_SHA256 = 3,
+  SNMP_USER_AUTH_SHA384 = 4,
+  SNMP_USER_AUTH_SHA512 = 5,
 } SNMP_USER_AUTH_MODE_E;
 
 /* User encryption mode */
@@ -140,6 +165,16 @@ struct var_bind {
   uint8_t value[0];
 };
 
+/* Varbind of a request, oid and value are left BER encoded in the receive
+ * buffer and given by offset and length in bytes */
+struct vb_view {
+  uint32_t oid_off;
+  uint32_t oid_len;
+  uint32_t value_off;
+  uint32_t value_len;
+  uint8_t value_type;
+};
+
 struct pdu_hdr {
   uint8_t pdu_type;
   uint32_t pdu_len;
@@ -154,11 +189,17 @@ struct pdu_hdr {
   integer_t err_idx;
 };
 
+/* Request context, everything needed to process one request and encode
+ * its response, so that several requests can be in flight at once. */
 struct snmp_datagram {
   void *recv_buf;
   uint32_t recv_len;
   void *send_buf;
   uint32_t send_len;
+  /* transport handle of the manager, handed back with the response */
+  void *peer;
+  /* varbinds, oids and send buffer of the request, reset once replied */
+  struct mem_arena *arena;
 
   uint32_t data_len;
   /* version */
@@ -187,7 +228,9 @@ struct snmp_datagram {
   uint32_t user_name_len;
   struct mib_user *user;
   uint8_t auth_err;
-  uint8_t auth_para[SNMP_MSG_AUTH_PARA_LEN];
+  /* MAC verified ahead with its batch */
+  uint8_t auth_done;
+  uint8_t auth_para[SNMP_MSG_AUTH_PARA_MAX_LEN];
   uint32_t auth_para_len;
   uint8_t priv_para[SNMP_MSG_ENCRYPT_PARA_LEN];
   uint32_t priv_para_len;
@@ -203,12 +246,19 @@ struct snmp_datagram {
   uint32_t vb_list_len;
   uint32_t vb_in_cnt;
   uint32_t vb_out_cnt;
-  struct list_head vb_in_list;
-  struct list_head vb_out_list;
+  struct vb_view *vb_in;
+  /* response encoding */
+  uint8_t *out_buf;
+  uint32_t out_size;
+  uint8_t *out_auth_para;
+  /* Response is signed and sent with its batch */
+  uint8_t held;
 };
 
-extern struct snmp_datagram snmp_datagram;
+struct oid_search_res;
+
 extern const uint8_t snmpv3_engine_id[4 + 1 + sizeof("smithsnmp")];
+extern struct arena_stats snmp_arena_stats;
 
 static inline struct var_bind *
 vb_new(uint32_t oid_len, uint32_t val_len)
@@ -241,24 +291,78 @@ uint32_t ber_value_enc_try(const void *value, uint32_t len, uint8_t type);
 uint32_t ber_value_enc(const void *value, uint32_t len, uint8_t type, uint8_t *buf);
 uint32_t ber_length_enc_try(uint32_t value);
 uint32_t ber_length_enc(uint32_t value, uint8_t *buf);
+uint32_t ber_value_enc_rev(const void *value, uint32_t len, uint8_t type, uint8_t *end);
+uint32_t ber_oid_arcs_enc_rev(const oid_t *oid, uint32_t len, uint8_t *end);
+uint32_t ber_length_enc_rev(uint32_t value, uint8_t *end);
 
 uint32_t ber_value_dec_try(const uint8_t *buf, uint32_t len, uint8_t type);
 uint32_t ber_value_dec(const uint8_t *buf, uint32_t len, uint8_t type, void *value);
 uint32_t ber_length_dec_try(const uint8_t *buf);
 uint32_t ber_length_dec(const uint8_t *buf, uint32_t *value);
 
+/* One message of a multi-buffer HMAC */
+struct hmac_job {
+  const unsigned char *data;
+  size_t len;
+  unsigned char *mac;
+  /* Hash states after the pad blocks of the key */
+  const uint32_t *ipad;
+  const uint32_t *opad;
+};
+
 void MD5_key(const unsigned char *password, unsigned int passwordlen, const unsigned char *engineID, unsigned int engineLength, unsigned char *key);
 void SHA1_key(const unsigned char *password, unsigned int passwordlen, const unsigned char *engineID, unsigned int engineLength, unsigned char *key);
 int MD5_hmac(const unsigned char *data, size_t len, unsigned char *mac, size_t maclen, const unsigned char *secret, size_t secretlen);
 int SHA1_hmac(const unsigned char *data, size_t len, unsigned char *mac, size_t maclen, const unsigned char *secret, size_t secretlen);
-void AES_Encrypt(const unsigned char *key, unsigned int keylen, const unsigned char *iv, unsigned int ivlen, const unsigned char *plaintext, unsigned int ptlen, unsigned char *ciphertext, unsigned int *ctlen);
-void AES_Decrypt(const unsigned char *key, unsigned int keylen, const unsigned char *iv, unsigned int ivlen, const unsigned char *ciphertext, unsigned int ctlen, unsigned char *plaintext, unsigned int *ptlen);
+void MD5_hmac_prepare(const unsigned char *secret, size_t secretlen, uint32_t *ipad, uint32_t *opad);
+void SHA1_hmac_prepare(const unsigned char *secret, size_t secretlen, uint32_t *ipad, uint32_t *opad);
+int MD5_hmac_prepared(const unsigned char *data, size_t len, unsigned char *mac, size_t maclen, const uint32_t *ipad, const uint32_t *opad);
+int SHA1_hmac_prepared(const unsigned char *data, size_t len, unsigned char *mac, size_t maclen, const uint32_t *ipad, const uint32_t *opad);
+int MD5_hmac_prepared_mb(const struct hmac_job *jobs, unsigned int n, size_t maclen);
+int SHA1_hmac_prepared_mb(const struct hmac_job *jobs, unsigned int n, size_t maclen);
+void SHA2_key(unsigned int md_len, const unsigned char *password, unsigned int passwordlen, const unsigned char *engineID, unsigned int engineLength, unsigned char *key);
+void SHA2_hmac_prepare(unsigned int md_len, const unsigned char *secret, size_t secretlen, uint32_t *ipad, uint32_t *opad);
+int SHA2_hmac_prepared(unsigned int md_len, const unsigned char *data, size_t len, unsigned char *mac, size_t maclen, const uint32_t *ipad, const uint32_t *opad);
+void AES_Schedule(const unsigned char *key, unsigned int keylen, unsigned char *sched);
+void AES_Encrypt(const unsigned char *sched, const unsigned char *iv, unsigned int ivlen, const unsigned char *plaintext, unsigned int ptlen, unsigned char *ciphertext, unsigned int *ctlen);
+void AES_Decrypt(const unsigned char *sched, const unsigned char *iv, unsigned int ivlen, const unsigned char *ciphertext, unsigned int ctlen, unsigned char *plaintext, unsigned int *ptlen);
+
+/* Decode oid of the request varbind, return number of elements */
+static inline uint32_t
+vb_view_oid(const struct snmp_datagram *sdg, const struct vb_view *vb, oid_t *oid)
+{
+  return ber_value_dec((const uint8_t *)sdg->recv_buf + vb->oid_off, vb->oid_len, ASN1_TAG_OBJID, oid);
+}
+
+/* Decode value of the request varbind, strings point into the receive
+ * buffer and oids are decoded into arena */
+static inline void
+vb_view_value(const struct snmp_datagram *sdg, const struct vb_view *vb, Variable *var)
+{
+  uint8_t *buf = (uint8_t *)sdg->recv_buf + vb->value_off;
+
+  tag(var) = vb->value_type;
+  if (tag(var) == ASN1_TAG_OBJID) {
+    oid(var) = arena_alloc(sdg->arena, ber_value_dec_try(buf, vb->value_len, tag(var)) * sizeof(oid_t));
+  } else if (ASN1_TAG_ARRAY(tag(var))) {
+    var->value.p = buf;
+    length(var) = ber_value_dec_try(buf, vb->value_len, tag(var));
+    return;
+  }
+  length(var) = ber_value_dec(buf, vb->value_len, tag(var), value(var));
+}
 
-void snmp_recv(uint8_t *buf, int len);
+struct snmp_datagram *snmp_datagram_new(void);
+void snmp_datagram_free(struct snmp_datagram *sdg);
+void snmp_recv(struct snmp_datagram *sdg, uint8_t *buf, int len, void *peer);
+void snmp_recv_batch(struct snmp_datagram **sdgs, uint8_t **bufs, const int *lens, void **peers, int n);
+void snmp_msg_hmac_batch(struct mib_user **users, struct hmac_job *jobs, int n, int *ret);
 void snmp_get(struct snmp_datagram *sdg);
 void snmp_getnext(struct snmp_datagram *sdg);
 void snmp_set(struct snmp_datagram *sdg);
 void snmp_bulkget(struct snmp_datagram *sdg);
+void snmp_vb_encode(struct snmp_datagram *sdg, struct oid_search_res *ret_oid, uint8_t type);
 void snmp_response(struct snmp_datagram *sdg);
+void snmp_response_flush(struct snmp_datagram **sdgs, int n);
 
 #endif /* _SNMP_H_ */
@@ -313,26 +313,17 @@ ber_uint_enc(int value, uint8_t *buf)
 }
 
 
-/* Input:  oid pointer, number of elements
+/* Input:  oid arcs behind the first two, number of elements
  * Output: buffer
  * Return: byte length.
  */
 static uint32_t
-ber_oid_enc(const oid_t *oid, uint32_t len, uint8_t *buf)
+ber_oid_arcs_enc(const oid_t *oid, uint32_t len, uint8_t *buf)
 {
   uint32_t i, j;
   uint8_t tmp[10];
 
-  if (len == 0) {
-    return 0;
-  } else if (len == 1) {
-    buf[0] = oid[0];
-    return 1;
-  }
-
-  buf[0] = oid[0] * 40 + oid[1];
-
-  for (j = 1, i = 2; i < len; i++) {
+  for (j = 0, i = 0; i < len; i++) {
     uint32_t k = 0;
     oid_t id = oid[i];
     do {
@@ -348,6 +339,25 @@ ber_oid_enc(const oid_t *oid, uint32_t len, uint8_t *buf)
   return j;
 }
 
+/* Input:  oid pointer, number of elements
+ * Output: buffer
+ * Return: byte length.
+ */
+static uint32_t
+ber_oid_enc(const oid_t *oid, uint32_t len, uint8_t *buf)
+{
+  if (len == 0) {
+    return 0;
+  } else if (len == 1) {
+    buf[0] = oid[0];
+    return 1;
+  }
+
+  buf[0] = oid[0] * 40 + oid[1];
+
+  return 1 + ber_oid_arcs_enc(oid + 2, len - 2, buf + 1);
+}
+
 /* Input:  value pointer, number of elements, value type
  * Output: buffer
  * Return: byte length.
@@ -481,3 +491,150 @@ ber_length_enc(uint32_t value, uint8_t *buf)
 
   return j;
 }
+
+/* Input:  integer value, end of buffer
+ * Output: buffer in front of end
+ * Return: byte length.
+ */
+static uint32_t
+ber_int_enc_rev(int value, uint8_t *end)
+{
+  uint8_t *buf = end;
+
+  do {
+    *--buf = value & 0xff;
+    value >>= 8;
+  } while (value != 0 && value != -1);
+
+  /* Keep the sign bit */
+  if (value == 0 && (*buf & 0x80)) {
+    *--buf = 0x0;
+  } else if (value == -1 && !(*buf & 0x80)) {
+    *--buf = 0xff;
+  }
+
+  return end - buf;
+}
+
+/* Input:  unsigned integer value, end of buffer
+ * Output: buffer in front of end
+ * Return: byte length.
+ */
+static uint32_t
+ber_uint_enc_rev(unsigned int value, uint8_t *end)
+{
+  uint8_t *buf = end;
+
+  do {
+    *--buf = value & 0xff;
+    value >>= 8;
+  } while (value);
+
+  if (*buf & 0x80) {
+    *--buf = 0x0;
+  }
+
+  return end - buf;
+}
+
+/* Input:  oid arcs behind the first two, number of elements, end of buffer
+ * Output: buffer in front of end
+ * Return: byte length.
+ */
+uint32_t
+ber_oid_arcs_enc_rev(const oid_t *oid, uint32_t len, uint8_t *end)
+{
+  uint8_t *buf = end;
+  oid_t id;
+
+  while (len-- > 0) {
+    id = oid[len];
+    *--buf = id & 0x7f;
+    while (id >>= 7) {
+      *--buf = (id & 0x7f) | 0x80;
+    }
+  }
+
+  return end - buf;
+}
+
+/* Input:  oid pointer, number of elements, end of buffer
+ * Output: buffer in front of end
+ * Return: byte length.
+ */
+static uint32_t
+ber_oid_enc_rev(const oid_t *oid, uint32_t len, uint8_t *end)
+{
+  uint32_t ret;
+
+  if (len == 0) {
+    return 0;
+  } else if (len == 1) {
+    end[-1] = oid[0];
+    return 1;
+  }
+
+  ret = ber_oid_arcs_enc_rev(oid + 2, len - 2, end);
+  *(end - ret - 1) = oid[0] * 40 + oid[1];
+
+  return ret + 1;
+}
+
+/* Input:  value pointer, number of elements, value type, end of buffer
+ * Output: buffer in front of end
+ * Return: byte length.
+ */
+uint32_t
+ber_value_enc_rev(const void *value, uint32_t len, uint8_t type, uint8_t *end)
+{
+  uint32_t ret;
+
+  switch (type) {
+    case ASN1_TAG_INT:
+    case ASN1_TAG_CNT:
+      ret = ber_int_enc_rev(*(const int *)value, end);
+      break;
+    case ASN1_TAG_GAU:
+    case ASN1_TAG_TIMETICKS:
+      ret = ber_uint_enc_rev(*(const unsigned int *)value, end);
+      break;
+    case ASN1_TAG_OBJID:
+      ret = ber_oid_enc_rev((const oid_t *)value, len, end);
+      break;
+    case ASN1_TAG_OCTSTR:
+    case ASN1_TAG_IPADDR:
+      memcpy(end - len, value, len);
+      ret = len;
+      break;
+    case ASN1_TAG_SEQ:
+    case ASN1_TAG_NUL:
+    default:
+      ret = 0;
+      break;
+  }
+
+  return ret;
+}
+
+/* Input:  length value, end of buffer
+ * Output: buffer in front of end
+ * Return: byte length.
+ */
+uint32_t
+ber_length_enc_rev(uint32_t value, uint8_t *end)
+{
+  uint8_t *buf = end;
+
+  if (value > 127) {
+    do {
+      *--buf = value & 0xff;
+      value >>= 8;
+    } while (value);
+    buf--;
+    *buf = 0x80 | (end - buf - 1);
+  } else {
+    *--buf = value;
+  }
+
+  return end - buf;
+}
@@ -79,67 +79,62 @@ static struct err_msg_map snmp_err_msg[] = {
   { SNMP_ERR_ENCRYPT_PDU_TAG, "SNMP encrypted PDU tag should be octect string!" },
 };
 
+/* Release everything the request allocated in one step */
 static void
 snmp_datagram_clear(struct snmp_datagram *sdg)
 {
-  vb_list_free(&sdg->vb_in_list);
-  vb_list_free(&sdg->vb_out_list);
+  struct mem_arena *arena = sdg->arena;
+
+  arena_reset(arena);
   memset(sdg, 0, sizeof(*sdg));
-  INIT_LIST_HEAD(&sdg->vb_in_list);
-  INIT_LIST_HEAD(&sdg->vb_out_list);
+  sdg->arena = arena;
 }
 
-/* Alloc buffer for var bind decoding */
-static struct var_bind *
-var_bind_alloc(uint8_t *buf, enum snmp_err_code *err)
+/* Allocate a request context */
+struct snmp_datagram *
+snmp_datagram_new(void)
 {
-  struct var_bind *vb;
-  uint8_t oid_type, val_type;
-  uint32_t oid_len, oid_dec_len, val_len;
-  uint8_t *buf1;
+  struct snmp_datagram *sdg = xcalloc(1, sizeof(*sdg));
+  sdg->arena = arena_new(SNMP_ARENA_SIZE, &snmp_arena_stats);
+  return sdg;
+}
 
-  /* OID */
-  oid_type = *buf++;
-  if (oid_type != ASN1_TAG_OBJID) {
-    *err = SNMP_ERR_VB_OID_TYPE;
-    return NULL;
-  }
-  buf += ber_length_dec(buf, &oid_len);
-  buf1 = buf;
-  buf += oid_len;
+/* Release a request context */
+void
+snmp_datagram_free(struct snmp_datagram *sdg)
+{
+  arena_free(sdg->arena);
+  free(sdg);
+}
 
-  /* OID length decoding, keep from overflow. */
-  oid_dec_len = ber_value_dec_try(buf1, oid_len, ASN1_TAG_OBJID);
-  if (oid_dec_len > ASN1_OID_MAX_LEN) {
-    *err = SNMP_ERR_VB_OID_LEN;
-    return NULL;
-  }
+/* Point a varbind view at its oid and value in the receive buffer */
+static SNMP_ERR_CODE_E
+var_bind_view(struct snmp_datagram *sdg, uint8_t *buf, struct vb_view *vb)
+{
+  const uint8_t *base = sdg->recv_buf;
 
-  /* Value */
-  val_type = *buf++;
-  buf += ber_length_dec(buf, &val_len);
-  if (val_len > ASN1_VALUE_MAX_LEN) {
-    *err = SNMP_ERR_VB_VALUE_LEN;
-    return NULL;
+  /* OID */
+  if (*buf++ != ASN1_TAG_OBJID) {
+    return SNMP_ERR_VB_OID_TYPE;
   }
+  buf += ber_length_dec(buf, &vb->oid_len);
+  vb->oid_off = buf - base;
 
-  /* Varbind allocation */
-  vb = vb_new(oid_dec_len, val_len);
-  if (vb == NULL) {
-    *err = SNMP_ERR_VB_VAR;
-    return NULL;
+  /* OID length checking, keep from overflow. Decoded when processed. */
+  if (ber_value_dec_try(buf, vb->oid_len, ASN1_TAG_OBJID) > ASN1_OID_MAX_LEN) {
+    return SNMP_ERR_VB_OID_LEN;
   }
-
-  /* vb->oid_len is the actual length of oid */
-  vb->oid_len = ber_value_dec(buf1, oid_len, ASN1_TAG_OBJID, vb->oid);
+  buf += vb->oid_len;
 
   /* Value */
-  vb->value_type = val_type;
-  vb->value_len = val_len;
-  memcpy(vb->value, buf, val_len);
+  vb->value_type = *buf++;
+  buf += ber_length_dec(buf, &vb->value_len);
+  if (vb->value_len > ASN1_VALUE_MAX_LEN) {
+    return SNMP_ERR_VB_VALUE_LEN;
+  }
+  vb->value_off = buf - base;
 
-  *err = SNMP_ERR_OK;
-  return vb;
+  return SNMP_ERR_OK;
 }
 
 /* Parse PDU header */
@@ -193,10 +188,8 @@ static SNMP_ERR_CODE_E
 var_bind_parse(struct snmp_datagram *sdg, uint8_t **buffer)
 {
   SNMP_ERR_CODE_E err;
-  struct var_bind *vb;
-  uint8_t *buf;
-  uint32_t vb_len, len_len;
-  const uint32_t tag_len = 1;
+  uint8_t *buf, *end;
+  uint32_t vb_len, cnt;
 
   err = SNMP_ERR_OK;
   buf = *buffer;
@@ -207,28 +200,38 @@ var_bind_parse(struct snmp_datagram *sdg, uint8_t **buffer)
     return err;
   }
   buf += ber_length_dec(buf, &sdg->vb_list_len);
+  end = buf + sdg->vb_list_len;
+
+  /* Count varbinds to size the views at once */
+  for (cnt = 0, *buffer = buf; buf < end; cnt++) {
+    buf++;
+    buf += ber_length_dec(buf, &vb_len);
+    buf += vb_len;
+  }
+  sdg->vb_in = arena_alloc(sdg->arena, (cnt ? cnt : 1) * sizeof(struct vb_view));
 
-  while (sdg->vb_list_len > 0) {
+  buf = *buffer;
+  while (buf < end) {
     /* check vb_list type */
     if (*buf++ != ASN1_TAG_SEQ) {
       err = SNMP_ERR_VB_SEQ;
       break;
     }
-    len_len = ber_length_dec(buf, &vb_len);
-    buf += len_len;
+    buf += ber_length_dec(buf, &vb_len);
 
-    /* Alloc a new var_bind and add into var_bind list. */
-    vb = var_bind_alloc(buf, &err);
-    if (vb == NULL) {
+    /* Oid and value stay in the receive buffer */
+    err = var_bind_view(sdg, buf, &sdg->vb_in[sdg->vb_in_cnt]);
+    if (err) {
       break;
     }
-    list_add_tail(&vb->link, &sdg->vb_in_list);
     sdg->vb_in_cnt++;
 
     buf += vb_len;
-    sdg->vb_list_len -= tag_len + len_len + vb_len;
   }
 
+  /* Reused as the varbind list length of response */
+  sdg->vb_list_len = 0;
+
   *buffer = buf;
   return err;
 }
@@ -357,7 +360,7 @@ security_parameter_decode(struct snmp_datagram *sdg, uint8_t **buffer)
     return err;
   }
   buf += ber_length_dec(buf, &sdg->auth_para_len);
-  if (sdg->auth_para_len && sdg->auth_para_len != SNMP_MSG_AUTH_PARA_LEN) {
+  if (sdg->auth_para_len > SNMP_MSG_AUTH_PARA_MAX_LEN) {
     err = SNMP_ERR_SECURITY_AUTH_PARA_LEN;
     return err;
   }
@@ -384,30 +387,100 @@ security_parameter_decode(struct snmp_datagram *sdg, uint8_t **buffer)
 }
 
 #ifndef DISABLE_CRYPTO
-/* Message authentication */
-static void
-snmp_msg_authen(struct snmp_datagram *sdg)
+/* HMAC of messages with the keys of their users, at most SNMP_BATCH_MAX.
+ * MD5 and SHA-1 messages are hashed together in vector lanes. ret[i] is
+ * zero when the mac of jobs[i] has been made. */
+void
+snmp_msg_hmac_batch(struct mib_user **users, struct hmac_job *jobs, int n, int *ret)
 {
-  int ret = 1;
-  uint8_t mac[SHA1_SECRETKEYLEN] = { 0 };
-  const uint8_t *whole_msg = sdg->recv_buf;
-  struct mib_user *user = sdg->user;
-  const uint8_t *secret = user->auth_key.md5;
+#ifndef DISABLE_MD5
+  struct hmac_job md5_jobs[SNMP_BATCH_MAX];
+  int md5_idx[SNMP_BATCH_MAX], md5_cnt = 0;
+#endif
+#ifndef DISABLE_SHA
+  struct hmac_job sha1_jobs[SNMP_BATCH_MAX];
+  int sha1_idx[SNMP_BATCH_MAX], sha1_cnt = 0;
+#endif
+  int i, err;
 
-  if (user->auth_mode == SNMP_USER_AUTH_MD5) {
+  for (i = 0; i < n; i++) {
+    struct mib_user *user = users[i];
+
+    jobs[i].ipad = user->auth_ipad;
+    jobs[i].opad = user->auth_opad;
+    ret[i] = 1;
+    if (user->auth_mode == SNMP_USER_AUTH_MD5) {
 #ifndef DISABLE_MD5
-    ret = MD5_hmac(whole_msg, sdg->recv_len, mac, MD5_SECRETKEYLEN, secret, sizeof(user->auth_key.md5));
+      md5_idx[md5_cnt] = i;
+      md5_jobs[md5_cnt++] = jobs[i];
+#endif
+    } else if (user->auth_mode == SNMP_USER_AUTH_SHA1) {
+#ifndef DISABLE_SHA
+      sha1_idx[sha1_cnt] = i;
+      sha1_jobs[sha1_cnt++] = jobs[i];
 #endif
-  } else if (user->auth_mode == SNMP_USER_AUTH_SHA1) {
+    } else if (user->auth_mode >= SNMP_USER_AUTH_SHA224 && user->auth_mode <= SNMP_USER_AUTH_SHA512) {
 #ifndef DISABLE_SHA
-    ret = SHA1_hmac(whole_msg, sdg->recv_len, mac, SHA1_SECRETKEYLEN, secret, sizeof(user->auth_key.sha1));
+      ret[i] = SHA2_hmac_prepared(user->auth_key_len, jobs[i].data, jobs[i].len, jobs[i].mac, user->auth_mac_len, jobs[i].ipad, jobs[i].opad);
 #endif
+    }
   }
 
-  if (ret) {
-    sdg->auth_err = SNMP_ERR_STAT_GEN_ERR;
-  } else {
-    if (memcmp(mac, sdg->auth_para, sdg->auth_para_len)) {
+#ifndef DISABLE_MD5
+  if (md5_cnt > 0) {
+    err = MD5_hmac_prepared_mb(md5_jobs, md5_cnt, SNMP_MSG_AUTH_PARA_LEN);
+    for (i = 0; i < md5_cnt; i++) {
+      ret[md5_idx[i]] = err;
+    }
+  }
+#endif
+#ifndef DISABLE_SHA
+  if (sha1_cnt > 0) {
+    err = SHA1_hmac_prepared_mb(sha1_jobs, sha1_cnt, SNMP_MSG_AUTH_PARA_LEN);
+    for (i = 0; i < sha1_cnt; i++) {
+      ret[sha1_idx[i]] = err;
+    }
+  }
+#endif
+  (void)err;
+}
+
+/* Message authentication of datagrams whose users are known, the MACs
+ * are verified together */
+static void
+snmp_msg_authen(struct snmp_datagram **sdgs, int n)
+{
+  struct snmp_datagram *sdg, *auth[SNMP_BATCH_MAX];
+  struct mib_user *users[SNMP_BATCH_MAX];
+  struct hmac_job jobs[SNMP_BATCH_MAX];
+  uint8_t macs[SNMP_BATCH_MAX][SHA512_SECRETKEYLEN];
+  int i, cnt, ret[SNMP_BATCH_MAX];
+
+  for (i = cnt = 0; i < n; i++) {
+    sdg = sdgs[i];
+    sdg->auth_done = 1;
+
+    /* MAC length is given by auth mode of the user */
+    if (sdg->auth_para_len != sdg->user->auth_mac_len) {
+      sdg->auth_err = SNMP_ERR_STAT_AUTHORIZATION;
+      continue;
+    }
+
+    auth[cnt] = sdg;
+    users[cnt] = sdg->user;
+    jobs[cnt].data = sdg->recv_buf;
+    jobs[cnt].len = sdg->recv_len;
+    jobs[cnt].mac = macs[cnt];
+    cnt++;
+  }
+
+  snmp_msg_hmac_batch(users, jobs, cnt, ret);
+
+  for (i = 0; i < cnt; i++) {
+    sdg = auth[i];
+    if (ret[i]) {
+      sdg->auth_err = SNMP_ERR_STAT_GEN_ERR;
+    } else if (memcmp(macs[i], sdg->auth_para, sdg->auth_para_len)) {
       sdg->auth_err = SNMP_ERR_STAT_AUTHORIZATION;
     }
   }
@@ -432,15 +505,16 @@ snmp_msg_decrypt(struct snmp_datagram *sdg, uint8_t *cipher, uint32_t clen, uint
     memcpy(iv, &boots, sizeof(uint32_t));
     memcpy(iv + sizeof(uint32_t), &time, sizeof(uint32_t));
     memcpy(iv + 2 * sizeof(uint32_t), salt, sdg->priv_para_len);
-    AES_Decrypt(user->priv_key.aes, sizeof(user->priv_key.aes), iv, iv_len, cipher, clen, plain, plen);
+    AES_Decrypt(user->priv_sched, iv, iv_len, cipher, clen, plain, plen);
   }
 #endif
 }
 #endif
 
-/* Decode snmp datagram */
-static void
-snmp_decode(struct snmp_datagram *sdg)
+/* Decode snmp datagram up to the user security model, return where the
+ * scoped PDU starts or NULL on failure */
+static uint8_t *
+snmp_decode_head(struct snmp_datagram *sdg)
 {
   SNMP_ERR_CODE_E err;
   uint8_t *buf, dec_fail = 0;
@@ -448,13 +522,13 @@ snmp_decode(struct snmp_datagram *sdg)
 
   /* Skip tag and length */
   buf = sdg->recv_buf + tag_len;
-  buf += ber_length_dec(buf, &snmp_datagram.data_len);
+  buf += ber_length_dec(buf, &sdg->data_len);
 
   /* Version */
   if (*buf++ != ASN1_TAG_INT) {
     SMARTSNMP_LOG(L_ERROR, "ERR(%d): %s\n", SNMP_ERR_VERSION, error_message(snmp_err_msg, elem_num(snmp_err_msg), SNMP_ERR_VERSION));
     dec_fail = 1;
-    goto DECODE_FINISH;
+    goto HEAD_FINISH;
   }
   buf += ber_length_dec(buf, &sdg->ver_len);
   ber_value_dec(buf, sdg->ver_len, ASN1_TAG_INT, &sdg->version);
@@ -466,7 +540,7 @@ snmp_decode(struct snmp_datagram *sdg)
     if (*buf++ != ASN1_TAG_SEQ) {
       SMARTSNMP_LOG(L_ERROR, "ERR(%d): %s\n", SNMP_ERR_GLOBAL_DATA_LEN, error_message(snmp_err_msg, elem_num(snmp_err_msg), SNMP_ERR_GLOBAL_DATA_LEN));
       dec_fail = 1;
-      goto DECODE_FINISH;
+      goto HEAD_FINISH;
     }
     buf += ber_length_dec(buf, &sdg->msg_len);
  
@@ -475,7 +549,7 @@ snmp_decode(struct snmp_datagram *sdg)
     if (err) { 
       SMARTSNMP_LOG(L_ERROR, "ERR(%d): %s\n", err, error_message(snmp_err_msg, elem_num(snmp_err_msg), err));
       dec_fail = 1;
-      goto DECODE_FINISH;
+      goto HEAD_FINISH;
     }
 
     /* Security parameter */
@@ -483,16 +557,38 @@ snmp_decode(struct snmp_datagram *sdg)
     if (err) { 
       SMARTSNMP_LOG(L_ERROR, "ERR(%d): %s\n", err, error_message(snmp_err_msg, elem_num(snmp_err_msg), err));
       dec_fail = 1;
-      goto DECODE_FINISH;
+      goto HEAD_FINISH;
     }
 
     /* User security model */
     sdg->user = mib_user_search(sdg->user_name);
+  }
+
+HEAD_FINISH:
+  /* If fail, do some clear things */
+  if (dec_fail) {
+    snmp_datagram_clear(sdg);
+    return NULL;
+  }
+  return buf;
+}
+
+/* Decode the scoped PDU of snmp datagram */
+static void
+snmp_decode_body(struct snmp_datagram *sdg, uint8_t *buf)
+{
+  SNMP_ERR_CODE_E err;
+  uint8_t dec_fail = 0;
+
+  /* SNMPv3 */
+  if (sdg->version >= 3) {
 #ifndef DISABLE_CRYPTO
     if (sdg->msg_flags & SNMP_SECUR_FLAG_AUTH) {
       if (sdg->user != NULL) {
-        /* Message authentication */
-        snmp_msg_authen(sdg);
+        /* Message authentication, unless done with its batch */
+        if (!sdg->auth_done) {
+          snmp_msg_authen(&sdg, 1);
+        }
         if (sdg->auth_err) {
           SMARTSNMP_LOG(L_ERROR, "ERR(%d): %s\n", SNMP_ERR_AUTH_FAIL, error_message(snmp_err_msg, elem_num(snmp_err_msg), SNMP_ERR_AUTH_FAIL));
         } else {
@@ -506,10 +602,9 @@ snmp_decode(struct snmp_datagram *sdg)
               goto DECODE_FINISH;
             }
             cipher += ber_length_dec(cipher, &sdg->scope_len);
-            uint8_t *cipher1 = malloc(sdg->scope_len);
+            uint8_t *cipher1 = arena_alloc(sdg->arena, sdg->scope_len);
             memcpy(cipher1, cipher, sdg->scope_len);
             snmp_msg_decrypt(sdg, cipher1, sdg->scope_len, buf, &sdg->scope_len);
-            free(cipher1);
           }
         }
       } else {
@@ -574,9 +669,6 @@ snmp_decode(struct snmp_datagram *sdg)
   }
 
 DECODE_FINISH:
-  /* We should free received buffer here */
-  free(snmp_datagram.recv_buf);
-
   /* If fail, do some clear things */
   if (dec_fail) {
     snmp_datagram_clear(sdg);
@@ -619,38 +711,107 @@ snmp_request_dispatch(struct snmp_datagram *sdg)
   }
 }
 
-/* Receive snmp datagram from transport module */
-void
-snmp_recv(uint8_t *buffer, int len)
+/* Check tag and length of the datagram and bind it to sdg */
+static int
+snmp_recv_bind(struct snmp_datagram *sdg, uint8_t *buffer, int len, void *peer)
 {
-  uint32_t len_len;
+  uint32_t len_len, data_len;
   const uint32_t tag_len = 1;
 
-  assert(buffer != NULL && len > 0);
+  assert(sdg != NULL && buffer != NULL && len > 0);
 
   /* Check PDU tag */
   if (buffer[0] != ASN1_TAG_SEQ) {
     SMARTSNMP_LOG(L_ERROR, "ERR(%d): %s\n", SNMP_ERR_PDU_TYPE, error_message(snmp_err_msg, elem_num(snmp_err_msg), SNMP_ERR_PDU_TYPE));
-    free(buffer);
-    return;
+    return 0;
   }
 
   /* Check PDU length */
-  len_len = ber_length_dec(buffer + tag_len, &snmp_datagram.data_len);
-  if (tag_len + len_len + snmp_datagram.data_len != len) {
+  len_len = ber_length_dec(buffer + tag_len, &data_len);
+  if (tag_len + len_len + data_len != len) {
     SMARTSNMP_LOG(L_ERROR, "ERR(%d): %s\n", SNMP_ERR_PDU_LEN, error_message(snmp_err_msg, elem_num(snmp_err_msg), SNMP_ERR_PDU_LEN));
-    free(buffer);
-    return;
+    return 0;
   }
 
-  /* Reset datagram */
-  snmp_datagram_clear(&snmp_datagram);
-  snmp_datagram.recv_buf = buffer;
-  snmp_datagram.recv_len = len;
+  sdg->recv_buf = buffer;
+  sdg->recv_len = len;
+  sdg->peer = peer;
+  return 1;
+}
+
+/* Receive snmp datagram from transport module, the buffer is owned by the
+ * transport and only valid until this function returns */
+void
+snmp_recv(struct snmp_datagram *sdg, uint8_t *buffer, int len, void *peer)
+{
+  uint8_t *scope;
+
+  if (!snmp_recv_bind(sdg, buffer, len, peer)) {
+    return;
+  }
 
   /* Decode snmp datagram */
-  snmp_decode(&snmp_datagram);
+  scope = snmp_decode_head(sdg);
+  if (scope != NULL) {
+    snmp_decode_body(sdg, scope);
+
+    /* Dispatch request */
+    snmp_request_dispatch(sdg);
+  }
+
+  /* The response has been handed to transport, reset datagram */
+  snmp_datagram_clear(sdg);
+}
+
+/* Receive at most SNMP_BATCH_MAX datagrams together, each with its own
+ * context. Requests are still processed in order, but the MACs of all
+ * requests are verified before and all responses are signed and handed
+ * to transport after, so that HMACs of the batch run in vector lanes. */
+void
+snmp_recv_batch(struct snmp_datagram **sdgs, uint8_t **bufs, const int *lens, void **peers, int n)
+{
+#ifndef DISABLE_CRYPTO
+  struct snmp_datagram *auth[SNMP_BATCH_MAX];
+  int cnt = 0;
+#endif
+  uint8_t *scope[SNMP_BATCH_MAX];
+  int i;
+
+  assert(n <= SNMP_BATCH_MAX);
+
+  /* Message headers and users */
+  for (i = 0; i < n; i++) {
+    struct snmp_datagram *sdg = sdgs[i];
 
-  /* Dispatch request */
-  snmp_request_dispatch(&snmp_datagram);
+    scope[i] = NULL;
+    if (snmp_recv_bind(sdg, bufs[i], lens[i], peers[i])) {
+      scope[i] = snmp_decode_head(sdg);
+    }
+#ifndef DISABLE_CRYPTO
+    if (scope[i] != NULL && sdg->version >= 3 &&
+        (sdg->msg_flags & SNMP_SECUR_FLAG_AUTH) && sdg->user != NULL) {
+      auth[cnt++] = sdg;
+    }
+#endif
+  }
+
+#ifndef DISABLE_CRYPTO
+  /* Message authentication of the batch */
+  snmp_msg_authen(auth, cnt);
+#endif
+
+  /* Requests in order, responses are held back */
+  for (i = 0; i < n; i++) {
+    if (scope[i] != NULL) {
+      sdgs[i]->held = 1;
+      snmp_decode_body(sdgs[i], scope[i]);
+      snmp_request_dispatch(sdgs[i]);
+    }
+  }
+
+  snmp_response_flush(sdgs, n);
+
+  for (i = 0; i < n; i++) {
+    snmp_datagram_clear(sdgs[i]);
+  }
 }
@@ -29,273 +29,126 @@
 #include "snmp.h"
 #include "protocol.h"
 
-static uint8_t *snmp_msg_auth_para;
-static uint8_t *snmp_msg_priv_para;
-static uint32_t snmp_scope_pdu_len;
-
-static uint32_t
-global_data_encode_try(struct snmp_datagram *sdg)
-{
-  const uint32_t tag_len = 1;
-  uint32_t len_len, msg_len;
- 
-  len_len = ber_length_enc_try(sdg->msg_id_len);
-  msg_len = tag_len + len_len + sdg->msg_id_len;
-
-  len_len = ber_length_enc_try(sdg->msg_size_len);
-  msg_len += tag_len + len_len + sdg->msg_size_len;
- 
-  len_len = ber_length_enc_try(sdg->msg_flags_len);
-  msg_len += tag_len + len_len + sdg->msg_flags_len;
- 
-  len_len = ber_length_enc_try(sdg->msg_model_len);
-  msg_len += tag_len + len_len + sdg->msg_model_len;
-
-  return msg_len;
-}
-
+/* Encode a primitive TLV backward in front of buf */
 static uint8_t *
-global_data_encode(struct snmp_datagram *sdg, uint8_t *buf)
+tlv_encode(uint8_t *buf, uint8_t type, const void *value, uint32_t len)
 {
-  /* Global data sequence */
-  *buf++ = ASN1_TAG_SEQ;
-  buf += ber_length_enc(sdg->msg_len, buf);
-
-  /* Messege ID */
-  *buf++ = ASN1_TAG_INT;
-  buf += ber_length_enc(sdg->msg_id_len, buf);
-  buf += ber_value_enc(&sdg->msg_id, 1, ASN1_TAG_INT, buf);
-
-  /* Messege max size */
-  *buf++ = ASN1_TAG_INT;
-  buf += ber_length_enc(sdg->msg_size_len, buf);
-  buf += ber_value_enc(&sdg->msg_max_size, 1, ASN1_TAG_INT, buf);
+  uint32_t val_len;
 
-  /* Messege flags */
-  *buf++ = ASN1_TAG_OCTSTR;
-  buf += ber_length_enc(sdg->msg_flags_len, buf);
-  buf += ber_value_enc(&sdg->msg_flags, sdg->msg_flags_len, ASN1_TAG_OCTSTR, buf);
-
-  /* Messege security model */
-  *buf++ = ASN1_TAG_INT;
-  buf += ber_length_enc(sdg->msg_model_len, buf);
-  buf += ber_value_enc(&sdg->msg_security_model, 1, ASN1_TAG_INT, buf);
+  val_len = ber_value_enc_rev(value, len, type, buf);
+  buf -= val_len;
+  buf -= ber_length_enc_rev(val_len, buf);
+  *--buf = type;
 
   return buf;
 }
 
-static uint32_t
-security_parameter_encode_try(struct snmp_datagram *sdg)
+/* Encode tag and length of a constructed TLV in front of its content */
+static uint8_t *
+hdr_encode(uint8_t *buf, uint8_t type, uint32_t len)
 {
-  const uint32_t tag_len = 1;
-  uint32_t len_len, secur_para_len;
+  buf -= ber_length_enc_rev(len, buf);
+  *--buf = type;
 
-  sdg->engine_id_len = sizeof(snmpv3_engine_id);
-  len_len = ber_length_enc_try(sdg->engine_id_len);
-  secur_para_len = tag_len + len_len + sdg->engine_id_len;
+  return buf;
+}
 
-  len_len = ber_length_enc_try(sdg->engine_boots_len);
-  secur_para_len += tag_len + len_len + sdg->engine_boots_len;
+static uint8_t *
+global_data_encode(struct snmp_datagram *sdg, uint8_t *buf)
+{
+  uint8_t *end = buf;
 
-  len_len = ber_length_enc_try(sdg->engine_time_len);
-  secur_para_len += tag_len + len_len + sdg->engine_time_len;
+  /* Messege security model */
+  buf = tlv_encode(buf, ASN1_TAG_INT, &sdg->msg_security_model, 1);
 
-  len_len = ber_length_enc_try(sdg->user_name_len);
-  secur_para_len += tag_len + len_len + sdg->user_name_len;
+  /* Messege flags */
+  buf = tlv_encode(buf, ASN1_TAG_OCTSTR, &sdg->msg_flags, sizeof(sdg->msg_flags));
 
-  len_len = ber_length_enc_try(sdg->auth_para_len);
-  secur_para_len += tag_len + len_len + sdg->auth_para_len;
+  /* Messege max size */
+  buf = tlv_encode(buf, ASN1_TAG_INT, &sdg->msg_max_size, 1);
 
-  len_len = ber_length_enc_try(sdg->priv_para_len);
-  secur_para_len += tag_len + len_len + sdg->priv_para_len;
+  /* Messege ID */
+  buf = tlv_encode(buf, ASN1_TAG_INT, &sdg->msg_id, 1);
 
-  return secur_para_len;
+  /* Global data sequence */
+  return hdr_encode(buf, ASN1_TAG_SEQ, end - buf);
 }
 
 static uint8_t *
 security_parameter_encode(struct snmp_datagram *sdg, uint8_t *buf)
 {
-  /* Security parameter sequence */
-  *buf++ = ASN1_TAG_SEQ;
-  buf += ber_length_enc(sdg->secur_para_len, buf);
-
-  /* Engine ID */
-  *buf++ = ASN1_TAG_OCTSTR;
-  buf += ber_length_enc(sdg->engine_id_len, buf);
-  buf += ber_value_enc(snmpv3_engine_id, sdg->engine_id_len, ASN1_TAG_OCTSTR, buf);
+  uint8_t *end = buf;
 
-  /* Engine boots */
-  *buf++ = ASN1_TAG_INT;
-  buf += ber_length_enc(sdg->engine_boots_len, buf);
-  buf += ber_value_enc(&sdg->engine_boots, 1, ASN1_TAG_INT, buf);
+  /* Privative parameter */
+  buf = tlv_encode(buf, ASN1_TAG_OCTSTR, sdg->priv_para, sdg->priv_para_len);
 
-  /* Engine time */
-  *buf++ = ASN1_TAG_INT;
-  buf += ber_length_enc(sdg->engine_time_len, buf);
-  buf += ber_value_enc(&sdg->engine_time, 1, ASN1_TAG_INT, buf);
+  /* Authentication parameter */
+  sdg->out_auth_para = buf - sdg->auth_para_len;
+  buf = tlv_encode(buf, ASN1_TAG_OCTSTR, sdg->auth_para, sdg->auth_para_len);
 
   /* User name */
-  *buf++ = ASN1_TAG_OCTSTR;
-  buf += ber_length_enc(sdg->user_name_len, buf);
-  buf += ber_value_enc(&sdg->user_name, sdg->user_name_len, ASN1_TAG_OCTSTR, buf);
+  buf = tlv_encode(buf, ASN1_TAG_OCTSTR, sdg->user_name, sdg->user_name_len);
 
-  /* Authentication parameter */
-  *buf++ = ASN1_TAG_OCTSTR;
-  buf += ber_length_enc(sdg->auth_para_len, buf);
-  snmp_msg_auth_para = buf;
-  buf += ber_value_enc(&sdg->auth_para, sdg->auth_para_len, ASN1_TAG_OCTSTR, buf);
+  /* Engine time */
+  buf = tlv_encode(buf, ASN1_TAG_INT, &sdg->engine_time, 1);
 
-  /* Privative parameter */
-  *buf++ = ASN1_TAG_OCTSTR;
-  buf += ber_length_enc(sdg->priv_para_len, buf);
-  snmp_msg_priv_para = buf;
-  buf += ber_value_enc(&sdg->priv_para, sdg->priv_para_len, ASN1_TAG_OCTSTR, buf);
+  /* Engine boots */
+  buf = tlv_encode(buf, ASN1_TAG_INT, &sdg->engine_boots, 1);
 
-  return buf; 
+  /* Engine ID */
+  buf = tlv_encode(buf, ASN1_TAG_OCTSTR, snmpv3_engine_id, sizeof(snmpv3_engine_id));
+
+  /* Security parameter sequence */
+  return hdr_encode(buf, ASN1_TAG_SEQ, end - buf);
 }
 
+/* Encode scoped PDU in front of the varbind list */
 static uint8_t *
-asn1_encode(struct snmp_datagram *sdg)
+scope_encode(struct snmp_datagram *sdg, uint8_t *buf)
 {
   struct pdu_hdr *ph;
-  uint8_t *buf;
-  const uint32_t tag_len = 1;
-  uint32_t len_len;
+  uint8_t *end = buf + sdg->vb_list_len;
 
   ph = &sdg->pdu_hdr;
-  sdg->data_len = 0;
-
-  len_len = ber_length_enc_try(sdg->vb_list_len);
-  ph->pdu_len = tag_len + len_len + sdg->vb_list_len;
-
-  len_len = ber_length_enc_try(ph->req_id_len);
-  ph->pdu_len += tag_len + len_len + ph->req_id_len;
-
-  len_len = ber_length_enc_try(ph->err_stat_len);
-  ph->pdu_len += tag_len + len_len + ph->err_stat_len;
-
-  len_len = ber_length_enc_try(ph->err_idx_len);
-  ph->pdu_len += tag_len + len_len + ph->err_idx_len;
-
-  len_len = ber_length_enc_try(ph->pdu_len);
-  sdg->scope_len = tag_len + len_len + ph->pdu_len;
-
-  len_len = ber_length_enc_try(sdg->context_name_len);
-  sdg->scope_len += tag_len + len_len + sdg->context_name_len;
-
-  if (sdg->version >= 3) {
-    /* SNMPv3 */
-    sdg->context_id_len = sizeof(snmpv3_engine_id);
-    len_len = ber_length_enc_try(sdg->context_id_len);
-    sdg->scope_len += tag_len + len_len + sdg->context_id_len;
-
-    sdg->secur_para_len = security_parameter_encode_try(sdg);
-
-    len_len = ber_length_enc_try(sdg->secur_para_len);
-    sdg->secur_str_len = tag_len + len_len + sdg->secur_para_len;
-
-    sdg->msg_len = global_data_encode_try(sdg);
-
-    len_len = ber_length_enc_try(sdg->msg_len);
-    sdg->data_len += tag_len + len_len + sdg->msg_len;
-
-    len_len = ber_length_enc_try(sdg->secur_str_len);
-    sdg->data_len += tag_len + len_len + sdg->secur_str_len;
-
-    len_len = ber_length_enc_try(sdg->scope_len);
-    sdg->data_len += tag_len + len_len;
-    snmp_scope_pdu_len = tag_len + len_len + sdg->scope_len;
 
-    if (sdg->msg_flags & SNMP_SECUR_FLAG_ENCRYPT) {
-      len_len = ber_length_enc_try(snmp_scope_pdu_len);
-      sdg->data_len += tag_len + len_len;
-    }
-  }
-
-  sdg->data_len += sdg->scope_len;
+  /* Varbind list */
+  buf = hdr_encode(buf, ASN1_TAG_SEQ, sdg->vb_list_len);
 
-  len_len = ber_length_enc_try(sdg->ver_len);
-  sdg->data_len += tag_len + len_len + sdg->ver_len;
+  /* Error index */
+  buf = tlv_encode(buf, ASN1_TAG_INT, &ph->err_idx, 1);
 
-  len_len = ber_length_enc_try(sdg->data_len);
-  sdg->send_buf = xmalloc(tag_len + len_len + sdg->data_len);
+  /* Error status */
+  buf = tlv_encode(buf, ASN1_TAG_INT, &ph->err_stat, 1);
 
-  buf = sdg->send_buf;
+  /* Request ID */
+  buf = tlv_encode(buf, ASN1_TAG_INT, &ph->req_id, 1);
 
-  /* Datagram sequence */
-  *buf++ = ASN1_TAG_SEQ;
-  buf += ber_length_enc(sdg->data_len, buf);
+  /* PDU header */
+  buf = hdr_encode(buf, ph->pdu_type, end - buf);
 
-  /* Version */
-  *buf++ = ASN1_TAG_INT;
-  buf += ber_length_enc(sdg->ver_len, buf);
-  buf += ber_value_enc(&sdg->version, 1, ASN1_TAG_INT, buf);
+  /* Context_name */
+  buf = tlv_encode(buf, ASN1_TAG_OCTSTR, sdg->context_name, sdg->context_name_len);
 
   if (sdg->version >= 3) {
-    /* Global data */
-    buf = global_data_encode(sdg, buf);
-
-    /* Security string */
-    *buf++ = ASN1_TAG_OCTSTR;
-    buf += ber_length_enc(sdg->secur_str_len, buf);
-
-    /* Security parameter */
-    buf = security_parameter_encode(sdg, buf);
+    /* Context ID */
+    buf = tlv_encode(buf, ASN1_TAG_OCTSTR, snmpv3_engine_id, sizeof(snmpv3_engine_id));
 
     /* Context sequence */
-    *buf++ = ASN1_TAG_SEQ;
-    buf += ber_length_enc(sdg->scope_len, buf);
-
-    /* Context ID */
-    *buf++ = ASN1_TAG_OCTSTR;
-    buf += ber_length_enc(sizeof(snmpv3_engine_id), buf);
-    buf += ber_value_enc(snmpv3_engine_id, sizeof(snmpv3_engine_id), ASN1_TAG_OCTSTR, buf);
+    buf = hdr_encode(buf, ASN1_TAG_SEQ, end - buf);
   }
 
-  /* Context_name */
-  *buf++ = ASN1_TAG_OCTSTR;
-  buf += ber_length_enc(sdg->context_name_len, buf);
-  buf += ber_value_enc(sdg->context_name, sdg->context_name_len, ASN1_TAG_OCTSTR, buf);
-
-  /* PDU header */
-  *buf++ = ph->pdu_type;
-  buf += ber_length_enc(ph->pdu_len, buf);
-
-  /* Request ID */
-  *buf++ = ASN1_TAG_INT;
-  buf += ber_length_enc(ph->req_id_len, buf);
-  buf += ber_value_enc(&ph->req_id, 1, ASN1_TAG_INT, buf);
-
-  /* Error status */
-  *buf++ = ASN1_TAG_INT;
-  buf += ber_length_enc(ph->err_stat_len, buf);
-  buf += ber_value_enc(&ph->err_stat, 1, ASN1_TAG_INT, buf);
-
-  /* Error index */
-  *buf++ = ASN1_TAG_INT;
-  buf += ber_length_enc(ph->err_idx_len, buf);
-  buf += ber_value_enc(&ph->err_idx, 1, ASN1_TAG_INT, buf);
-
-  /* Varbind list */
-  *buf++ = ASN1_TAG_SEQ;
-  buf += ber_length_enc(sdg->vb_list_len, buf);
-
   return buf;
 }
 
 #ifndef DISABLE_CRYPTO
 /* Message encryption */
-static void
-snmp_msg_encrypt(struct snmp_datagram *sdg)
+static uint8_t *
+snmp_msg_encrypt(struct snmp_datagram *sdg, uint8_t *plain, uint32_t plen)
 {
 #ifndef DISABLE_AES
   int i1, i2;
   uint32_t boots, time;
   uint8_t iv[AES_SECRETKEYLEN], iv_len;
-  uint8_t *salt = snmp_msg_priv_para;
-  uint8_t *plain = snmp_msg_priv_para + sdg->priv_para_len;
-  uint32_t plen = snmp_scope_pdu_len;
-  uint8_t *cipher = NULL;
   uint32_t clen = plen;
   struct mib_user *user = sdg->user;
 
@@ -310,99 +163,201 @@ snmp_msg_encrypt(struct snmp_datagram *sdg)
     memcpy(iv + sizeof(uint32_t), &time, sizeof(uint32_t));
     memcpy(iv + 2 * sizeof(int), &i1, sizeof(int));
     memcpy(iv + 3 * sizeof(int), &i2, sizeof(int));
-    cipher = malloc(snmp_scope_pdu_len);
-    AES_Encrypt(user->priv_key.aes, sizeof(user->priv_key.aes), iv, iv_len, plain, plen, cipher, &clen);
-    memcpy(salt, iv + 2 * sizeof(int), sdg->priv_para_len);
+    AES_Encrypt(user->priv_sched, iv, iv_len, plain, plen, plain, &clen);
+    /* Salt goes into privacy parameter */
+    memcpy(sdg->priv_para, iv + 2 * sizeof(int), sdg->priv_para_len);
   }
 
   /* Build cipher text tag */
-  *plain++ = ASN1_TAG_OCTSTR;
-  plain += ber_length_enc(clen, plain);
-  plain += ber_value_enc(cipher, clen, ASN1_TAG_OCTSTR, plain);
-
-  if (cipher != NULL) {
-    free(cipher);
-  }
+  plain = hdr_encode(plain, ASN1_TAG_OCTSTR, clen);
 #endif
+  return plain;
 }
 
-/* Message encryption */
+/* Message signature of responses, the MACs are made together */
 static void
-snmp_msg_signature(struct snmp_datagram *sdg)
+snmp_msg_signature(struct snmp_datagram **sdgs, int n)
 {
-  uint8_t mac[SHA1_SECRETKEYLEN];
-  const uint8_t *whole_msg;
-  const uint8_t *secret;
-  struct mib_user *user = sdg->user;
+  struct snmp_datagram *sdg;
+  struct mib_user *users[SNMP_BATCH_MAX];
+  struct hmac_job jobs[SNMP_BATCH_MAX];
+  uint8_t macs[SNMP_BATCH_MAX][SHA512_SECRETKEYLEN];
+  int i, ret[SNMP_BATCH_MAX];
+
+  for (i = 0; i < n; i++) {
+    sdg = sdgs[i];
+    /* Blanking for authencitation */
+    memset(sdg->out_auth_para, 0, sdg->auth_para_len);
+    memset(macs[i], 0, sizeof(macs[i]));
+    users[i] = sdg->user;
+    jobs[i].data = sdg->send_buf;
+    jobs[i].len = sdg->send_len;
+    jobs[i].mac = macs[i];
+  }
 
-  whole_msg = sdg->send_buf;
-  secret = user->auth_key.md5;
+  snmp_msg_hmac_batch(users, jobs, n, ret);
 
-  /* Blanking for authencitation */
-  memset(snmp_msg_auth_para, 0, sdg->auth_para_len);
-  if (user->auth_mode == SNMP_USER_AUTH_MD5) {
-#ifndef DISABLE_MD5
-    MD5_hmac(whole_msg, sdg->send_len, mac, MD5_SECRETKEYLEN, secret, sizeof(user->auth_key.md5));
-#endif
-  } else if (user->auth_mode == SNMP_USER_AUTH_SHA1) {
-#ifndef DISABLE_SHA
-    SHA1_hmac(whole_msg, sdg->send_len, mac, SHA1_SECRETKEYLEN, secret, sizeof(user->auth_key.sha1));
+  for (i = 0; i < n; i++) {
+    sdg = sdgs[i];
+    if (ret[i]) {
+      memset(macs[i], 0, sizeof(macs[i]));
+    }
+    memcpy(sdg->out_auth_para, macs[i], sdg->auth_para_len);
+  }
+}
 #endif
+
+/* Make sure a varbind fits behind the varbind list, return the list tail */
+static uint8_t *
+snmp_vb_room(struct snmp_datagram *sdg)
+{
+  uint8_t *buf;
+  uint32_t used, size;
+
+  used = SNMP_HDR_MAX_LEN + sdg->vb_list_len;
+  if (used + SNMP_VB_MAX_LEN > sdg->out_size) {
+    size = sdg->out_size ? sdg->out_size * 2 : SNMP_OUT_BUF_SIZE;
+    buf = arena_alloc(sdg->arena, size);
+    if (sdg->out_buf != NULL) {
+      memcpy(buf + SNMP_HDR_MAX_LEN, sdg->out_buf + SNMP_HDR_MAX_LEN, sdg->vb_list_len);
+    }
+    sdg->out_buf = buf;
+    sdg->out_size = size;
+  }
+
+  return sdg->out_buf + used;
+}
+
+/* Append the result varbind to the response. The varbind is encoded
+ * backward from the end of a window large enough for any varbind and
+ * then moved down to the list tail. */
+void
+snmp_vb_encode(struct snmp_datagram *sdg, struct oid_search_res *ret_oid, uint8_t type)
+{
+  uint8_t *tail, *end, *buf;
+  uint32_t len, prefix;
+
+  tail = snmp_vb_room(sdg);
+  end = buf = tail + SNMP_VB_MAX_LEN;
+
+  /* value */
+  len = ber_value_enc_rev(value(&ret_oid->var), length(&ret_oid->var), tag(&ret_oid->var), buf);
+  buf -= len;
+  buf = hdr_encode(buf, type, len);
+
+  /* oid */
+  if (ret_oid->ber_prefix != NULL) {
+    /* Only the instance arcs behind the encoded instance node oid */
+    prefix = ret_oid->inst_id - ret_oid->oid;
+    len = ber_oid_arcs_enc_rev(ret_oid->inst_id, ret_oid->id_len - prefix, buf);
+    buf -= len;
+    buf -= ret_oid->ber_prefix_len;
+    memcpy(buf, ret_oid->ber_prefix, ret_oid->ber_prefix_len);
+    len += ret_oid->ber_prefix_len;
+    /* Used up, the next varbind searches again */
+    ret_oid->ber_prefix = NULL;
+    ret_oid->ber_prefix_len = 0;
   } else {
-    memset(mac, 0, sizeof(mac));
+    len = ber_value_enc_rev(ret_oid->oid, ret_oid->id_len, ASN1_TAG_OBJID, buf);
+    buf -= len;
   }
-  memcpy(snmp_msg_auth_para, mac, sdg->auth_para_len);
+  buf = hdr_encode(buf, ASN1_TAG_OBJID, len);
+
+  /* varbind */
+  buf = hdr_encode(buf, ASN1_TAG_SEQ, end - buf);
+
+  len = end - buf;
+  memmove(tail, buf, len);
+  sdg->vb_list_len += len;
+  sdg->vb_out_cnt++;
 }
-#endif
 
 void
 snmp_response(struct snmp_datagram *sdg)
 {
-  struct var_bind *vb_out;
-  struct list_head *curr;
-  uint8_t *buf;
-  uint32_t oid_len, len_len;
-  const uint32_t tag_len = 1;
+  uint8_t *buf, *end, *scope;
 
-  buf = asn1_encode(sdg);
+  /* Headers go backward in front of the varbind list */
+  buf = snmp_vb_room(sdg) - sdg->vb_list_len;
+  end = buf + sdg->vb_list_len;
 
-  list_for_each(curr, &sdg->vb_out_list) {
-    vb_out = list_entry(curr, struct var_bind, link);
+  buf = scope_encode(sdg, buf);
 
-    *buf++ = ASN1_TAG_SEQ;
-    buf += ber_length_enc(vb_out->vb_len, buf);
+  if (sdg->version >= 3) {
+#ifndef DISABLE_CRYPTO
+    if (sdg->user != NULL && (sdg->msg_flags & SNMP_SECUR_FLAG_AUTH) &&
+        (sdg->msg_flags & SNMP_SECUR_FLAG_ENCRYPT)) {
+      /* Message encryption */
+      buf = snmp_msg_encrypt(sdg, buf, end - buf);
+    }
+#endif
 
-    /* oid */
-    *buf++ = ASN1_TAG_OBJID;
-    oid_len = ber_value_enc_try(vb_out->oid, vb_out->oid_len, ASN1_TAG_OBJID);
-    buf += ber_length_enc(oid_len, buf);
-    buf += ber_value_enc(vb_out->oid, vb_out->oid_len, ASN1_TAG_OBJID, buf);
+    /* Security string */
+    scope = buf;
+    buf = security_parameter_encode(sdg, buf);
+    buf = hdr_encode(buf, ASN1_TAG_OCTSTR, scope - buf);
 
-    /* value */
-    *buf++ = vb_out->value_type;
-    buf += ber_length_enc(vb_out->value_len, buf);
-    memcpy(buf, vb_out->value, vb_out->value_len);
-    buf += vb_out->value_len;
+    /* Global data */
+    buf = global_data_encode(sdg, buf);
   }
 
-  len_len = ber_length_enc_try(sdg->data_len);
-  sdg->send_len = tag_len + len_len + sdg->data_len;
+  /* Version */
+  buf = tlv_encode(buf, ASN1_TAG_INT, &sdg->version, 1);
+
+  /* Datagram sequence */
+  buf = hdr_encode(buf, ASN1_TAG_SEQ, end - buf);
+
+  sdg->send_buf = buf;
+  sdg->send_len = end - buf;
+
+  if (sdg->held) {
+    /* Left to snmp_response_flush */
+    return;
+  }
 
 #ifndef DISABLE_CRYPTO
   if (sdg->version >= 3) {
     if (sdg->user != NULL) {
       /* Message authentication */
-      if (sdg->msg_flags & SNMP_SECUR_FLAG_AUTH) { 
-        /* Message encryption */
-        if (sdg->msg_flags & SNMP_SECUR_FLAG_ENCRYPT) {
-          snmp_msg_encrypt(sdg);
-        }
-        snmp_msg_signature(sdg);
+      if (sdg->msg_flags & SNMP_SECUR_FLAG_AUTH) {
+        snmp_msg_signature(&sdg, 1);
       }
     }
   }
 #endif
 
-  /* This callback will free send_buf */
-  snmp_prot_ops.send(sdg->send_buf, sdg->send_len);
+  /* Transport copies send_buf, which goes back to the arena afterwards */
+  snmp_prot_ops.send(sdg->send_buf, sdg->send_len, sdg->peer);
+}
+
+/* Sign the held responses of a batch together and hand them to transport
+ * in order */
+void
+snmp_response_flush(struct snmp_datagram **sdgs, int n)
+{
+  struct snmp_datagram *sdg;
+#ifndef DISABLE_CRYPTO
+  struct snmp_datagram *auth[SNMP_BATCH_MAX];
+  int cnt = 0;
+#endif
+  int i;
+
+#ifndef DISABLE_CRYPTO
+  for (i = 0; i < n; i++) {
+    sdg = sdgs[i];
+    if (sdg->held && sdg->send_buf != NULL && sdg->version >= 3 &&
+        sdg->user != NULL && (sdg->msg_flags & SNMP_SECUR_FLAG_AUTH)) {
+      auth[cnt++] = sdg;
+    }
+  }
+  /* Message authentication */
+  snmp_msg_signature(auth, cnt);
+#endif
+
+  for (i = 0; i < n; i++) {
+    sdg = sdgs[i];
+    if (sdg->held && sdg->send_buf != NULL) {
+      snmp_prot_ops.send(sdg->send_buf, sdg->send_len, sdg->peer);
+    }
+  }
 }
@@ -19,6 +19,7 @@
  *
  */
 
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -26,89 +27,103 @@
 #include "mib.h"
 #include "snmp.h"
 
-static void
-mib_get(struct snmp_datagram *sdg, struct var_bind *vb_in, struct oid_search_res *ret_oid)
+/* Security level of request */
+static inline uint8_t
+request_secur_level(const struct snmp_datagram *sdg)
+{
+  if (!(sdg->msg_flags & SNMP_SECUR_FLAG_AUTH)) {
+    return MIB_VACM_NOAUTH;
+  }
+  return sdg->msg_flags & SNMP_SECUR_FLAG_ENCRYPT ? MIB_VACM_PRIV : MIB_VACM_AUTH;
+}
+
+/* Views the community or user of request may access, NULL if none */
+static const struct mib_view_set *
+request_views(struct snmp_datagram *sdg, MIB_ACES_ATTR_E attribute, struct oid_search_res *ret_oid)
 {
-  struct mib_view *view = NULL;
-  struct mib_community *community = NULL;
-  struct mib_user *user = NULL;
+  const struct mib_view_set *views;
 
   /* Access control */
   if (sdg->version >= 3) {
-    user = sdg->user;
-    if (user == NULL) {
-      ret_oid->err_stat = SNMP_ERR_STAT_NO_ACCESS;
-    }
+    views = mib_user_view_set(sdg->user, request_secur_level(sdg), attribute);
   } else {
-    community = mib_community_search(sdg->context_name);
-    if (community == NULL) {
-      ret_oid->err_stat = SNMP_ERR_STAT_NO_ACCESS;
-    }
+    views = mib_community_view_set(sdg->context_name, sdg->version, attribute);
+  }
+  if (views == NULL) {
+    ret_oid->err_stat = SNMP_ERR_STAT_NO_ACCESS;
+    return NULL;
   }
 
   /* Authentication */
-  if (user != NULL) {
-    if (sdg->msg_flags & SNMP_SECUR_FLAG_AUTH) {
-      ret_oid->err_stat = sdg->auth_err;
-    }
+  if (sdg->version >= 3 && (sdg->msg_flags & SNMP_SECUR_FLAG_AUTH)) {
+    ret_oid->err_stat = sdg->auth_err;
   }
+  return views;
+}
 
-  /* Traverse all availble views according to community or user */
-  for (; ;) {
-    if (sdg->version >= 3) {
-      view = mib_user_next_view(user, MIB_ACES_READ, view);
-    } else {
-      view = mib_community_next_view(community, MIB_ACES_READ, view);
-    }
+/* Search oid in the view covering it, oids out of views and excluded ones
+ * are no such object */
+static void
+view_set_search(const struct mib_view_set *views, const oid_t *oid, uint32_t oid_len, struct oid_search_res *ret_oid)
+{
+  uint32_t i, skip_len;
 
-    /* End of mib view */
-    if (view == NULL) {
-      /* Duplicate original oid when result not found */
-      ret_oid->oid = oid_dup(vb_in->oid, vb_in->oid_len);
-      ret_oid->id_len = vb_in->oid_len;
-      return;
-    }
+  if (views == NULL || views->cnt == 0) {
+    /* Copy original oid when result not found */
+    oid_cpy(ret_oid->oid, oid, oid_len);
+    ret_oid->id_len = oid_len;
+    return;
+  }
 
-    mib_tree_search(view, vb_in->oid, vb_in->oid_len, ret_oid);
-    if ((!ret_oid->err_stat && ASN1_TAG_VALID(tag(&ret_oid->var))) || oid_cmp(vb_in->oid, vb_in->oid_len, view->oid, view->id_len) < 0) {
-      /* Gotcha or given oid ahead of all views */
-      return;
-    }
-    /* Free temporary result */
-    free(ret_oid->oid);
+  /* Only the view covering oid may have it, any other one tells no such
+   * object */
+  i = mib_view_set_locate(views, oid, oid_len);
+  if (i == views->cnt) {
+    i--;
+  } else if (!mib_view_set_allow(views, oid, oid_len, &skip_len)
+             && oid_cover(views->views[i]->oid, views->views[i]->id_len, oid, oid_len) > 0) {
+    /* Excluded from view */
+    oid_cpy(ret_oid->oid, oid, oid_len);
+    ret_oid->id_len = oid_len;
+    ret_oid->err_stat = 0;
+    ret_oid->ber_prefix = NULL;
+    ret_oid->ber_prefix_len = 0;
+    tag(&ret_oid->var) = ASN1_TAG_NO_SUCH_OBJ;
+    return;
   }
+  mib_tree_search(views->views[i], oid, oid_len, ret_oid);
+}
+
+static void
+mib_get(struct snmp_datagram *sdg, const oid_t *oid, uint32_t oid_len, struct oid_search_res *ret_oid)
+{
+  view_set_search(request_views(sdg, MIB_ACES_READ, ret_oid), oid, oid_len, ret_oid);
 }
 
 void
 snmp_get(struct snmp_datagram *sdg)
 {
-  struct list_head *curr;
-  struct var_bind *vb_in, *vb_out;
+  struct vb_view *vb_in;
   struct oid_search_res ret_oid;
-  uint32_t oid_len, len_len, val_len;
+  oid_t oid_buf[ASN1_OID_MAX_LEN];
+  oid_t in_oid[ASN1_OID_MAX_LEN];
+  uint32_t in_len;
   uint32_t vb_in_cnt = 0;
-  const uint32_t tag_len = 1;
 
   memset(&ret_oid, 0, sizeof(ret_oid));
+  ret_oid.oid = oid_buf;
+  ret_oid.arena = sdg->arena;
   ret_oid.request = SNMP_REQ_GET;
 
-  list_for_each(curr, &sdg->vb_in_list) {
-    vb_in = list_entry(curr, struct var_bind, link);
-    vb_in_cnt++;
+  while (vb_in_cnt < sdg->vb_in_cnt) {
+    vb_in = &sdg->vb_in[vb_in_cnt++];
 
-    /* Decode vb_in value first */
-    tag(&ret_oid.var) = vb_in->value_type;
-    length(&ret_oid.var) = ber_value_dec(vb_in->value, vb_in->value_len, tag(&ret_oid.var), value(&ret_oid.var));
+    /* Decode vb_in oid and value out of the receive buffer first */
+    in_len = vb_view_oid(sdg, vb_in, in_oid);
+    vb_view_value(sdg, vb_in, &ret_oid.var);
 
     /* Search the mib node at the input oid */
-    mib_get(sdg, vb_in, &ret_oid);
-
-    val_len = ber_value_enc_try(value(&ret_oid.var), length(&ret_oid.var), tag(&ret_oid.var));
-    vb_out = xmalloc(sizeof(*vb_out) + val_len);
-    vb_out->oid = ret_oid.oid;
-    vb_out->oid_len = ret_oid.id_len;
-    vb_out->value_type = tag(&ret_oid.var);
-    vb_out->value_len = ber_value_enc(value(&ret_oid.var), length(&ret_oid.var), tag(&ret_oid.var), vb_out->value);
+    mib_get(sdg, in_oid, in_len, &ret_oid);
 
     /* Error status */
     if (ret_oid.err_stat) {
@@ -119,110 +134,119 @@ snmp_get(struct snmp_datagram *sdg)
       }
     }
 
-    /* OID length encoding */
-    oid_len = ber_value_enc_try(vb_out->oid, vb_out->oid_len, ASN1_TAG_OBJID);
-    len_len = ber_length_enc_try(oid_len);
-    vb_out->vb_len = tag_len + len_len + oid_len;
-
-    /* Value length encoding */
-    len_len = ber_length_enc_try(vb_out->value_len);
-    vb_out->vb_len += tag_len + len_len + vb_out->value_len;
-
-    /* Varbind length encoding */
-    len_len = ber_length_enc_try(vb_out->vb_len);
-    sdg->vb_list_len += tag_len + len_len + vb_out->vb_len;
-
-    /* Add into list. */
-    list_add_tail(&vb_out->link, &sdg->vb_out_list);
-    sdg->vb_out_cnt++;
+    /* Encode into response */
+    snmp_vb_encode(sdg, &ret_oid, tag(&ret_oid.var));
   }
 
   snmp_response(sdg);
 }
 
-static void
-mib_getnext(struct snmp_datagram *sdg, struct var_bind *vb_in, struct oid_search_res *ret_oid)
+/* Turn the first len arcs of oid into the least oid after their subtree,
+ * return its length, 0 if there is none */
+static uint32_t
+oid_subtree_next(oid_t *oid, uint32_t len)
 {
-  struct mib_view *view = NULL;
-  struct mib_community *community = NULL;
-  struct mib_user *user = NULL;
-
-  /* Access control */
-  if (sdg->version >= 3) {
-    user = sdg->user;
-    if (user == NULL) {
-      ret_oid->err_stat = SNMP_ERR_STAT_NO_ACCESS;
-    }
-  } else {
-    community = mib_community_search(sdg->context_name);
-    if (community == NULL) {
-      ret_oid->err_stat = SNMP_ERR_STAT_NO_ACCESS;
-    }
+  while (len > 0 && oid[len - 1] == UINT_MAX) {
+    len--;
   }
-
-  /* Authentication */
-  if (user != NULL) {
-    if (sdg->msg_flags & SNMP_SECUR_FLAG_AUTH) {
-      ret_oid->err_stat = sdg->auth_err;
-    }
+  if (len > 0) {
+    oid[len - 1]++;
   }
+  return len;
+}
 
-  /* Traverse all availble views according to community or user */
-  for (; ;) {
-    if (sdg->version >= 3) {
-      view = mib_user_next_view(user, MIB_ACES_READ, view);
-    } else {
-      view = mib_community_next_view(community, MIB_ACES_READ, view);
+static void
+mib_getnext(struct snmp_datagram *sdg, const oid_t *oid, uint32_t oid_len, struct oid_search_res *ret_oid)
+{
+  const struct mib_view_set *views;
+  const oid_t *from = oid;
+  uint32_t from_len = oid_len;
+  oid_t next[ASN1_OID_MAX_LEN];
+  uint32_t i, j, skip_len;
+
+  views = request_views(sdg, MIB_ACES_READ, ret_oid);
+  if (views != NULL && views->cnt > 0) {
+    /* Views behind oid are skipped, the last one still tells end of view */
+    i = mib_view_set_locate(views, oid, oid_len);
+    if (i == views->cnt) {
+      i--;
     }
 
-    /* End of mib view */
-    if (view == NULL) {
-      /* Duplicate original oid when result not found */
-      ret_oid->oid = oid_dup(vb_in->oid, vb_in->oid_len);
-      ret_oid->id_len = vb_in->oid_len;
-      return;
-    }
+    /* Traverse the views from the one of oid on */
+    while (i < views->cnt) {
+      mib_tree_search_next(views->views[i], from, from_len, ret_oid);
+      if (tag(&ret_oid->var) == ASN1_TAG_END_OF_MIB_VIEW) {
+        i++;
+        continue;
+      }
+      if (mib_view_set_allow(views, ret_oid->oid, ret_oid->id_len, &skip_len)) {
+        /* Gotcha */
+        return;
+      }
 
-    mib_tree_search_next(view, vb_in->oid, vb_in->oid_len, ret_oid);
-    if (tag(&ret_oid->var) != ASN1_TAG_END_OF_MIB_VIEW) {
-      /* Gotcha */
-      break;
+      /* Excluded, go on after it or after the excluded subtree */
+      from_len = ret_oid->id_len;
+      if (skip_len > 0 && skip_len < ret_oid->id_len) {
+        from_len = oid_subtree_next(ret_oid->oid, skip_len);
+        if (from_len == 0) {
+          /* Nothing follows the subtree */
+          ret_oid->inst_id = NULL;
+          ret_oid->inst_id_len = 0;
+          ret_oid->ber_prefix = NULL;
+          ret_oid->ber_prefix_len = 0;
+          tag(&ret_oid->var) = ASN1_TAG_END_OF_MIB_VIEW;
+          break;
+        }
+        from = oid_cpy(next, ret_oid->oid, from_len);
+
+        /* Searching next skips the successor itself, which may be an
+         * instance too */
+        j = mib_view_set_locate(views, from, from_len);
+        if (j < views->cnt && oid_cover(views->views[j]->oid, views->views[j]->id_len, from, from_len) > 0) {
+          ret_oid->request = SNMP_REQ_GET;
+          mib_tree_search(views->views[j], from, from_len, ret_oid);
+          ret_oid->request = SNMP_REQ_GETNEXT;
+          if (ret_oid->err_stat == 0 && tag(&ret_oid->var) != ASN1_TAG_NO_SUCH_OBJ
+              && tag(&ret_oid->var) != ASN1_TAG_NO_SUCH_INST
+              && mib_view_set_allow(views, ret_oid->oid, ret_oid->id_len, &skip_len)) {
+            return;
+          }
+        }
+      } else {
+        from = oid_cpy(next, ret_oid->oid, from_len);
+      }
     }
-    /* Free temporary result */
-    free(ret_oid->oid);
   }
+
+  /* End of mib view, copy original oid when result not found */
+  oid_cpy(ret_oid->oid, oid, oid_len);
+  ret_oid->id_len = oid_len;
 }
 
 void
 snmp_getnext(struct snmp_datagram *sdg)
 {
-  struct list_head *curr;
-  struct var_bind *vb_in, *vb_out;
+  struct vb_view *vb_in;
   struct oid_search_res ret_oid;
-  uint32_t oid_len, len_len, val_len;
+  oid_t oid_buf[ASN1_OID_MAX_LEN];
+  oid_t in_oid[ASN1_OID_MAX_LEN];
+  uint32_t in_len;
   uint32_t vb_in_cnt = 0;
-  const uint32_t tag_len = 1;
 
   memset(&ret_oid, 0, sizeof(ret_oid));
+  ret_oid.oid = oid_buf;
+  ret_oid.arena = sdg->arena;
   ret_oid.request = SNMP_REQ_GETNEXT;
 
-  list_for_each(curr, &sdg->vb_in_list) {
-    vb_in = list_entry(curr, struct var_bind, link);
-    vb_in_cnt++;
+  while (vb_in_cnt < sdg->vb_in_cnt) {
+    vb_in = &sdg->vb_in[vb_in_cnt++];
 
-    /* Decode vb_in value first */
-    tag(&ret_oid.var) = vb_in->value_type;
-    length(&ret_oid.var) = ber_value_dec(vb_in->value, vb_in->value_len, tag(&ret_oid.var), value(&ret_oid.var));
+    /* Decode vb_in oid and value out of the receive buffer first */
+    in_len = vb_view_oid(sdg, vb_in, in_oid);
+    vb_view_value(sdg, vb_in, &ret_oid.var);
 
     /* Search the mib node at the next input oid */
-    mib_getnext(sdg, vb_in, &ret_oid);
-
-    val_len = ber_value_enc_try(value(&ret_oid.var), length(&ret_oid.var), tag(&ret_oid.var));
-    vb_out = xmalloc(sizeof(*vb_out) + val_len);
-    vb_out->oid = ret_oid.oid;
-    vb_out->oid_len = ret_oid.id_len;
-    vb_out->value_type = tag(&ret_oid.var);
-    vb_out->value_len = ber_value_enc(value(&ret_oid.var), length(&ret_oid.var), tag(&ret_oid.var), vb_out->value);
+    mib_getnext(sdg, in_oid, in_len, &ret_oid);
 
     /* Error status */
     if (ret_oid.err_stat) {
@@ -233,123 +257,53 @@ snmp_getnext(struct snmp_datagram *sdg)
       }
     }
 
-    /* OID length encoding */
-    oid_len = ber_value_enc_try(vb_out->oid, vb_out->oid_len, ASN1_TAG_OBJID);
-    len_len = ber_length_enc_try(oid_len);
-    vb_out->vb_len = tag_len + len_len + oid_len;
-
-    /* Value length encoding */
-    len_len = ber_length_enc_try(vb_out->value_len);
-    vb_out->vb_len += tag_len + len_len + vb_out->value_len;
-
-    /* Varbind length encoding */
-    len_len = ber_length_enc_try(vb_out->vb_len);
-    sdg->vb_list_len += tag_len + len_len + vb_out->vb_len;
-
-    /* Add into list. */
-    list_add_tail(&vb_out->link, &sdg->vb_out_list);
-    sdg->vb_out_cnt++;
+    /* Encode into response */
+    snmp_vb_encode(sdg, &ret_oid, tag(&ret_oid.var));
   }
 
   snmp_response(sdg);
 }
 
 static void
-mib_set(struct snmp_datagram *sdg, struct var_bind *vb_in, struct oid_search_res *ret_oid)
+mib_set(struct snmp_datagram *sdg, const oid_t *oid, uint32_t oid_len, struct oid_search_res *ret_oid)
 {
-  struct mib_view *view = NULL;
-  struct mib_community *community = NULL;
-  struct mib_user *user = NULL;
+  const struct mib_view_set *views;
 
-  /* Access control */
-  if (sdg->version >= 3) {
-    user = sdg->user;
-    if (user != NULL) {
-      /* Check mib write views */
-      if (!mib_user_view_cover(user, MIB_ACES_WRITE, vb_in->oid, vb_in->oid_len)) {
-        ret_oid->err_stat = SNMP_ERR_STAT_NO_ACCESS;
-        user = NULL;
-      }
-    } else {
-      ret_oid->err_stat = SNMP_ERR_STAT_NO_ACCESS;
-    }
-  } else {
-    community = mib_community_search(sdg->context_name);
-    if (community != NULL) {
-      /* Check mib write views */
-      if (!mib_community_view_cover(community, MIB_ACES_WRITE, vb_in->oid, vb_in->oid_len)) {
-        ret_oid->err_stat = SNMP_ERR_STAT_NO_ACCESS;
-        community = NULL;
-      }
-    } else {
-      ret_oid->err_stat = SNMP_ERR_STAT_NO_ACCESS;
-    }
-  }
-
-  /* Authentication */
-  if (user != NULL) {
-    if (sdg->msg_flags & SNMP_SECUR_FLAG_AUTH) {
-      ret_oid->err_stat = sdg->auth_err;
-    }
+  /* Check mib write views */
+  views = request_views(sdg, MIB_ACES_WRITE, ret_oid);
+  if (views != NULL && !mib_view_set_cover(views, oid, oid_len)) {
+    ret_oid->err_stat = SNMP_ERR_STAT_NO_ACCESS;
+    views = NULL;
   }
 
-  /* Traverse all availble views according to community or user */
-  for (; ;) {
-    if (sdg->version >= 3) {
-      view = mib_user_next_view(user, MIB_ACES_WRITE, view);
-    } else {
-      view = mib_community_next_view(community, MIB_ACES_WRITE, view);
-    }
-
-    /* End of mib view */
-    if (view == NULL) {
-      /* Duplicate original oid when result not found */
-      ret_oid->oid = oid_dup(vb_in->oid, vb_in->oid_len);
-      ret_oid->id_len = vb_in->oid_len;
-      return;
-    }
-
-    mib_tree_search(view, vb_in->oid, vb_in->oid_len, ret_oid);
-    if ((!ret_oid->err_stat && ASN1_TAG_VALID(tag(&ret_oid->var))) || oid_cmp(vb_in->oid, vb_in->oid_len, view->oid, view->id_len) < 0) {
-      /* Gotcha or given oid ahead of all views */
-      return;
-    }
-    /* Free temporary result */
-    free(ret_oid->oid);
-  }
+  view_set_search(views, oid, oid_len, ret_oid);
 }
 
 /* SET request function */
 void
 snmp_set(struct snmp_datagram *sdg)
 {
-  struct list_head *curr;
-  struct var_bind *vb_in, *vb_out;
+  struct vb_view *vb_in;
   struct oid_search_res ret_oid;
-  uint32_t oid_len, len_len, val_len;
+  oid_t oid_buf[ASN1_OID_MAX_LEN];
+  oid_t in_oid[ASN1_OID_MAX_LEN];
+  uint32_t in_len;
   uint32_t vb_in_cnt = 0;
-  const uint32_t tag_len = 1;
 
   memset(&ret_oid, 0, sizeof(ret_oid));
+  ret_oid.oid = oid_buf;
+  ret_oid.arena = sdg->arena;
   ret_oid.request = SNMP_REQ_SET;
 
-  list_for_each(curr, &sdg->vb_in_list) {
-    vb_in = list_entry(curr, struct var_bind, link);
-    vb_in_cnt++;
+  while (vb_in_cnt < sdg->vb_in_cnt) {
+    vb_in = &sdg->vb_in[vb_in_cnt++];
 
-    /* Decode vb_in value first */
-    tag(&ret_oid.var) = vb_in->value_type;
-    length(&ret_oid.var) = ber_value_dec(vb_in->value, vb_in->value_len, tag(&ret_oid.var), value(&ret_oid.var));
+    /* Decode vb_in oid and value out of the receive buffer first */
+    in_len = vb_view_oid(sdg, vb_in, in_oid);
+    vb_view_value(sdg, vb_in, &ret_oid.var);
 
     /* Search the mib node at the input oid and set it */
-    mib_set(sdg, vb_in, &ret_oid);
-
-    val_len = ber_value_enc_try(value(&ret_oid.var), length(&ret_oid.var), tag(&ret_oid.var));
-    vb_out = xmalloc(sizeof(*vb_out) + val_len);
-    vb_out->oid = ret_oid.oid;
-    vb_out->oid_len = ret_oid.id_len;
-    vb_out->value_type = vb_in->value_type;
-    vb_out->value_len = ber_value_enc(value(&ret_oid.var), val_len, tag(&ret_oid.var), vb_out->value);
+    mib_set(sdg, in_oid, in_len, &ret_oid);
 
     /* Invalid tags convert to error status for snmpset */
     if (!ret_oid.err_stat && !ASN1_TAG_VALID(tag(&ret_oid.var))) {
@@ -365,22 +319,8 @@ snmp_set(struct snmp_datagram *sdg)
       }
     }
 
-    /* OID length encoding */
-    oid_len = ber_value_enc_try(vb_out->oid, vb_out->oid_len, ASN1_TAG_OBJID);
-    len_len = ber_length_enc_try(oid_len);
-    vb_out->vb_len = tag_len + len_len + oid_len;
-
-    /* Value length encoding */
-    len_len = ber_length_enc_try(vb_out->value_len);
-    vb_out->vb_len += tag_len + len_len + vb_out->value_len;
-
-    /* Varbind length encoding */
-    len_len = ber_length_enc_try(vb_out->vb_len);
-    sdg->vb_list_len += tag_len + len_len + vb_out->vb_len;
-
-    /* Add into list. */
-    list_add_tail(&vb_out->link, &sdg->vb_out_list);
-    sdg->vb_out_cnt++;
+    /* Encode into response */
+    snmp_vb_encode(sdg, &ret_oid, vb_in->value_type);
   }
 
   snmp_response(sdg);
@@ -389,42 +329,53 @@ snmp_set(struct snmp_datagram *sdg)
 void
 snmp_bulkget(struct snmp_datagram *sdg)
 {
-  struct list_head *curr;
-  struct var_bind *vb_in, *vb_out;
+  struct vb_view *vb_in;
   struct oid_search_res ret_oid;
-  uint32_t oid_len, len_len, val_len;
+  struct mib_walk *walks;
+  oid_t oid_buf[ASN1_OID_MAX_LEN];
+  oid_t (*next_oid)[ASN1_OID_MAX_LEN];
+  uint32_t *next_len;
   uint32_t vb_in_cnt = 0;
-  uint32_t repeat;
-  const uint32_t tag_len = 1;
+  uint32_t repeat, i, n;
 
   memset(&ret_oid, 0, sizeof(ret_oid));
+  ret_oid.oid = oid_buf;
+  ret_oid.arena = sdg->arena;
   ret_oid.request = SNMP_REQ_GETNEXT;
   repeat = sdg->pdu_hdr.err_idx;
   sdg->pdu_hdr.err_idx = 0;
+  n = sdg->vb_in_cnt ? sdg->vb_in_cnt : 1;
+
+  /* Each varbind walks its own column, so rows are fetched ahead per varbind */
+  walks = arena_alloc(sdg->arena, n * sizeof(*walks));
+  memset(walks, 0, n * sizeof(*walks));
+
+  /* Oid each varbind goes on from, the input one at first */
+  next_oid = arena_alloc(sdg->arena, n * sizeof(*next_oid));
+  next_len = arena_alloc(sdg->arena, n * sizeof(*next_len));
+  for (i = 0; i < sdg->vb_in_cnt; i++) {
+    next_len[i] = vb_view_oid(sdg, &sdg->vb_in[i], next_oid[i]);
+  }
 
   while (repeat-- > 0) {
-    list_for_each(curr, &sdg->vb_in_list) {
-      vb_in = list_entry(curr, struct var_bind, link);
+    for (i = 0; i < sdg->vb_in_cnt; i++) {
+      vb_in = &sdg->vb_in[i];
       vb_in_cnt++;
 
+      /* Instances still wanted for this varbind, including this one */
+      ret_oid.walk = &walks[i];
+      ret_oid.walk->arena = sdg->arena;
+      ret_oid.walk->want = repeat + 1;
+
       /* Decode vb_in value first */
-      tag(&ret_oid.var) = vb_in->value_type;
-      length(&ret_oid.var) = ber_value_dec(vb_in->value, vb_in->value_len, tag(&ret_oid.var), value(&ret_oid.var));
+      vb_view_value(sdg, vb_in, &ret_oid.var);
 
       /* Search the mib node at the next input oid */
-      mib_getnext(sdg, vb_in, &ret_oid);
+      mib_getnext(sdg, next_oid[i], next_len[i], &ret_oid);
 
-      /* Return oid for the next query. */
-      free(vb_in->oid);
-      vb_in->oid = oid_dup(ret_oid.oid, ret_oid.id_len);
-      vb_in->oid_len = ret_oid.id_len;
-
-      val_len = ber_value_enc_try(value(&ret_oid.var), length(&ret_oid.var), tag(&ret_oid.var));
-      vb_out = xmalloc(sizeof(*vb_out) + val_len);
-      vb_out->oid = ret_oid.oid;
-      vb_out->oid_len = ret_oid.id_len;
-      vb_out->value_type = tag(&ret_oid.var);
-      vb_out->value_len = ber_value_enc(value(&ret_oid.var), length(&ret_oid.var), tag(&ret_oid.var), vb_out->value);
+      /* Return oid for the next query */
+      oid_cpy(next_oid[i], ret_oid.oid, ret_oid.id_len);
+      next_len[i] = ret_oid.id_len;
 
       /* Error status */
       if (ret_oid.err_stat) {
@@ -435,22 +386,8 @@ snmp_bulkget(struct snmp_datagram *sdg)
         }
       }
 
-      /* OID length encoding */
-      oid_len = ber_value_enc_try(vb_out->oid, vb_out->oid_len, ASN1_TAG_OBJID);
-      len_len = ber_length_enc_try(oid_len);
-      vb_out->vb_len = tag_len + len_len + oid_len;
-
-      /* Value length encoding */
-      len_len = ber_length_enc_try(vb_out->value_len);
-      vb_out->vb_len += tag_len + len_len + vb_out->value_len;
-
-      /* Varbind length encoding */
-      len_len = ber_length_enc_try(vb_out->vb_len);
-      sdg->vb_list_len += tag_len + len_len + vb_out->vb_len;
-
-      /* Add into list. */
-      list_add_tail(&vb_out->link, &sdg->vb_out_list);
-      sdg->vb_out_cnt++;
+      /* Encode into response */
+      snmp_vb_encode(sdg, &ret_oid, tag(&ret_oid.var));
     }
   }
 
@@ -308,6 +308,7 @@ snmp_trap_close(void)
     snmp_event_timeout(0);
     luaL_unref(L, LUA_ENVIRONINDEX, tdg->lua_handler);
     close(snmp_trap_datagram.sock);
+    tdg->lua_state = NULL;
   }
 }
 
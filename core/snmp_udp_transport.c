@@ -19,8 +19,15 @@
  *
  */
 
+/* recvmmsg/sendmmsg and SO_REUSEPORT */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
 #include <sys/socket.h>
 #include <sys/signalfd.h>
+#include <sys/prctl.h>
+#include <sys/wait.h>
 #include <netinet/in.h>
 
 #include <unistd.h>
@@ -28,22 +35,76 @@
 #include <stdlib.h>
 #include <string.h>
 #include <signal.h>
+#include <fcntl.h>
+#include <errno.h>
 
 #include "transport.h"
 #include "protocol.h"
 #include "event_loop.h"
 #include "utils.h"
 
+/* Outbound queue depth, must be power of 2 */
+#ifndef SNMP_SEND_QUEUE_LEN
+#define SNMP_SEND_QUEUE_LEN  128
+#endif
+
+/* Stop reading requests above high water mark, resume below low water mark */
+#define SNMP_SEND_QUEUE_HIWAT  (SNMP_SEND_QUEUE_LEN * 3 / 4)
+#define SNMP_SEND_QUEUE_LOWAT  (SNMP_SEND_QUEUE_LEN / 4)
+
+#ifdef USE_MMSG
+/* Max datagrams moved by one recvmmsg()/sendmmsg() call */
+#ifndef SNMP_MMSG_VLEN
+#define SNMP_MMSG_VLEN  32
+#endif
+
+struct snmp_mmsg_batch {
+  struct mmsghdr msgs[SNMP_MMSG_VLEN];
+  struct iovec iovs[SNMP_MMSG_VLEN];
+  struct sockaddr_in sins[SNMP_MMSG_VLEN];
+  uint8_t *bufs[SNMP_MMSG_VLEN];
+};
+#endif
+
+/* Reply waiting for the socket to be writable, the buffer is kept across
+ * replies and only grows */
+struct snmp_send_entry {
+  uint8_t *buf;
+  int len;
+  int size;
+  struct sockaddr_in sin;
+};
+
+struct snmp_send_queue {
+  unsigned int head;
+  unsigned int tail;
+  struct snmp_send_entry entries[SNMP_SEND_QUEUE_LEN];
+};
+
 struct snmp_data_entry {
   int sock;
   int sigfd;
-  uint8_t *buf;
-  int len;
+  int port;
+  int worker_cnt;
+  pid_t *workers;
+  unsigned char reading;
+  unsigned char writing;
+  struct snmp_send_queue sq;
+#ifdef USE_MMSG
+  struct snmp_mmsg_batch rx;
+  struct snmp_mmsg_batch tx;
+#else
+  uint8_t *recv_buf;
   struct sockaddr_in client_sin;
+#endif
 };
 
 static struct snmp_data_entry snmp_entry;
 static void transport_close(void);
+static void snmp_read_handler(int sock, unsigned char flag, void *ud);
+static void snmp_write_handler(int sock, unsigned char flag, void *ud);
+
+struct transport_stats snmp_transp_stats;
 
 static void
 snmp_signal_handler(int sigfd, unsigned char flag, void *ud)
@@ -57,18 +118,177 @@ snmp_signal_handler(int sigfd, unsigned char flag, void *ud)
   }
 }
 
+static inline unsigned int
+send_queue_count(struct snmp_send_queue *sq)
+{
+  return sq->tail - sq->head;
+}
+
+static inline struct snmp_send_entry *
+send_queue_entry(struct snmp_send_queue *sq, unsigned int i)
+{
+  return &sq->entries[i & (SNMP_SEND_QUEUE_LEN - 1)];
+}
+
 static void
-snmp_write_handler(int sock, unsigned char flag, void *ud)
+send_queue_pop(struct snmp_send_queue *sq, unsigned int n)
 {
-  struct snmp_data_entry *entry = ud;
+  sq->head += n;
+  snmp_transp_stats.tx_queued = send_queue_count(sq);
+}
+
+/* Pause or resume reading requests according to queue water marks */
+static void
+snmp_backpressure(struct snmp_data_entry *entry)
+{
+  unsigned int cnt = send_queue_count(&entry->sq);
 
-  if (sendto(sock, entry->buf, entry->len, 0, (struct sockaddr *)&entry->client_sin, sizeof(struct sockaddr_in)) == -1) {
-    perror("sendto()");
-    snmp_event_done();
+  if (entry->reading && cnt >= SNMP_SEND_QUEUE_HIWAT) {
+    snmp_event_remove(entry->sock, SNMP_EV_READ);
+    entry->reading = 0;
+    snmp_transp_stats.rx_pauses++;
+  } else if (!entry->reading && cnt <= SNMP_SEND_QUEUE_LOWAT) {
+    snmp_event_add(entry->sock, SNMP_EV_READ, snmp_read_handler, NULL);
+    entry->reading = 1;
   }
-  free(entry->buf);
 
-  snmp_event_remove(sock, flag);
+  if (!entry->writing && cnt > 0) {
+    snmp_event_add(entry->sock, SNMP_EV_WRITE, snmp_write_handler, entry);
+    entry->writing = 1;
+  } else if (entry->writing && cnt == 0) {
+    snmp_event_remove(entry->sock, SNMP_EV_WRITE);
+    entry->writing = 0;
+  }
+}
+
+#ifdef USE_MMSG
+/* Send queued replies with as few sendmmsg() calls as possible */
+static void
+snmp_send_drain(struct snmp_data_entry *entry)
+{
+  struct snmp_send_queue *sq = &entry->sq;
+  struct snmp_mmsg_batch *tx = &entry->tx;
+  int i, n, cnt;
+
+  while ((cnt = send_queue_count(sq)) > 0) {
+    if (cnt > SNMP_MMSG_VLEN) {
+      cnt = SNMP_MMSG_VLEN;
+    }
+    for (i = 0; i < cnt; i++) {
+      struct snmp_send_entry *se = send_queue_entry(sq, sq->head + i);
+      tx->iovs[i].iov_base = se->buf;
+      tx->iovs[i].iov_len = se->len;
+      memset(&tx->msgs[i].msg_hdr, 0, sizeof(struct msghdr));
+      tx->msgs[i].msg_hdr.msg_name = &se->sin;
+      tx->msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+      tx->msgs[i].msg_hdr.msg_iov = &tx->iovs[i];
+      tx->msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    n = sendmmsg(entry->sock, tx->msgs, cnt, 0);
+    if (n == -1) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        /* Wait for writability */
+        break;
+      } else if (errno == EINTR) {
+        continue;
+      }
+      /* Skip the reply which can not be sent */
+      perror("sendmmsg()");
+      snmp_transp_stats.tx_drops++;
+      n = 1;
+    } else {
+      snmp_transp_stats.tx_calls++;
+      snmp_transp_stats.tx_dgrams += n;
+    }
+    send_queue_pop(sq, n);
+  }
+}
+
+static void
+snmp_read_handler(int sock, unsigned char flag, void *ud)
+{
+  struct snmp_mmsg_batch *rx = &snmp_entry.rx;
+  uint8_t *bufs[SNMP_MMSG_VLEN];
+  void *peers[SNMP_MMSG_VLEN];
+  int lens[SNMP_MMSG_VLEN];
+  int i, n, cnt, room;
+
+  /* Never receive more requests than the outbound queue can hold */
+  room = SNMP_SEND_QUEUE_LEN - send_queue_count(&snmp_entry.sq);
+  if (room > SNMP_MMSG_VLEN) {
+    room = SNMP_MMSG_VLEN;
+  }
+
+  for (i = 0; i < room; i++) {
+    rx->iovs[i].iov_base = rx->bufs[i];
+    rx->iovs[i].iov_len = TRANSP_BUF_SIZ;
+    memset(&rx->msgs[i].msg_hdr, 0, sizeof(struct msghdr));
+    rx->msgs[i].msg_hdr.msg_name = &rx->sins[i];
+    rx->msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+    rx->msgs[i].msg_hdr.msg_iov = &rx->iovs[i];
+    rx->msgs[i].msg_hdr.msg_iovlen = 1;
+  }
+
+  /* Drain as many pending datagrams as one batch can hold */
+  n = recvmmsg(sock, rx->msgs, room, MSG_DONTWAIT, NULL);
+  if (n == -1) {
+    if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+      perror("recvmmsg()");
+      snmp_event_done();
+    }
+    return;
+  }
+  snmp_transp_stats.rx_calls++;
+  snmp_transp_stats.rx_dgrams += n;
+
+  /* Parse each SNMP PDU in decoder, replies are queued in send queue */
+  for (i = cnt = 0; i < n; i++) {
+    if (rx->msgs[i].msg_len == 0) {
+      continue;
+    }
+    bufs[cnt] = rx->bufs[i];
+    lens[cnt] = rx->msgs[i].msg_len;
+    peers[cnt] = &rx->sins[i];
+    cnt++;
+  }
+  if (snmp_prot_ops.receive_batch != NULL) {
+    /* The batch is handled together, e.g. for multi-buffer HMAC */
+    snmp_prot_ops.receive_batch(bufs, lens, peers, cnt);
+  } else {
+    for (i = 0; i < cnt; i++) {
+      snmp_prot_ops.receive(bufs[i], lens[i], peers[i]);
+    }
+  }
+
+  snmp_send_drain(&snmp_entry);
+  snmp_backpressure(&snmp_entry);
+}
+#else
+/* Send queued replies until the socket would block */
+static void
+snmp_send_drain(struct snmp_data_entry *entry)
+{
+  struct snmp_send_queue *sq = &entry->sq;
+
+  while (send_queue_count(sq) > 0) {
+    struct snmp_send_entry *se = send_queue_entry(sq, sq->head);
+    if (sendto(entry->sock, se->buf, se->len, 0, (struct sockaddr *)&se->sin, sizeof(struct sockaddr_in)) == -1) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        /* Wait for writability */
+        break;
+      } else if (errno == EINTR) {
+        continue;
+      }
+      /* Skip the reply which can not be sent */
+      perror("sendto()");
+      snmp_transp_stats.tx_drops++;
+    } else {
+      snmp_transp_stats.tx_calls++;
+      snmp_transp_stats.tx_dgrams++;
+    }
+    send_queue_pop(sq, 1);
+  }
 }
 
 static void
@@ -76,36 +296,77 @@ snmp_read_handler(int sock, unsigned char flag, void *ud)
 {
   socklen_t server_sz = sizeof(struct sockaddr_in);
   int len;
-  uint8_t *buf;
-
-  buf = xmalloc(TRANSP_BUF_SIZ);
 
   /* Receive UDP data, store the address of the sender in client_sin */
-  len = recvfrom(sock, buf, TRANSP_BUF_SIZ, 0, (struct sockaddr *)&snmp_entry.client_sin, &server_sz);
+  len = recvfrom(sock, snmp_entry.recv_buf, TRANSP_BUF_SIZ, 0, (struct sockaddr *)&snmp_entry.client_sin, &server_sz);
   if (len == -1) {
-    perror("recvfrom()");
-    snmp_event_done();
+    if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+      perror("recvfrom()");
+      snmp_event_done();
+    }
+    return;
   }
+  snmp_transp_stats.rx_calls++;
+  snmp_transp_stats.rx_dgrams++;
 
   /* Parse SNMP PDU in decoder */
-  snmp_prot_ops.receive(buf, len);
+  if (len > 0) {
+    snmp_prot_ops.receive(snmp_entry.recv_buf, len, &snmp_entry.client_sin);
+  }
+
+  snmp_send_drain(&snmp_entry);
+  snmp_backpressure(&snmp_entry);
 }
+#endif
 
-/* Send snmp datagram as a UDP packet to the remote */
 static void
-transport_send(uint8_t *buf, int len)
+snmp_write_handler(int sock, unsigned char flag, void *ud)
 {
-  snmp_entry.buf = buf;
-  snmp_entry.len = len;
-  snmp_event_add(snmp_entry.sock, SNMP_EV_WRITE, snmp_write_handler, &snmp_entry);
+  struct snmp_data_entry *entry = ud;
+
+  snmp_send_drain(entry);
+  snmp_backpressure(entry);
 }
 
+/* Queue a copy of snmp datagram for the peer, sent when the socket is writable */
 static void
-transport_running(void)
+transport_send(uint8_t *buf, int len, void *peer)
+{
+  struct snmp_send_queue *sq = &snmp_entry.sq;
+  struct snmp_send_entry *se;
+
+  if (send_queue_count(sq) == SNMP_SEND_QUEUE_LEN) {
+    /* Queue overflow, drop the reply */
+    snmp_transp_stats.tx_drops++;
+    return;
+  }
+
+  se = send_queue_entry(sq, sq->tail++);
+  if (se->size < len) {
+    se->buf = xrealloc(se->buf, len);
+    se->size = len;
+  }
+  memcpy(se->buf, buf, len);
+  se->len = len;
+  se->sin = *(struct sockaddr_in *)peer;
+  snmp_transp_stats.tx_queued = send_queue_count(sq);
+}
+
+static void
+snmp_event_register(void)
 {
   snmp_event_init();
   snmp_event_add(snmp_entry.sock, SNMP_EV_READ, snmp_read_handler, NULL);
   snmp_event_add(snmp_entry.sigfd, SNMP_EV_READ, snmp_signal_handler, NULL);
+  snmp_entry.reading = 1;
+  snmp_entry.writing = 0;
+  snmp_backpressure(&snmp_entry);
+}
+
+static void
+transport_running(void)
+{
+  snmp_event_register();
   snmp_event_run();
 }
 
@@ -114,27 +375,161 @@ transport_step(long timeout)
 {
   static int inited = 0;
   if (inited == 0) {
-    snmp_event_init();
-    snmp_event_add(snmp_entry.sock, SNMP_EV_READ, snmp_read_handler, NULL);
-    snmp_event_add(snmp_entry.sigfd, SNMP_EV_READ, snmp_signal_handler, NULL);
+    snmp_event_register();
     inited = 1;
   }
   return snmp_event_step(timeout);
 }
 
+/* Stop the worker processes forked by this one */
+static void
+transport_workers_stop(void)
+{
+  int i;
+
+  for (i = 0; i < snmp_entry.worker_cnt; i++) {
+    kill(snmp_entry.workers[i], SIGINT);
+  }
+  for (i = 0; i < snmp_entry.worker_cnt; i++) {
+    waitpid(snmp_entry.workers[i], NULL, 0);
+  }
+  free(snmp_entry.workers);
+  snmp_entry.workers = NULL;
+  snmp_entry.worker_cnt = 0;
+}
+
 static void
 transport_close(void)
 {
+  struct snmp_send_queue *sq = &snmp_entry.sq;
+
   snmp_event_done();
   close(snmp_entry.sock);
   close(snmp_entry.sigfd);
+
+  transport_workers_stop();
+
+  /* Drop unsent replies */
+  snmp_transp_stats.tx_drops += send_queue_count(sq);
+  send_queue_pop(sq, send_queue_count(sq));
+}
+
+/* Open a non-blocking UDP socket bound to port */
+static int
+snmp_socket_open(int port, int reuseport)
+{
+  int sock;
+  struct sockaddr_in sin;
+
+  sock = socket(AF_INET, SOCK_DGRAM, 0);
+  if (sock < 0) {
+    perror("usock");
+    return -1;
+  }
+
+  if (reuseport) {
+#ifdef SO_REUSEPORT
+    int on = 1;
+    if (setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) < 0) {
+      perror("setsockopt()");
+      close(sock);
+      return -1;
+    }
+#else
+    fprintf(stderr, "SO_REUSEPORT is not supported\n");
+    close(sock);
+    return -1;
+#endif
+  }
+
+  memset(&sin, 0, sizeof(sin));
+  sin.sin_family = AF_INET;
+  sin.sin_addr.s_addr = htonl(INADDR_ANY);
+  sin.sin_port = htons(port);
+
+  if (bind(sock, (struct sockaddr *)&sin, sizeof(sin))) {
+    perror("bind()");
+    close(sock);
+    return -1;
+  }
+
+  /* Replies are queued instead of blocking on a full socket buffer */
+  if (fcntl(sock, F_SETFL, fcntl(sock, F_GETFL, 0) | O_NONBLOCK) < 0) {
+    perror("fcntl()");
+    close(sock);
+    return -1;
+  }
+
+  return sock;
+}
+
+/* Pre-fork workers - 1 processes sharing the port by SO_REUSEPORT, the caller
+ * stays as worker 0. Everything loaded so far (MIB groups, communities, users)
+ * is inherited by the workers, later changes stay in the worker making them.
+ * Return worker id, or -1 on failure with no worker left running. */
+static int
+transport_fork(int workers)
+{
+  int i, sock;
+  pid_t pid;
+
+  if (workers <= 1 || snmp_entry.worker_cnt > 0) {
+    return 0;
+  }
+
+  /* All sockets sharing the port must set SO_REUSEPORT before bind */
+  close(snmp_entry.sock);
+  sock = snmp_socket_open(snmp_entry.port, 1);
+  if (sock < 0) {
+    return -1;
+  }
+  snmp_entry.sock = sock;
+
+  /* Do not let workers flush output buffered before fork again */
+  fflush(NULL);
+
+  snmp_entry.workers = xcalloc(workers - 1, sizeof(pid_t));
+  for (i = 1; i < workers; i++) {
+    /* Worker binds its own socket so the kernel balances among workers,
+     * opened here to fail before forking */
+    sock = snmp_socket_open(snmp_entry.port, 1);
+    if (sock < 0) {
+      break;
+    }
+
+    pid = fork();
+    if (pid < 0) {
+      perror("fork()");
+      close(sock);
+      break;
+    } else if (pid == 0) {
+      free(snmp_entry.workers);
+      snmp_entry.workers = NULL;
+      snmp_entry.worker_cnt = 0;
+      prctl(PR_SET_PDEATHSIG, SIGINT);
+      close(snmp_entry.sock);
+      snmp_entry.sock = sock;
+      return i;
+    }
+    close(sock);
+    snmp_entry.workers[snmp_entry.worker_cnt++] = pid;
+  }
+
+  if (i < workers) {
+    /* Run all the workers or none */
+    transport_workers_stop();
+    return -1;
+  }
+  return 0;
 }
 
 static int
 transport_init(int port)
 {
   sigset_t mask;
-  struct sockaddr_in sin;
+#ifdef USE_MMSG
+  int i;
+#endif
 
   /* SNMP signal */
   sigemptyset(&mask);
@@ -148,22 +543,24 @@ transport_init(int port)
   }
 
   /* SNMP socket */
-  snmp_entry.sock = socket(AF_INET, SOCK_DGRAM, 0);
+  snmp_entry.port = port;
+  snmp_entry.sock = snmp_socket_open(port, 0);
   if (snmp_entry.sock < 0) {
-    perror("usock");
     return -1;
   }
 
-  memset(&sin, 0, sizeof(sin));
-  sin.sin_family = AF_INET;
-  sin.sin_addr.s_addr = htonl(INADDR_ANY);
-  sin.sin_port = htons(port);
-
-  if (bind(snmp_entry.sock, (struct sockaddr *)&sin, sizeof(sin))) {
-    perror("bind()");
-    close(snmp_entry.sock);
-    return -1;
+  /* Receive buffers are owned by transport and reused for every datagram */
+#ifdef USE_MMSG
+  for (i = 0; i < SNMP_MMSG_VLEN; i++) {
+    if (snmp_entry.rx.bufs[i] == NULL) {
+      snmp_entry.rx.bufs[i] = xmalloc(TRANSP_BUF_SIZ);
+    }
+  }
+#else
+  if (snmp_entry.recv_buf == NULL) {
+    snmp_entry.recv_buf = xmalloc(TRANSP_BUF_SIZ);
   }
+#endif
 
   return 0;
 }
@@ -175,4 +572,5 @@ struct transport_operation snmp_transp_ops = {
   transport_close,
   transport_send,
   transport_step,
+  transport_fork,
 };
@@ -31,10 +31,24 @@ struct transport_operation {
   int (*init)(int port);
   void (*running)(void);
   void (*close)(void);
-  void (*send)(uint8_t *buf, int len);
+  void (*send)(uint8_t *buf, int len, void *peer);
   int (*step)(long timeout);
+  int (*fork)(int workers);
 };
 
+/* Syscall and datagram counters, datagrams per syscall shows the batching */
+struct transport_stats {
+  unsigned long rx_calls;
+  unsigned long rx_dgrams;
+  unsigned long rx_pauses;
+  unsigned long tx_calls;
+  unsigned long tx_dgrams;
+  unsigned long tx_drops;
+  unsigned long tx_queued;
+};
+
+extern struct transport_stats snmp_transp_stats;
+
 extern struct transport_operation snmp_transp_ops;
 extern struct transport_operation agentx_transp_ops;
 
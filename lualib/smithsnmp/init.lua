@@ -120,92 +120,126 @@ function _M.sh_call(command, rmode)
     return t
 end
 
+-- Optional attributes of variable, e.g. { ttl = 5 } lets the core cache
+-- the value for 5 seconds without calling get function.
+local variable_options = function (variable, opt)
+    if opt ~= nil then
+        assert(type(opt) == 'table', 'Options must be table type')
+        if opt.ttl ~= nil then
+            assert(type(opt.ttl) == 'number' and opt.ttl >= 0, 'TTL must be non-negative number')
+            variable.ttl = opt.ttl
+        end
+    end
+    return variable
+end
+
 -- Bit String get/set function.
-function _M.ConstBitString(g)
+function _M.ConstBitString(g, opt)
     assert(type(g) == 'function', 'Argument must be function type')
-    return { tag = ASN1_TAG_BITSTR, access = MIB_ACES_RO, get_f = g }
+    return variable_options({ tag = ASN1_TAG_BITSTR, access = MIB_ACES_RO, get_f = g }, opt)
 end
 
-function _M.BitString(g, s)
+function _M.BitString(g, s, opt)
     assert(type(g) == 'function' and type(s) == 'function', 'Arguments must be function type')
-    return { tag = ASN1_TAG_BITSTR, access = MIB_ACES_RW, get_f = g, set_f = s }
+    return variable_options({ tag = ASN1_TAG_BITSTR, access = MIB_ACES_RW, get_f = g, set_f = s }, opt)
 end
 
 -- Octet String get/set function.
-function _M.ConstOctString(g)
+function _M.ConstOctString(g, opt)
     assert(type(g) == 'function', 'Argument must be function type')
-    return { tag = ASN1_TAG_OCTSTR, access = MIB_ACES_RO, get_f = g }
+    return variable_options({ tag = ASN1_TAG_OCTSTR, access = MIB_ACES_RO, get_f = g }, opt)
 end
 
-function _M.OctString(g, s)
+function _M.OctString(g, s, opt)
     assert(type(g) == 'function' and type(s) == 'function', 'Arguments must be function type')
-    return { tag = ASN1_TAG_OCTSTR, access = MIB_ACES_RW, get_f = g, set_f = s }
+    return variable_options({ tag = ASN1_TAG_OCTSTR, access = MIB_ACES_RW, get_f = g, set_f = s }, opt)
 end
 
 -- Integer get/set function.
-function _M.ConstInt(g)
+function _M.ConstInt(g, opt)
     assert(type(g) == 'function', 'Argument must be function type')
-    return { tag = ASN1_TAG_INT, access = MIB_ACES_RO, get_f = g }
+    return variable_options({ tag = ASN1_TAG_INT, access = MIB_ACES_RO, get_f = g }, opt)
 end
 
-function _M.Int(g, s)
+function _M.Int(g, s, opt)
     assert(type(g) == 'function' and type(s) == 'function', 'Arguments must be function type')
-    return { tag = ASN1_TAG_INT, access = MIB_ACES_RW, get_f = g, set_f = s }
+    return variable_options({ tag = ASN1_TAG_INT, access = MIB_ACES_RW, get_f = g, set_f = s }, opt)
 end
 
 -- Count get/set function.
-function _M.ConstCount(g)
+function _M.ConstCount(g, opt)
     assert(type(g) == 'function', 'Argument must be function type')
-    return { tag = ASN1_TAG_CNT, access = MIB_ACES_RO, get_f = g }
+    return variable_options({ tag = ASN1_TAG_CNT, access = MIB_ACES_RO, get_f = g }, opt)
 end
 
-function _M.Count(g, s)
+function _M.Count(g, s, opt)
     assert(type(g) == 'function' and type(s) == 'function', 'Arguments must be function type')
-    return { tag = ASN1_TAG_CNT, access = MIB_ACES_RW, get_f = g, set_f = s }
+    return variable_options({ tag = ASN1_TAG_CNT, access = MIB_ACES_RW, get_f = g, set_f = s }, opt)
 end
 
 -- IP address get/set function.
-function _M.ConstIpaddr(g)
+function _M.ConstIpaddr(g, opt)
     assert(type(g) == 'function', 'Argument must be function type')
-    return { tag = ASN1_TAG_IPADDR, access = MIB_ACES_RO, get_f = g }
+    return variable_options({ tag = ASN1_TAG_IPADDR, access = MIB_ACES_RO, get_f = g }, opt)
 end
 
-function _M.Ipaddr(g, s)
+function _M.Ipaddr(g, s, opt)
     assert(type(g) == 'function' and type(s) == 'function', 'Arguments must be function type')
-    return { tag = ASN1_TAG_IPADDR, access = MIB_ACES_RW, get_f = g, set_f = s }
+    return variable_options({ tag = ASN1_TAG_IPADDR, access = MIB_ACES_RW, get_f = g, set_f = s }, opt)
 end
 
 -- Oid get/set function for RO.
-function _M.ConstOid(g)
+function _M.ConstOid(g, opt)
     assert(type(g) == 'function', 'Argument must be function type')
-    return { tag = ASN1_TAG_OBJID, access = MIB_ACES_RO, get_f = g }
+    return variable_options({ tag = ASN1_TAG_OBJID, access = MIB_ACES_RO, get_f = g }, opt)
 end
 
-function _M.Oid(g, s)
+function _M.Oid(g, s, opt)
     assert(type(g) == 'function' and type(s) == 'function', 'Arguments must be function type')
-    return { tag = ASN1_TAG_OBJID, access = MIB_ACES_RW, get_f = g, set_f = s }
+    return variable_options({ tag = ASN1_TAG_OBJID, access = MIB_ACES_RW, get_f = g, set_f = s }, opt)
 end
 
 -- Timeticks get/set function.
-function _M.ConstTimeticks(g)
+function _M.ConstTimeticks(g, opt)
     assert(type(g) == 'function', 'Argument must be function type')
-    return { tag = ASN1_TAG_TIMETICKS, access = MIB_ACES_RO, get_f = g }
+    return variable_options({ tag = ASN1_TAG_TIMETICKS, access = MIB_ACES_RO, get_f = g }, opt)
 end
 
-function _M.Timeticks(g, s)
+function _M.Timeticks(g, s, opt)
     assert(type(g) == 'function' and type(s) == 'function', 'Arguments must be function type')
-    return { tag = ASN1_TAG_TIMETICKS, access = MIB_ACES_RW, get_f = g, set_f = s }
+    return variable_options({ tag = ASN1_TAG_TIMETICKS, access = MIB_ACES_RW, get_f = g, set_f = s }, opt)
 end
 
 -- Gauge get/set function.
-function _M.ConstGauge(g)
+function _M.ConstGauge(g, opt)
     assert(type(g) == 'function', 'Argument must be function type')
-    return { tag = ASN1_TAG_GAU, access = MIB_ACES_RO, get_f = g }
+    return variable_options({ tag = ASN1_TAG_GAU, access = MIB_ACES_RO, get_f = g }, opt)
 end
 
-function _M.Gauge(g, s)
+function _M.Gauge(g, s, opt)
     assert(type(g) == 'function' and type(s) == 'function', 'Arguments must be function type')
-    return { tag = ASN1_TAG_GAU, access = MIB_ACES_RW, get_f = g, set_f = s }
+    return variable_options({ tag = ASN1_TAG_GAU, access = MIB_ACES_RW, get_f = g, set_f = s }, opt)
+end
+
+-- Instance indexes of tables sorted by the core, keyed by entry.indexes.
+local index_sets = setmetatable({}, { __mode = 'k' })
+-- Tables declared by Indexes() map to true if their keys changed since last
+-- sort, false if not. Others are sorted on every request as their keys may
+-- change at any time.
+local index_managed = setmetatable({}, { __mode = 'k' })
+
+-- Declare entry indexes whose order is kept by the core across requests,
+-- call indexes_changed() after inserting or removing keys.
+function _M.Indexes(t)
+    t = t or {}
+    assert(type(t) == 'table', 'Indexes must be table type')
+    index_managed[t] = true
+    return t
+end
+
+function _M.indexes_changed(t)
+    assert(index_managed[t] ~= nil, 'Indexes not declared by Indexes()')
+    index_managed[t] = true
 end
 
 --
@@ -258,6 +292,21 @@ end
   Currently we don't support IP address as an instance index.
 ]]--
 
+local mib_index_set = function (indexes)
+    local set = index_sets[indexes]
+    if set == nil then
+        set = core.index_new()
+        index_sets[indexes] = set
+        core.index_build(set, indexes)
+    elseif index_managed[indexes] ~= false then
+        core.index_build(set, indexes)
+    end
+    if index_managed[indexes] then
+        index_managed[indexes] = false
+    end
+    return set
+end
+
 local mib_group_indexes_generate = function (group, name)
     assert(type(group) == 'table', string.format('Group should be container'))
     assert(type(name) == 'string', string.format('What is the group\'s name?'))
@@ -265,21 +314,6 @@ local mib_group_indexes_generate = function (group, name)
     local group_indexes = {}  -- result to produce
     local scalar_indexes = {{},{0}}  -- 2 dimensions matrix
     local table_indexes = {}  -- N dimensions matrix
-    local oid_cmp = function (oid1, oid2)
-        if type(oid1) == 'number' and type(oid2) == 'number' then
-            return oid1 < oid2
-        elseif type(oid1) == 'table' and type(oid2) == 'table' then
-            local len = math.min(#oid1, #oid2)
-            for i = 1, len do
-                if oid1[i] ~= oid2[i] then
-                    return oid1[i] < oid2[i]
-                end
-            end
-            return #oid1 < #oid2
-        else
-            error(string.format("Group \'%s\': Invalid element type in comparision", name))
-        end
-    end
     for obj_no in pairs(group) do
 
         if type(obj_no) == 'number' then
@@ -323,24 +357,8 @@ local mib_group_indexes_generate = function (group, name)
                         end
                     else
                         assert(entry.indexes.cascade == nil, string.format("%s[%d][%d]: No need to write \'cascade == false\' if indexes not cascaded, just wipe it out!", name, obj_no, entry_no))
-                        local dim4 = {}
-                        for key in pairs(entry.indexes) do
-                            local index
-                            -- index type
-                            if type(key) == 'string' then
-                                -- oid array
-                                index = {}
-                                for id in string.gmatch(key, "%d+") do
-                                    table.insert(index, tonumber(id))
-                                end
-                            else
-                                -- id number
-                                index = key
-                            end
-                            table.insert(dim4, index)
-                        end
-                        table.sort(dim4, oid_cmp)
-                        table.insert(table_indexes, dim4)
+                        -- Keys are id numbers or oid strings, sorted in core
+                        table.insert(table_indexes, mib_index_set(entry.indexes))
                     end
                 end
 
@@ -434,13 +452,25 @@ local function getnext(
     end
 
     -- Empty.
-    if next(it[dim]) == nil then
+    if type(it[dim]) == 'userdata' then
+        if core.index_count(it[dim]) == 0 then
+            return {}
+        end
+    elseif next(it[dim]) == nil then
         return {}
     end
 
     record[dim] = record[dim] or {}
 
-    if oid[offset] == nil then
+    local found = true
+    if type(it[dim]) == 'userdata' then
+        -- instance indexes sorted in core, always the last dimension
+        local index = core.index_next(it[dim], oid, offset)
+        if index ~= nil then
+            return concat(oid, offset, index)
+        end
+        found = false
+    elseif oid[offset] == nil then
         -- then point to first element
         oid = concat(oid, #oid + 1, it[dim][1])
         if dim == #it then
@@ -452,7 +482,7 @@ local function getnext(
             dim = dim + 1
         end
     else
-        local found = false
+        found = false
 
         xl = it[dim]
         for i, index in ipairs(xl) do
@@ -482,26 +512,26 @@ local function getnext(
                 end
             end
         end
+    end
 
-        -- if didn't find anything
-        if not found then
-            local pos
-            repeat
-                if dim == 1 then
-                    -- can't be recursive
-                    return {}
-                else
-                    -- backtracking
-                    dim = dim - 1
-                    pos = record[dim].pos + 1
-                end
-            until pos <= #it[dim]
-            offset = record[dim].offset
-            for i = offset, #oid do
-                oid[i] = nil
+    -- if didn't find anything
+    if not found then
+        local pos
+        repeat
+            if dim == 1 then
+                -- can't be recursive
+                return {}
+            else
+                -- backtracking
+                dim = dim - 1
+                pos = record[dim].pos + 1
             end
-            oid = concat(oid, offset, it[dim][pos])
+        until pos <= #it[dim]
+        offset = record[dim].offset
+        for i = offset, #oid do
+            oid[i] = nil
         end
+        oid = concat(oid, offset, it[dim][pos])
     end
 
     -- Tail recursion
@@ -543,6 +573,7 @@ local mib_node_search = function(group, name, op, req_sub_oid, req_val, req_val_
     local rsp_sub_oid = nil
     local rsp_val = nil
     local rsp_val_type = nil
+    local rsp_ttl = nil
     local group_index_table = nil
     -- Search obj_id in group index table.
     local effective_object_index = function (tab, id)
@@ -654,6 +685,7 @@ local mib_node_search = function(group, name, op, req_sub_oid, req_val, req_val_
                 end
                 rsp_val, err_stat = scalar.get_f()
                 rsp_val_type = scalar.tag
+                rsp_ttl = scalar.ttl
             elseif dim >= 4 then
                 -- table
                 local table_no = obj_no
@@ -689,6 +721,7 @@ local mib_node_search = function(group, name, op, req_sub_oid, req_val, req_val_
                 -- get instance value
                 rsp_val, err_stat = variable.get_f(inst_no)
                 rsp_val_type = variable.tag
+                rsp_ttl = variable.ttl
             else
                 return _M.SNMP_ERR_STAT_NO_ERR, rsp_sub_oid, nil, ASN1_TAG_NO_SUCH_OBJ
             end
@@ -705,12 +738,14 @@ local mib_node_search = function(group, name, op, req_sub_oid, req_val, req_val_
         if err_stat ~= nil then
             return err_stat, rsp_sub_oid, rsp_val, rsp_val_type
         else
-            return _M.SNMP_ERR_STAT_NO_ERR, rsp_sub_oid, rsp_val, rsp_val_type
+            return _M.SNMP_ERR_STAT_NO_ERR, rsp_sub_oid, rsp_val, rsp_val_type, rsp_ttl
         end
     end
 
     -- get next operation
-    handlers[SNMP_REQ_GETNEXT] = function ()
+    handlers[SNMP_REQ_GETNEXT] = function (req_sub_oid)
+        -- called repeatedly by bulk walk
+        err_stat, rsp_val, rsp_val_type, rsp_ttl = nil, nil, nil, nil
         rsp_sub_oid = req_sub_oid
 
         local i = 1
@@ -741,6 +776,7 @@ local mib_node_search = function(group, name, op, req_sub_oid, req_val, req_val_
                 if variable ~= nil then
                     rsp_val, err_stat = variable.get_f()
                     rsp_val_type = variable.tag
+                    rsp_ttl = variable.ttl
                 end
             elseif #rsp_sub_oid >= 4 then
                 -- table
@@ -761,6 +797,7 @@ local mib_node_search = function(group, name, op, req_sub_oid, req_val, req_val_
                     -- get instance value
                     rsp_val, err_stat = variable.get_f(inst_no)
                     rsp_val_type = variable.tag
+                    rsp_ttl = variable.ttl
                     -- oid iterator
                     if rsp_val == nil or rsp_val_type == nil or variable.access == MIB_ACES_UNA then
                         rsp_sub_oid[3] = rsp_sub_oid[3] + 1
@@ -782,8 +819,38 @@ local mib_node_search = function(group, name, op, req_sub_oid, req_val, req_val_
         if err_stat ~= nil then
             return err_stat, rsp_sub_oid, rsp_val, rsp_val_type
         else
-            return _M.SNMP_ERR_STAT_NO_ERR, rsp_sub_oid, rsp_val, rsp_val_type
+            return _M.SNMP_ERR_STAT_NO_ERR, rsp_sub_oid, rsp_val, rsp_val_type, rsp_ttl
+        end
+    end
+
+    -- bulk walk operation, fetch at most req_val instances following req_sub_oid
+    -- in one call and return them as rows of {sub_oid, tag, value, ...}
+    handlers[SNMP_REQ_GET_BLK] = function ()
+        local rows = {}
+        local n = 0
+        local sub_oid = req_sub_oid
+        while n < req_val do
+            local ok, err, oid, val, tag = pcall(handlers[SNMP_REQ_GETNEXT], sub_oid)
+            if not ok then
+                -- raise at the failed instance, or stop before it
+                if n == 0 then error(err, 0) end
+                return _M.SNMP_ERR_STAT_GEN_ERR, rows, n
+            elseif err ~= _M.SNMP_ERR_STAT_NO_ERR then
+                -- leave the failed instance to getnext
+                return err, rows, n
+            elseif next(oid) == nil then
+                break
+            end
+            rows[3 * n + 1] = oid
+            rows[3 * n + 2] = tag
+            rows[3 * n + 3] = val
+            n = n + 1
+            sub_oid = {}
+            for i, id in ipairs(oid) do
+                sub_oid[i] = id
+            end
         end
+        return _M.SNMP_ERR_STAT_NO_ERR, rows, n
     end
 
     -- Pre-process IO for mib group
@@ -794,7 +861,7 @@ local mib_node_search = function(group, name, op, req_sub_oid, req_val, req_val_
     group_index_table = mib_group_indexes_generate(group, name)
 
     local H = handlers[op]
-    return H()
+    return H(req_sub_oid)
 end
 
 --
@@ -811,9 +878,9 @@ _M.open = function ()
     return core.open()
 end
 
--- start snmp agent
-_M.start = function ()
-    core.run()
+-- start snmp agent, optionally in multiple worker processes
+_M.start = function (workers)
+    core.run(workers)
 end
 
 -- start snmp agent
@@ -821,6 +888,26 @@ _M.step = function (tm)
     core.step(tm)
 end
 
+-- snmp transport counters
+_M.transport_stats = function ()
+    return core.transport_stats()
+end
+
+-- snmp request arena counters
+_M.arena_stats = function ()
+    return core.arena_stats()
+end
+
+-- mib value cache counters
+_M.cache_stats = function ()
+    return core.cache_stats()
+end
+
+-- localized user key store counters
+_M.key_stats = function ()
+    return core.key_stats()
+end
+
 -- set read only community
 _M.set_ro_community = function (community, oid)
     assert(type(community) == 'string')
@@ -871,12 +958,55 @@ _M.user_create = function (user, auth_mode, auth_phrase, encrypt_mode, encrypt_p
     core.mib_user_create(user, auth_mode, auth_phrase, encrypt_mode, encrypt_phrase)
 end
 
+-- store of localized user keys, open before creating users
+_M.user_key_store = function (path)
+    assert(type(path) == 'string')
+    return core.mib_user_key_store(path)
+end
+
+local vacm_models = { any = 0, v1 = 1, v2c = 2, usm = 3 }
+local vacm_levels = { noauth = 1, auth = 2, priv = 3 }
+
+-- add a family to a VACM view, mask is hex octets like 'ff:a0' or ''
+_M.vacm_view = function (view, oid, mask, family_type)
+    assert(type(view) == 'string' and type(oid) == 'table')
+    mask = mask or ''
+    assert(type(mask) == 'string')
+    family_type = family_type or 'included'
+    if family_type ~= 'included' and family_type ~= 'excluded' then
+        return false
+    end
+    local octets = {}
+    for hex in string.gmatch(mask, '%x%x?') do
+        table.insert(octets, string.char(tonumber(hex, 16)))
+    end
+    return core.mib_vacm_view_add(view, oid, table.concat(octets), family_type == 'included')
+end
+
+-- map a community ('v1' or 'v2c' model) or a user ('usm' model) into a VACM group
+_M.vacm_group = function (group, model, name)
+    assert(type(group) == 'string' and type(name) == 'string')
+    if vacm_models[model] == nil or model == 'any' then
+        return false
+    end
+    return core.mib_vacm_group_add(group, vacm_models[model], name)
+end
+
+-- give a VACM group read and write views at a security model and level
+_M.vacm_access = function (group, model, level, read_view, write_view)
+    assert(type(group) == 'string')
+    if vacm_models[model] == nil or vacm_levels[level] == nil then
+        return false
+    end
+    return core.mib_vacm_access_add(group, vacm_models[model], vacm_levels[level], read_view or '', write_view or '')
+end
+
 -- register an mib group node
 _M.register_mib_group = function (oid, group, name)
     local mib_search_handler = function (op, req_sub_oid, req_val, req_val_type)
         return mib_node_search(group, name, op, req_sub_oid, req_val, req_val_type)
     end
-    core.mib_node_reg(oid, mib_search_handler)
+    core.mib_node_reg(oid, mib_search_handler, true)
 end
 
 -- unregister an mib group node
@@ -901,7 +1031,13 @@ _M.mib_group_indexes_check = function(group, name)
         end
         for i in ipairs(v) do
             print(string.format("\tDim%d:", i))
-            if next(v[i]) then
+            if type(v[i]) == 'userdata' then
+                local index = core.index_next(v[i], {}, 1)
+                while index ~= nil do
+                    print("\t", unpack(index))
+                    index = core.index_next(v[i], index, 1)
+                end
+            elseif next(v[i]) then
                 if type(v[i][1]) == 'number' then
                     if v[i] == nil or next(v[i]) == nil then
                         crashed = true
@@ -0,0 +1,48 @@
+-- 
+-- This file is part of SmithSNMP
+-- Copyright (C) 2014, Credo Semiconductor Inc.
+-- Copyright (C) 2015, Leo Ma <begeekmyfriend@gmail.com>
+-- 
+-- This program is free software; you can redistribute it and/or modify
+-- it under the terms of the GNU General Public License as published by
+-- the Free Software Foundation; either version 2 of the License, or
+-- (at your option) any later version.
+-- 
+-- This program is distributed in the hope that it will be useful,
+-- but WITHOUT ANY WARRANTY; without even the implied warranty of
+-- MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+-- GNU General Public License for more details.
+-- 
+-- You should have received a copy of the GNU General Public License along
+-- with this program; if not, write to the Free Software Foundation, Inc.,
+-- 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+-- 
+
+
+local mib = require "smithsnmp"
+
+-- scalar index
+local cacheHits           = 1
+local cacheMisses         = 2
+local cacheEntries        = 3
+local arenaPeak           = 4
+local rxDgrams            = 5
+local txDgrams            = 6
+local txDrops             = 7
+
+-- Counter32 wraps around
+local counter = function (n)
+    return n % 4294967296
+end
+
+local agentStatsGroup = {
+    [cacheHits]    = mib.ConstCount(function () return counter(mib.cache_stats().hits) end),
+    [cacheMisses]  = mib.ConstCount(function () return counter(mib.cache_stats().misses) end),
+    [cacheEntries] = mib.ConstGauge(function () return mib.cache_stats().entries end),
+    [arenaPeak]    = mib.ConstGauge(function () return mib.arena_stats().peak end),
+    [rxDgrams]     = mib.ConstCount(function () return counter(mib.transport_stats().rx_dgrams) end),
+    [txDgrams]     = mib.ConstCount(function () return counter(mib.transport_stats().tx_dgrams) end),
+    [txDrops]      = mib.ConstCount(function () return counter(mib.transport_stats().tx_drops) end),
+}
+
+return agentStatsGroup
@@ -108,13 +108,13 @@ local sysMethods = {
 mib.module_method_register(sysMethods)
 
 local sysGroup = {
-    [sysDesc]         = mib.ConstOctString(function () return mib.sh_call("uname -a", "*line") end),
-    [sysObjectID]     = mib.ConstOid(function () return { 1, 3, 6, 1, 2, 1, 1 } end),
+    [sysDesc]         = mib.ConstOctString(function () return mib.sh_call("uname -a", "*line") end, { ttl = 60 }),
+    [sysObjectID]     = mib.ConstOid(function () return { 1, 3, 6, 1, 2, 1, 1 } end, { ttl = 60 }),
     [sysUpTime]       = mib.ConstTimeticks(function () return os.difftime(os.time(), startup_time) * 100 end),
-    [sysContact]      = mib.ConstOctString(function () return "Me <Me@example.org>" end),
-    [sysName]         = mib.ConstOctString(function () return mib.sh_call("uname -n", "*line") end),
-    [sysLocation]     = mib.ConstOctString(function () return "Shanghai" end),
-    [sysServices]     = mib.ConstInt(function () return 72 end),
+    [sysContact]      = mib.ConstOctString(function () return "Me <Me@example.org>" end, { ttl = 60 }),
+    [sysName]         = mib.ConstOctString(function () return mib.sh_call("uname -n", "*line") end, { ttl = 60 }),
+    [sysLocation]     = mib.ConstOctString(function () return "Shanghai" end, { ttl = 60 }),
+    [sysServices]     = mib.ConstInt(function () return 72 end, { ttl = 60 }),
     [sysORLastChange] = mib.ConstTimeticks(function () return os.difftime(os.time(), or_last_changed_time) * 100 end),
     [sysORTable]      = {
         [sysOREntry]  = {
@@ -21,7 +21,7 @@
 local mib = require "smithsnmp"
 
 local tcp_scalar_cache = {}
-local tcp_conn_entry_cache = {}
+local tcp_conn_entry_cache = mib.Indexes({})
 --[[
     ["0.0.0.0.22.0.0.0.0.0"] = { conn_stat = 1 },
     ["10.2.12.229.33874.91.189.92.10.443"] = { conn_stat = 8 },
@@ -94,7 +94,10 @@ end
 
 local __load_config = function()
     tcp_scalar_cache = {}
-    tcp_conn_entry_cache = {}
+    -- Refill in place as the table group refers to it
+    for key in pairs(tcp_conn_entry_cache) do
+        tcp_conn_entry_cache[key] = nil
+    end
     for line in io.lines("/proc/net/snmp") do
         if string.match(line, "%w+") == 'Tcp' then
             for w in string.gmatch(line, "%d+") do
@@ -119,6 +122,7 @@ local __load_config = function()
             tcp_conn_entry_cache[table.concat(key, '.')].conn_stat = tcp_snmp_conn_stat_map[conn_stat]
         end
     end
+    mib.indexes_changed(tcp_conn_entry_cache)
 end
 
 local last_load_time = os.time()
@@ -0,0 +1,27 @@
+mmsg_test = """
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+int main(void)
+{
+  struct mmsghdr msgs[2];
+  int sock = socket(AF_INET, SOCK_DGRAM, 0);
+
+  if (sock < 0)
+    exit(-1);
+
+  memset(msgs, 0, sizeof(msgs));
+  recvmmsg(sock, msgs, 2, MSG_DONTWAIT, NULL);
+  sendmmsg(sock, msgs, 0, 0);
+
+  return 0;
+}
+"""
+def CheckMmsg(context):
+  context.Message("Checking for recvmmsg/sendmmsg...")
+  result = context.TryLink(mmsg_test, '.c')
+  context.Result(result)
+  return result
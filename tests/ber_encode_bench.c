@@ -0,0 +1,187 @@
+/*
+ * This file is part of SmithSNMP
+ * Copyright (C) 2014, Credo Semiconductor Inc.
+ * Copyright (C) 2015, Leo Ma <begeekmyfriend@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ */
+
+/*
+ * Micro benchmark of response encoding, GET responses of scalars and
+ * GETBULK responses of table rows with varying number of varbinds.
+ *
+ * Build and run from the top directory:
+ *   gcc -std=c99 -O2 -D_XOPEN_SOURCE=600 -DLITTLE_ENDIAN -DDISABLE_CRYPTO -iquote core \
+ *       -I/usr/include/lua5.1 tests/ber_encode_bench.c core/snmp_msg_out.c \
+ *       core/snmp_encoder.c -o ber_encode_bench
+ *   ./ber_encode_bench
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "mib.h"
+#include "snmp.h"
+#include "protocol.h"
+
+#define ROUNDS  20000
+
+struct arena_stats snmp_arena_stats;
+const uint8_t snmpv3_engine_id[] = {
+  0x80, 0x00, 0x00, 0x00,
+  0x04,
+  's', 'm', 'i', 't', 'h', 's', 'n', 'm', 'p'
+};
+
+static unsigned long sent;
+
+static void
+bench_send(uint8_t *buf, int len, void *peer)
+{
+  sent += len + buf[len - 1];
+}
+
+struct protocol_operation snmp_prot_ops = {
+  "bench",
+  NULL, NULL, NULL, NULL, NULL, NULL, NULL,
+  bench_send,
+  NULL, NULL,
+};
+
+static double
+now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+#define COLUMNS  22
+
+static const oid_t scalar[] = { 1, 3, 6, 1, 2, 1, 1, 0, 0 };
+static const oid_t column[] = { 1, 3, 6, 1, 2, 1, 2, 2, 1, 0, 0 };
+
+/* Encoded oids of table columns as cached by instance nodes of mib tree */
+static uint8_t column_ber[COLUMNS][16];
+static uint32_t column_ber_len[COLUMNS];
+
+/* Search result of varbind i, a scalar for GET or a table cell for GETBULK */
+static void
+result_fill(struct oid_search_res *ret_oid, int bulk, int i)
+{
+  if (!bulk) {
+    memcpy(ret_oid->oid, scalar, sizeof(scalar));
+    ret_oid->oid[7] = 1 + i % 9;
+    ret_oid->id_len = elem_num(scalar);
+    ret_oid->inst_id = ret_oid->oid + 8;
+  } else {
+    memcpy(ret_oid->oid, column, sizeof(column));
+    ret_oid->oid[9] = 1 + i % COLUMNS;
+    ret_oid->oid[10] = 1 + i / COLUMNS;
+    ret_oid->id_len = elem_num(column);
+    ret_oid->inst_id = ret_oid->oid + 10;
+    ret_oid->ber_prefix = column_ber[i % COLUMNS];
+    ret_oid->ber_prefix_len = column_ber_len[i % COLUMNS];
+  }
+
+  if (i % 3) {
+    tag(&ret_oid->var) = ASN1_TAG_INT;
+    length(&ret_oid->var) = 1;
+    integer(&ret_oid->var) = i * 1000;
+  } else {
+    tag(&ret_oid->var) = ASN1_TAG_OCTSTR;
+    length(&ret_oid->var) = 8 + i % 16;
+    octstr(&ret_oid->var) = "smithsnmp varbind value";
+  }
+}
+
+/* Nanoseconds per response of n varbinds */
+static double
+bench(struct snmp_datagram *sdg, int bulk, int n)
+{
+  struct oid_search_res ret_oid;
+  oid_t oid_buf[ASN1_OID_MAX_LEN];
+  int i, r;
+  double t;
+
+  memset(&ret_oid, 0, sizeof(ret_oid));
+  ret_oid.oid = oid_buf;
+
+  t = now();
+  for (r = 0; r < ROUNDS; r++) {
+    sdg->pdu_hdr.pdu_type = SNMP_RESP;
+    sdg->pdu_hdr.req_id = r;
+    sdg->version = 1;
+    strcpy(sdg->context_name, "public");
+    sdg->context_name_len = strlen(sdg->context_name);
+
+    for (i = 0; i < n; i++) {
+      result_fill(&ret_oid, bulk, i);
+      snmp_vb_encode(sdg, &ret_oid, tag(&ret_oid.var));
+    }
+    snmp_response(sdg);
+
+    arena_reset(sdg->arena);
+    sdg->vb_list_len = 0;
+    sdg->vb_out_cnt = 0;
+    sdg->out_buf = NULL;
+    sdg->out_size = 0;
+  }
+
+  return (now() - t) * 1e9 / ROUNDS;
+}
+
+int
+main(void)
+{
+  static const int get_cnt[] = { 1, 4, 16, 64 };
+  static const int bulk_cnt[] = { 10, 100, 400, 1000 };
+  struct snmp_datagram *sdg;
+  double t;
+  int i;
+
+  for (i = 0; i < COLUMNS; i++) {
+    oid_t oid[elem_num(column) - 1];
+    memcpy(oid, column, sizeof(oid));
+    oid[9] = 1 + i;
+    column_ber_len[i] = ber_value_enc(oid, elem_num(oid), ASN1_TAG_OBJID, column_ber[i]);
+  }
+
+  sdg = xcalloc(1, sizeof(*sdg));
+  sdg->arena = arena_new(SNMP_ARENA_SIZE, &snmp_arena_stats);
+
+  printf("%8s %8s %12s %12s\n", "request", "varbinds", "ns/response", "ns/varbind");
+
+  for (i = 0; i < elem_num(get_cnt); i++) {
+    t = bench(sdg, 0, get_cnt[i]);
+    printf("%8s %8d %12.1f %12.1f\n", "get", get_cnt[i], t, t / get_cnt[i]);
+  }
+
+  for (i = 0; i < elem_num(bulk_cnt); i++) {
+    t = bench(sdg, 1, bulk_cnt[i]);
+    printf("%8s %8d %12.1f %12.1f\n", "getbulk", bulk_cnt[i], t, t / bulk_cnt[i]);
+  }
+
+  if (sent == 1) {
+    printf("\n");
+  }
+
+  arena_free(sdg->arena);
+  free(sdg);
+  return 0;
+}
@@ -1,6 +1,6 @@
 #!/bin/sh
 
-export NET_SNMP_VERSION=5.7.3
+export NET_SNMP_VERSION=5.8
 export NET_SNMP_SRC_URL=https://sourceforge.net/projects/net-snmp/files/net-snmp/${NET_SNMP_VERSION}/net-snmp-${NET_SNMP_VERSION}.tar.gz
 export NET_SNMP_ROOT_DIR=`pwd`/tests
 
@@ -0,0 +1,119 @@
+/*
+ * This file is part of SmithSNMP
+ * Copyright (C) 2014, Credo Semiconductor Inc.
+ * Copyright (C) 2015, Leo Ma <begeekmyfriend@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ */
+
+/*
+ * Micro benchmark of sub-id search in group nodes of synthetic widths,
+ * scalar search against the SIMD one picked by mib_search_init().
+ *
+ * Build and run from the top directory:
+ *   gcc -std=c99 -O2 -D_XOPEN_SOURCE=600 -iquote core -I/usr/include/lua5.1 \
+ *       tests/oid_search_bench.c core/mib_search.c -o oid_search_bench
+ *   ./oid_search_bench
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "mib.h"
+
+#define QUERIES  4096
+#define ROUNDS   5000
+
+static double
+now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Reference result by linear search */
+static int
+linear_search(const oid_t *array, int n, oid_t oid)
+{
+  int i;
+  for (i = 0; i < n && array[i] < oid; i++);
+  return i < n && array[i] == oid ? i : -i - 1;
+}
+
+/* Nanoseconds per search, each query depends on the last result */
+static double
+bench(const oid_t *array, int n, const oid_t *query)
+{
+  int i, r;
+  long sum = 0;
+  double t = now();
+
+  for (r = 0; r < ROUNDS; r++) {
+    for (i = 0; i < QUERIES; i++) {
+      sum += oid_binary_search(array, n, query[(i + (sum & 1)) % QUERIES]);
+    }
+  }
+
+  t = now() - t;
+  if (sum == 1) {
+    printf("\n");
+  }
+  return t * 1e9 / ((double)ROUNDS * QUERIES);
+}
+
+int
+main(void)
+{
+  static const int width[] = { 8, 32, 64, 200, 500, 2000 };
+  oid_t query[QUERIES];
+  int i, w;
+
+  srand(1);
+  printf("%8s %12s %12s\n", "sub-ids", "scalar(ns)", "simd(ns)");
+
+  for (w = 0; w < sizeof(width) / sizeof(width[0]); w++) {
+    int n = width[w];
+    oid_t *array = malloc(n * sizeof(oid_t));
+    double scalar, simd;
+
+    /* Sparse ascending sub-ids, two thirds of queries hit */
+    for (i = 0; i < n; i++) {
+      array[i] = (i ? array[i - 1] : 0) + 1 + rand() % 3;
+    }
+    for (i = 0; i < QUERIES; i++) {
+      query[i] = rand() % 3 ? array[rand() % n] : rand() % (array[n - 1] + 2);
+    }
+
+    /* Scalar search until mib_search_init() picks the SIMD one */
+    scalar = bench(array, n, query);
+    mib_search_init();
+    simd = bench(array, n, query);
+
+    for (i = 0; i < QUERIES; i++) {
+      if (oid_binary_search(array, n, query[i]) != linear_search(array, n, query[i])) {
+        printf("sub-ids %d: wrong result for %u\n", n, query[i]);
+        return 1;
+      }
+    }
+
+    printf("%8d %12.2f %12.2f\n", n, scalar, simd);
+    free(array);
+  }
+
+  return 0;
+}
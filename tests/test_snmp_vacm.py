@@ -0,0 +1,60 @@
+import unittest
+from smithsnmp_testcases import *
+
+class SNMPVACMTestCase(unittest.TestCase, SmithSNMPTestFramework):
+	def setUp(self):
+		self.snmp_setup("config/snmp_vacm.conf")
+		self.version = "2c"
+		self.community = "public"
+		self.ip = "127.0.0.1"
+		self.port = 161
+		if self.snmp.isalive() == False:
+			self.snmp.read()
+			raise Exception("SNMP daemon start error!")
+
+	def tearDown(self):
+		if self.snmp.isalive() == False:
+			self.snmp.read()
+			raise Exception("SNMP daemon start error!")
+		self.snmp_teardown()
+
+	def test_vacm_get(self):
+		# row 1 of ifTable is excluded in every column
+		self.snmpget_expect(".1.3.6.1.2.1.2.2.1.2.1", SNMPNoSuchObject())
+		self.snmpget_expect(".1.3.6.1.2.1.2.2.1.1.1", SNMPNoSuchObject())
+		self.snmpget_expect(".1.3.6.1.2.1.2.2.1.2.2", OctStr("eth0"))
+		self.snmpget_expect(".1.3.6.1.2.1.2.1.0", Integer(5))
+
+	def test_vacm_getnext(self):
+		self.snmpgetnext_expect(".1.3.6.1.2.1.2.2.1.2", ".1.3.6.1.2.1.2.2.1.2.2", OctStr("eth0"))
+		self.snmpgetnext_expect(".1.3.6.1.2.1.2.2.1.1.5", ".1.3.6.1.2.1.2.2.1.2.2", OctStr("eth0"))
+
+	def test_vacm_walk(self):
+		results = self.snmpwalk(".1.3.6.1.2.1.2.2.1.1")
+		assert([r["oid"] for r in results] == [".1.3.6.1.2.1.2.2.1.1.%d" % i for i in range(2, 6)])
+		results = self.snmpwalk(".1.3.6.1.2.1.2")
+		for r in results:
+			assert(re.match(r"^\.1\.3\.6\.1\.2\.1\.2\.2\.1\.\d+\.1$", r["oid"]) == None)
+		self.snmpwalk_expect(".")
+
+	def test_vacm_set(self):
+		# no write view
+		self.snmpset_expect(".1.3.6.1.2.1.2.2.1.7.2", Integer(1), SNMPNoAccess())
+		self.community = "private"
+		self.snmpset_expect(".1.3.6.1.2.1.2.2.1.7.1", Integer(2), SNMPNoAccess())
+		self.snmpset_expect(".1.3.6.1.2.1.2.2.1.7.2", Integer(1), Integer(1))
+
+	def test_vacm_security_level(self):
+		self.version = "3"
+		self.user = "rwAuthUser"
+		self.level = "noAuthNoPriv"
+		# access is given to authenticated requests only
+		self.snmpget_expect(".1.3.6.1.2.1.1.1.0", SNMPNoAccess())
+		self.level = "authNoPriv"
+		self.auth_protocol = "MD5"
+		self.auth_key = "rwAuthUser"
+		self.snmpget_expect(".1.3.6.1.2.1.1.1.0", OctStr(r".*"))
+		self.snmpget_expect(".1.3.6.1.2.1.2.2.1.2.1", SNMPNoSuchObject())
+
+if __name__ == '__main__':
+    unittest.main()
@@ -0,0 +1,25 @@
+import unittest
+from smithsnmp_testcases import *
+
+class SNMPv3TestCase(unittest.TestCase, SmithSNMPTestFramework, SmithSNMPTestCase):
+	def setUp(self):
+		self.snmp_setup("config/snmp.conf")
+		self.version = "3"
+		self.user = "rwAuthSha256User"
+		self.level = "authNoPriv"
+		self.auth_protocol = "SHA-256"
+		self.auth_key = "rwAuthSha256User"
+		self.ip = "127.0.0.1"
+		self.port = 161
+		if self.snmp.isalive() == False:
+			self.snmp.read()
+			raise Exception("SNMP daemon start error!")
+
+	def tearDown(self):
+		if self.snmp.isalive() == False:
+			self.snmp.read()
+			raise Exception("SNMP daemon start error!")
+		self.snmp_teardown()
+
+if __name__ == '__main__':
+    unittest.main()
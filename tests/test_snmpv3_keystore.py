@@ -0,0 +1,69 @@
+import unittest, os, stat
+from smithsnmp_testcases import *
+
+key_store = "tests/usm_keys"
+
+class SNMPv3KeyStoreTestCase(unittest.TestCase, SmithSNMPTestFramework):
+	def setUp(self):
+		if os.path.exists(key_store):
+			os.remove(key_store)
+		self.version = "3"
+		self.ip = "127.0.0.1"
+		self.port = 161
+		self.start()
+
+	def tearDown(self):
+		if self.snmp.isalive() == False:
+			self.snmp.read()
+			raise Exception("SNMP daemon start error!")
+		self.snmp_teardown()
+		os.remove(key_store)
+
+	def start(self):
+		self.snmp_setup("config/snmp_keystore.conf")
+		if self.snmp.isalive() == False:
+			self.snmp.read()
+			raise Exception("SNMP daemon start error!")
+
+	def restart(self):
+		self.snmp_teardown()
+		self.start()
+
+	def auth_get(self):
+		self.user = "rwAuthUser"
+		self.level = "authNoPriv"
+		self.auth_protocol = "MD5"
+		self.auth_key = "rwAuthUser"
+		self.priv_protocol = ""
+		self.priv_key = ""
+		self.snmpget_expect(".1.3.6.1.2.1.2.1.0", Integer(5))
+
+	def auth_priv_get(self):
+		self.user = "rwAuthPrivUser"
+		self.level = "authPriv"
+		self.auth_protocol = "MD5"
+		self.auth_key = "rwAuthPrivUser"
+		self.priv_protocol = "AES"
+		self.priv_key = "rwAuthPrivUser"
+		self.snmpget_expect(".1.3.6.1.2.1.2.2.1.2.2", OctStr("eth0"))
+
+	def test_key_store_create(self):
+		# keys are saved before the first request is served
+		self.auth_get()
+		self.auth_priv_get()
+		# the store holds secrets, readable by the owner only
+		assert(os.path.getsize(key_store) > 0)
+		assert(stat.S_IMODE(os.stat(key_store).st_mode) == 0600)
+
+	def test_key_store_restart(self):
+		self.auth_get()
+		size = os.path.getsize(key_store)
+		for i in range(2):
+			self.restart()
+			self.auth_get()
+			self.auth_priv_get()
+			# keys are all loaded from the store, none derived and appended again
+			assert(os.path.getsize(key_store) == size)
+
+if __name__ == '__main__':
+    unittest.main()
@@ -0,0 +1,171 @@
+/*
+ * This file is part of SmithSNMP
+ * Copyright (C) 2014, Credo Semiconductor Inc.
+ * Copyright (C) 2015, Leo Ma <begeekmyfriend@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ */
+
+
+/*
+ * Throughput benchmark of authNoPriv GET floods: every request of a
+ * receive batch is verified with HMAC-MD5-96 or HMAC-SHA1-96 and its
+ * response is signed the same way. The scalar path hashes messages one
+ * by one, the multi-buffer path hashes the batch together in vector
+ * lanes, with AVX2 when available.
+ *
+ * Build and run from the top directory:
+ *   gcc -std=c99 -O2 -D_XOPEN_SOURCE=600 -DLITTLE_ENDIAN -iquote core -I3rd/crypto \
+ *       -I/usr/include/lua5.1 tests/usm_auth_bench.c 3rd/crypto/openssl_md5*.c \
+ *       3rd/crypto/openssl_sha.c 3rd/crypto/openssl_sha_mb.c -o usm_auth_bench
+ *   ./usm_auth_bench
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "mib.h"
+#include "snmp.h"
+
+#define MESSAGES  (1 << 20)
+/* Bytes of an authNoPriv GET request and its response */
+#define REQ_LEN   96
+#define RESP_LEN  128
+#define USERS     16
+
+static uint32_t ipad[USERS][AUTH_STATE_LEN], opad[USERS][AUTH_STATE_LEN];
+static unsigned char req[SNMP_BATCH_MAX][REQ_LEN], resp[SNMP_BATCH_MAX][RESP_LEN];
+static unsigned char mac[SNMP_BATCH_MAX][2][SNMP_MSG_AUTH_PARA_LEN];
+static struct hmac_job jobs[SNMP_BATCH_MAX];
+
+typedef int (*hmac_f)(const unsigned char *data, size_t len, unsigned char *mac, size_t maclen, const uint32_t *ipad, const uint32_t *opad);
+typedef int (*hmac_mb_f)(const struct hmac_job *jobs, unsigned int n, size_t maclen);
+
+static double
+now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Verify requests and sign responses of a batch one by one */
+static void
+scalar(hmac_f hmac, int n)
+{
+  int i;
+
+  for (i = 0; i < n; i++) {
+    hmac(req[i], REQ_LEN, mac[i][0], SNMP_MSG_AUTH_PARA_LEN, ipad[i % USERS], opad[i % USERS]);
+  }
+  for (i = 0; i < n; i++) {
+    hmac(resp[i], RESP_LEN, mac[i][1], SNMP_MSG_AUTH_PARA_LEN, ipad[i % USERS], opad[i % USERS]);
+  }
+}
+
+/* Verify requests and sign responses of a batch together */
+static void
+multi(hmac_mb_f hmac_mb, int n)
+{
+  int i;
+
+  for (i = 0; i < n; i++) {
+    jobs[i].data = req[i];
+    jobs[i].len = REQ_LEN;
+    jobs[i].mac = mac[i][0];
+    jobs[i].ipad = ipad[i % USERS];
+    jobs[i].opad = opad[i % USERS];
+  }
+  hmac_mb(jobs, n, SNMP_MSG_AUTH_PARA_LEN);
+
+  for (i = 0; i < n; i++) {
+    jobs[i].data = resp[i];
+    jobs[i].len = RESP_LEN;
+    jobs[i].mac = mac[i][1];
+  }
+  hmac_mb(jobs, n, SNMP_MSG_AUTH_PARA_LEN);
+}
+
+/* Nanoseconds per request of batches of n, 0 when the paths disagree */
+static double
+bench(int mb, hmac_f hmac, hmac_mb_f hmac_mb, int n)
+{
+  unsigned char want[SNMP_BATCH_MAX][2][SNMP_MSG_AUTH_PARA_LEN];
+  int r, rounds = MESSAGES / n;
+  double t;
+
+  scalar(hmac, n);
+  memcpy(want, mac, sizeof(want));
+  multi(hmac_mb, n);
+  if (memcmp(want, mac, sizeof(want))) {
+    return 0;
+  }
+
+  t = now();
+  for (r = 0; r < rounds; r++) {
+    if (mb) {
+      multi(hmac_mb, n);
+    } else {
+      scalar(hmac, n);
+    }
+  }
+  return (now() - t) * 1e9 / ((double)rounds * n);
+}
+
+int
+main(void)
+{
+  static const int batches[] = { 1, 2, 4, 8, 16, 32 };
+  unsigned char key[SHA1_KEY_LEN];
+  double t0, t1;
+  int i, alg;
+
+  for (i = 0; i < SNMP_BATCH_MAX; i++) {
+    memset(req[i], 0x30 + i, REQ_LEN);
+    memset(resp[i], 0x60 + i, RESP_LEN);
+  }
+
+  printf("%6s %6s %14s %14s %8s\n", "hash", "batch", "scalar ns/req", "multi ns/req", "speedup");
+  for (alg = 0; alg < 2; alg++) {
+    for (i = 0; i < USERS; i++) {
+      memset(key, 'k' + i, sizeof(key));
+      if (alg == 0) {
+        MD5_hmac_prepare(key, MD5_KEY_LEN, ipad[i], opad[i]);
+      } else {
+        SHA1_hmac_prepare(key, SHA1_KEY_LEN, ipad[i], opad[i]);
+      }
+    }
+
+    for (i = 0; i < elem_num(batches); i++) {
+      if (alg == 0) {
+        t0 = bench(0, MD5_hmac_prepared, MD5_hmac_prepared_mb, batches[i]);
+        t1 = bench(1, MD5_hmac_prepared, MD5_hmac_prepared_mb, batches[i]);
+      } else {
+        t0 = bench(0, SHA1_hmac_prepared, SHA1_hmac_prepared_mb, batches[i]);
+        t1 = bench(1, SHA1_hmac_prepared, SHA1_hmac_prepared_mb, batches[i]);
+      }
+      if (t0 == 0 || t1 == 0) {
+        printf("mismatch at batch %d\n", batches[i]);
+        return 1;
+      }
+      printf("%6s %6d %14.1f %14.1f %8.2f\n", alg ? "sha1" : "md5", batches[i], t0, t1, t0 / t1);
+    }
+  }
+
+  return 0;
+}
@@ -0,0 +1,132 @@
+/*
+ * This file is part of SmithSNMP
+ * Copyright (C) 2014, Credo Semiconductor Inc.
+ * Copyright (C) 2015, Leo Ma <begeekmyfriend@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ */
+
+/*
+ * Throughput benchmark of authPriv GETBULK responses: encrypting the
+ * scoped PDU with AES-CFB128 and signing the message with HMAC-SHA1-96.
+ * The baseline expands the AES key and hashes the HMAC key pads for
+ * every message as before. The cached path uses the round keys and pad
+ * states kept by the user, with AES-NI or ARMv8 AES when available.
+ *
+ * Build and run from the top directory:
+ *   gcc -std=c99 -O2 -D_XOPEN_SOURCE=600 -DLITTLE_ENDIAN -iquote core -I3rd/crypto \
+ *       -I/usr/include/lua5.1 tests/usm_priv_bench.c 3rd/crypto/openssl_aes*.c \
+ *       3rd/crypto/openssl_cfb128.c 3rd/crypto/openssl_sha.c -o usm_priv_bench
+ *   ./usm_priv_bench
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "openssl_aes.h"
+#include "mib.h"
+#include "snmp.h"
+
+#define BYTES  (64 << 20)
+
+static const unsigned char key[AES_KEY_LEN] = "smithsnmp-priv!";
+static const unsigned char auth[SHA1_KEY_LEN] = "smithsnmp-auth-key!";
+static const unsigned char iv[AES_SECRETKEYLEN] = "0123456789abcde";
+
+static double
+now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Encrypt and sign a response of len bytes as before */
+static void
+baseline(unsigned char *msg, unsigned int len, unsigned char *mac)
+{
+  AES_KEY aes_key;
+  unsigned char my_iv[AES_SECRETKEYLEN];
+  int num = 0;
+
+  memcpy(my_iv, iv, sizeof(my_iv));
+  AES_set_encrypt_key(key, AES_SECRETKEYLEN * 8, &aes_key);
+  AES_cfb128_encrypt(msg, msg, len, &aes_key, my_iv, &num, AES_ENCRYPT);
+  SHA1_hmac(msg, len, mac, 12, auth, sizeof(auth));
+}
+
+/* Encrypt and sign with round keys and pad states of the user */
+static void
+cached(const struct mib_user *u, unsigned char *msg, unsigned int len, unsigned char *mac)
+{
+  unsigned int clen = len;
+
+  AES_Encrypt(u->priv_sched, iv, sizeof(iv), msg, len, msg, &clen);
+  SHA1_hmac_prepared(msg, len, mac, 12, u->auth_ipad, u->auth_opad);
+}
+
+int
+main(void)
+{
+  static const unsigned int sizes[] = { 64, 484, 1400, 8000 };
+  struct mib_user u;
+  unsigned char *a, *b, mac_a[12], mac_b[12];
+  unsigned int i, n, r;
+  double t0, t1;
+
+  memset(&u, 0, sizeof(u));
+  AES_Schedule(key, sizeof(key), u.priv_sched);
+  SHA1_hmac_prepare(auth, sizeof(auth), u.auth_ipad, u.auth_opad);
+
+  a = malloc(sizes[elem_num(sizes) - 1]);
+  b = malloc(sizes[elem_num(sizes) - 1]);
+
+  printf("%8s %14s %14s %8s\n", "bytes", "baseline MB/s", "cached MB/s", "speedup");
+  for (i = 0; i < elem_num(sizes); i++) {
+    n = BYTES / sizes[i];
+
+    /* Both paths must produce the same message */
+    memset(a, 0x5a, sizes[i]);
+    memset(b, 0x5a, sizes[i]);
+    baseline(a, sizes[i], mac_a);
+    cached(&u, b, sizes[i], mac_b);
+    if (memcmp(a, b, sizes[i]) || memcmp(mac_a, mac_b, sizeof(mac_a))) {
+      printf("mismatch at %u bytes\n", sizes[i]);
+      return 1;
+    }
+
+    t0 = now();
+    for (r = 0; r < n; r++) {
+      baseline(a, sizes[i], mac_a);
+    }
+    t0 = now() - t0;
+
+    t1 = now();
+    for (r = 0; r < n; r++) {
+      cached(&u, b, sizes[i], mac_b);
+    }
+    t1 = now() - t1;
+
+    printf("%8u %14.1f %14.1f %8.2f\n", sizes[i],
+           (double)n * sizes[i] / t0 / 1e6, (double)n * sizes[i] / t1 / 1e6, t0 / t1);
+  }
+
+  free(a);
+  free(b);
+  return 0;
+}